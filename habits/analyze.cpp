@@ -0,0 +1,451 @@
+#include "analyze.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "moves.hpp"
+#include "pgn.hpp"
+#include "position.hpp"
+#include "search.hpp"
+
+namespace habits {
+
+namespace {
+
+// Lines are analyzed in chunks, to keep the locking off the per-position path.
+constexpr size_t LINES_PER_CHUNK = 64;
+
+// How many chunks may be read ahead of the oldest one that hasn't been written
+// out yet, per thread.
+constexpr size_t CHUNKS_PER_THREAD = 4;
+
+constexpr std::string_view SPACES = " \t\r\n";
+constexpr std::string_view OPERATION_DELIMITERS = " \t\r\n;";
+
+// Find the end of the whitespace separated field at or after `i`. Returns npos
+// if there is no field.
+size_t fieldEnd(std::string_view line, size_t i) {
+  i = line.find_first_not_of(SPACES, i);
+  if (i == std::string_view::npos) {
+    return i;
+  }
+  size_t end = line.find_first_of(SPACES, i);
+  return end == std::string_view::npos ? line.size() : end;
+}
+
+bool isNumber(std::string_view line, size_t begin, size_t end) {
+  std::string_view field = line.substr(begin, end - begin);
+  size_t start = field.find_first_not_of(SPACES);
+  return start != std::string_view::npos &&
+         std::all_of(field.begin() + start, field.end(), [](char c) {
+           return std::isdigit(static_cast<unsigned char>(c));
+         });
+}
+
+bool isSquare(std::string_view square) {
+  return square[0] >= 'a' && square[0] <= 'h' && square[1] >= '1' &&
+         square[1] <= '8';
+}
+
+// Convert a best move in SAN, or check one in UCI notation, against the legal
+// moves. Returns 0 on success, or 1 if the move is not legal.
+int bestMoveToUci(const Position& p, const LegalMoves& legal_moves,
+                  std::string_view move, std::string* uci) {
+  if (sanToUci(p, legal_moves, move, uci) == 0) {
+    return 0;
+  }
+  if (move.size() < 4 || move.size() > 5 || !isSquare(move.substr(0, 2)) ||
+      !isSquare(move.substr(2, 2))) {
+    return 1;
+  }
+  Square from(move.substr(0, 2));
+  PieceMove to(Square(move.substr(2, 2)),
+               move.size() == 5 ? parsePromotion(move[4]) : PAWN);
+  for (const auto& [piece_on_square, moves] : legal_moves.Moves()) {
+    if (piece_on_square.square == from &&
+        std::find(moves.begin(), moves.end(), to) != moves.end()) {
+      *uci = from.Algebraic() + to.square.Algebraic();
+      if (to.promote_to != PAWN) {
+        *uci += toPromotion(to.promote_to);
+      }
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// A chunk of input lines, and the results of analyzing them.
+struct Chunk {
+  uint64_t first_line = 0;
+  std::vector<std::string> lines;
+  std::string output;
+  AnalyzeStats stats;
+  bool done = false;
+};
+
+void analyzeChunk(Chunk* chunk, const AnalyzeOptions& options) {
+  for (size_t i = 0; i < chunk->lines.size(); i++) {
+    std::string_view line = chunk->lines[i];
+    size_t start = line.find_first_not_of(SPACES);
+    if (start == std::string_view::npos || line[start] == '#') {
+      continue;
+    }
+    chunk->output += analyzeLine(line.substr(start), chunk->first_line + i,
+                                 &chunk->stats, options)
+                         .dump();
+    chunk->output += '\n';
+  }
+}
+
+// Analyzes chunks on worker threads, and writes the results out in the order
+// the chunks were added.
+class AnalyzePipeline {
+ public:
+  AnalyzePipeline(std::ostream& output, int threads,
+                  const AnalyzeOptions& options)
+      : output_(output),
+        options_(options),
+        max_in_flight_(static_cast<size_t>(threads) * CHUNKS_PER_THREAD) {
+    for (int thread = 0; thread < threads; thread++) {
+      workers_.emplace_back([this]() { work(); });
+    }
+  }
+
+  // Queue a chunk for analysis, writing out the results of earlier chunks as
+  // they are ready. Blocks while too many chunks are in flight.
+  void Add(std::unique_ptr<Chunk> chunk) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_flight_.push_back(std::move(chunk));
+    }
+    work_ready_.notify_one();
+    writeChunks(max_in_flight_);
+  }
+
+  // Wait for all the chunks to be analyzed and written out.
+  AnalyzeStats Finish() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    work_ready_.notify_all();
+    writeChunks(0);
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+    return stats_;
+  }
+
+ private:
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      work_ready_.wait(
+          lock, [this]() { return closed_ || claimed_ < in_flight_.size(); });
+      if (claimed_ == in_flight_.size()) {
+        return;
+      }
+      Chunk* chunk = in_flight_[claimed_++].get();
+      lock.unlock();
+      analyzeChunk(chunk, options_);
+      lock.lock();
+      chunk->done = true;
+      chunk_done_.notify_one();
+    }
+  }
+
+  // Write out the analyzed chunks at the front, waiting for more to be
+  // analyzed while there are more than `max_in_flight` chunks in flight.
+  void writeChunks(size_t max_in_flight) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!in_flight_.empty() &&
+           (in_flight_.front()->done || in_flight_.size() > max_in_flight)) {
+      chunk_done_.wait(lock, [this]() { return in_flight_.front()->done; });
+      std::unique_ptr<Chunk> chunk = std::move(in_flight_.front());
+      in_flight_.pop_front();
+      claimed_--;
+      lock.unlock();
+      output_ << chunk->output;
+      stats_.Add(chunk->stats);
+      lock.lock();
+    }
+  }
+
+  std::ostream& output_;
+  const AnalyzeOptions options_;
+  const size_t max_in_flight_;
+  std::vector<std::thread> workers_;
+  AnalyzeStats stats_;
+
+  std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable chunk_done_;
+  // The chunks in input order, of which the first `claimed_` have been taken
+  // by the workers.
+  std::deque<std::unique_ptr<Chunk>> in_flight_;
+  size_t claimed_ = 0;
+  bool closed_ = false;
+};
+
+}  // namespace
+
+const char* epdErrorName(EpdError error) {
+  switch (error) {
+    case EPD_OK:
+      return "ok";
+    case EPD_BAD_POSITION:
+      return "bad position";
+    case EPD_BAD_OPERATION:
+      return "bad operation";
+    case EPD_BAD_BEST_MOVE:
+      return "bad best move";
+  }
+  return "unknown";
+}
+
+EpdError parseEpd(std::string_view line, EpdRecord* record) {
+  *record = EpdRecord();
+
+  // The position is the first four fields, and the clocks if the next two
+  // fields are numbers (as they are in a FEN, but not in an EPD).
+  size_t start = line.find_first_not_of(SPACES);
+  if (start == std::string_view::npos) {
+    record->fen_error = FEN_BAD_BOARD;
+    return EPD_BAD_POSITION;
+  }
+  size_t position_end = start;
+  for (int field = 0; field < 4 && position_end != std::string_view::npos;
+       field++) {
+    position_end = fieldEnd(line, position_end);
+  }
+  if (position_end == std::string_view::npos) {
+    position_end = line.size();
+  }
+  size_t halfmove_end = fieldEnd(line, position_end);
+  size_t fullmove_end = halfmove_end == std::string_view::npos
+                            ? halfmove_end
+                            : fieldEnd(line, halfmove_end);
+  if (fullmove_end != std::string_view::npos &&
+      isNumber(line, position_end, halfmove_end) &&
+      isNumber(line, halfmove_end, fullmove_end)) {
+    position_end = fullmove_end;
+  }
+  record->fen_error = Position::ParseFen(
+      line.substr(start, position_end - start), &record->position);
+  if (record->fen_error != FEN_OK) {
+    return EPD_BAD_POSITION;
+  }
+
+  // Each operation is an opcode followed by operands, ended by a semicolon.
+  std::unique_ptr<LegalMoves> legal_moves;
+  size_t i = position_end;
+  while ((i = line.find_first_not_of(SPACES, i)) != std::string_view::npos) {
+    size_t opcode_end =
+        std::min(line.find_first_of(OPERATION_DELIMITERS, i), line.size());
+    std::string_view opcode = line.substr(i, opcode_end - i);
+    std::vector<std::string_view> operands;
+    for (i = opcode_end; i < line.size() && line[i] != ';';) {
+      if (line[i] == '"') {
+        size_t quote_end = line.find('"', i + 1);
+        if (quote_end == std::string_view::npos) {
+          return EPD_BAD_OPERATION;
+        }
+        operands.push_back(line.substr(i + 1, quote_end - i - 1));
+        i = quote_end + 1;
+      } else if (SPACES.find(line[i]) == std::string_view::npos) {
+        size_t operand_end = std::min(
+            line.find_first_of(OPERATION_DELIMITERS, i), line.size());
+        operands.push_back(line.substr(i, operand_end - i));
+        i = operand_end;
+      } else {
+        i++;
+      }
+    }
+    i++;
+
+    if (opcode == "id" && !operands.empty()) {
+      record->id = operands[0];
+    } else if (opcode == "bm") {
+      if (operands.empty()) {
+        return EPD_BAD_OPERATION;
+      }
+      if (legal_moves == nullptr) {
+        legal_moves = std::make_unique<LegalMoves>(record->position);
+      }
+      for (std::string_view operand : operands) {
+        std::string uci;
+        if (bestMoveToUci(record->position, *legal_moves, operand, &uci) !=
+            0) {
+          return EPD_BAD_BEST_MOVE;
+        }
+        record->best_moves.push_back(uci);
+      }
+    }
+  }
+  return EPD_OK;
+}
+
+void AnalyzeStats::Add(const AnalyzeStats& other) {
+  positions += other.positions;
+  errors += other.errors;
+  scored += other.scored;
+  correct += other.correct;
+}
+
+nlohmann::json analyzeLine(std::string_view line, uint64_t line_number,
+                           AnalyzeStats* stats,
+                           const AnalyzeOptions& options) {
+  nlohmann::json result;
+  result["line"] = line_number;
+  EpdRecord record;
+  EpdError error = parseEpd(line, &record);
+  if (error != EPD_OK) {
+    stats->errors++;
+    result["error"] = error == EPD_BAD_POSITION
+                          ? fenErrorName(record.fen_error)
+                          : epdErrorName(error);
+    return result;
+  }
+  stats->positions++;
+
+  const Position& p = record.position;
+  if (!record.id.empty()) {
+    result["id"] = record.id;
+  }
+  result["fen"] = p.ToFen();
+  if (options.legal) {
+    result["legal"] = LegalMoves(p).ToJson();
+  }
+  if (options.control) {
+    // Always give the control squares from white's perspective.
+    result["control"] =
+        ControlSquares(p.active_color == WHITE ? p : p.ForOpponent()).ToJson();
+  }
+  if (!options.best_move) {
+    return result;
+  }
+
+  Game game;
+  Decision decision = game.bestMove(p);
+  result["move"] = decision.move;
+  result["rule"] = ruleName(decision.rule);
+  if (!record.best_moves.empty()) {
+    bool correct = std::find(record.best_moves.begin(),
+                             record.best_moves.end(),
+                             decision.move) != record.best_moves.end();
+    result["bm"] = record.best_moves;
+    result["correct"] = correct;
+    stats->scored++;
+    if (correct) {
+      stats->correct++;
+    }
+  }
+  return result;
+}
+
+AnalyzeStats analyzeStream(std::istream& input, std::ostream& output,
+                           int threads, const AnalyzeOptions& options) {
+  const auto start = std::chrono::steady_clock::now();
+  AnalyzePipeline pipeline(output, std::max(threads, 1), options);
+  uint64_t line_number = 1;
+  auto chunk = std::make_unique<Chunk>();
+  chunk->first_line = line_number;
+  std::string line;
+  while (std::getline(input, line)) {
+    chunk->lines.push_back(std::move(line));
+    line_number++;
+    if (chunk->lines.size() == LINES_PER_CHUNK) {
+      pipeline.Add(std::move(chunk));
+      chunk = std::make_unique<Chunk>();
+      chunk->first_line = line_number;
+    }
+  }
+  if (!chunk->lines.empty()) {
+    pipeline.Add(std::move(chunk));
+  }
+
+  AnalyzeStats stats = pipeline.Finish();
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return stats;
+}
+
+std::string analyzePositions(const std::vector<std::string>& positions,
+                             WorkerPool* pool, AnalyzeStats* stats,
+                             const AnalyzeOptions& options) {
+  const auto start = std::chrono::steady_clock::now();
+  // Shared with the pool's tasks, which may only start after the positions
+  // have all been analyzed.
+  struct Batch {
+    const std::vector<std::string>* positions;
+    AnalyzeOptions options;
+    std::vector<Chunk> chunks;
+    std::atomic<size_t> next_chunk{0};
+    std::mutex mutex;
+    std::condition_variable chunk_done;
+    size_t chunks_done = 0;
+  };
+  auto batch = std::make_shared<Batch>();
+  batch->positions = &positions;
+  batch->options = options;
+  batch->chunks.resize((positions.size() + LINES_PER_CHUNK - 1) /
+                       LINES_PER_CHUNK);
+
+  // Claim and analyze chunks until they have all been claimed.
+  auto analyzeChunks = [](Batch* batch) {
+    size_t c;
+    while ((c = batch->next_chunk++) < batch->chunks.size()) {
+      Chunk& chunk = batch->chunks[c];
+      const size_t begin = c * LINES_PER_CHUNK;
+      const size_t end =
+          std::min(begin + LINES_PER_CHUNK, batch->positions->size());
+      for (size_t i = begin; i < end; i++) {
+        chunk.output += analyzeLine((*batch->positions)[i], i + 1,
+                                    &chunk.stats, batch->options)
+                            .dump();
+        chunk.output += '\n';
+      }
+      std::lock_guard<std::mutex> lock(batch->mutex);
+      batch->chunks_done++;
+      batch->chunk_done.notify_one();
+    }
+  };
+  // This thread is one of the analyzers, so the pool's other threads help.
+  const size_t analyzers = std::min(batch->chunks.size(), pool->Threads());
+  for (size_t i = 1; i < analyzers; i++) {
+    // A full pool leaves more of the chunks to this thread.
+    if (!pool->TrySubmit([batch, analyzeChunks]() {
+          analyzeChunks(batch.get());
+        })) {
+      break;
+    }
+  }
+  analyzeChunks(batch.get());
+
+  // Only chunks already being analyzed by the pool are waited for.
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->chunk_done.wait(
+      lock, [&]() { return batch->chunks_done == batch->chunks.size(); });
+  std::string output;
+  for (const Chunk& chunk : batch->chunks) {
+    output += chunk.output;
+    stats->Add(chunk.stats);
+  }
+  stats->seconds +=
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  return output;
+}
+
+}  // namespace habits
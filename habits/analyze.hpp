@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "position.hpp"
+#include "worker_pool.hpp"
+
+namespace habits {
+
+enum EpdError : int {
+  EPD_OK = 0,
+  EPD_BAD_POSITION,
+  EPD_BAD_OPERATION,
+  EPD_BAD_BEST_MOVE,
+};
+
+// A short human readable description of the error.
+const char* epdErrorName(EpdError error);
+
+// A position read from a line of FEN or EPD, with the EPD operations that are
+// used when analyzing it.
+struct EpdRecord {
+  Position position;
+  // The error in the position, if parsing failed with EPD_BAD_POSITION.
+  FenError fen_error = FEN_OK;
+  // The "id" operation, empty if there is none.
+  std::string id;
+  // The moves of the "bm" (best move) operation in UCI notation.
+  std::vector<std::string> best_moves;
+};
+
+// Parse a line holding either a FEN (with or without the clocks), or an EPD
+// position followed by operations such as: bm Nf3 e4; id "Test 1";
+// The best moves may be in SAN or UCI notation. Returns EPD_OK, or the first
+// error found.
+EpdError parseEpd(std::string_view line, EpdRecord* record);
+
+// Counts from analyzing a file of positions.
+struct AnalyzeStats {
+  uint64_t positions = 0;
+  // Lines that couldn't be parsed.
+  uint64_t errors = 0;
+  // Positions that had best moves to score against, and how many of those the
+  // habits chose one of the best moves in.
+  uint64_t scored = 0;
+  uint64_t correct = 0;
+  double seconds = 0.0;
+
+  double PositionsPerSecond() const {
+    return seconds > 0.0 ? positions / seconds : 0.0;
+  }
+
+  void Add(const AnalyzeStats& other);
+};
+
+// Which results to include when analyzing positions.
+struct AnalyzeOptions {
+  // The legal moves, as in LegalMoves::ToJson.
+  bool legal = true;
+  // The control squares, as in ControlSquares::ToJson.
+  bool control = true;
+  // The move the habits choose, the rule that chose it, and whether it's one
+  // of the EPD best moves.
+  bool best_move = true;
+};
+
+// Analyze a line of FEN or EPD with a new Game, LegalMoves and ControlSquares.
+// `line_number` is included in the result to find the line again.
+nlohmann::json analyzeLine(std::string_view line, uint64_t line_number,
+                           AnalyzeStats* stats,
+                           const AnalyzeOptions& options = AnalyzeOptions());
+
+// Analyze each FEN or EPD line read from `input` on `threads` threads, and
+// write the results to `output` as a line of JSON per position, in the same
+// order as the input. Blank lines and lines starting with '#' are skipped.
+AnalyzeStats analyzeStream(std::istream& input, std::ostream& output,
+                           int threads,
+                           const AnalyzeOptions& options = AnalyzeOptions());
+
+// Analyze the positions (FEN or EPD) in chunks, on the calling thread and on
+// the threads of `pool`, and return the results as a line of JSON per
+// position, in the same order. Nothing is skipped: a blank or invalid
+// position gets a line with its error, and "line" is its 1-based index. The
+// calling thread analyzes every chunk the pool hasn't started, so this doesn't
+// wait on a pool that is full, or that the caller is running on.
+std::string analyzePositions(const std::vector<std::string>& positions,
+                             WorkerPool* pool, AnalyzeStats* stats,
+                             const AnalyzeOptions& options = AnalyzeOptions());
+
+}  // namespace habits
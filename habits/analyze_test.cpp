@@ -0,0 +1,203 @@
+#include "analyze.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+TEST(AnalyzeTest, ParseFen) {
+  EpdRecord record;
+  ASSERT_EQ(parseEpd("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq "
+                     "e3 0 1",
+                     &record),
+            EPD_OK);
+  EXPECT_EQ(record.position.ToFen(),
+            "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1");
+  EXPECT_EQ(record.id, "");
+  EXPECT_TRUE(record.best_moves.empty());
+
+  ASSERT_EQ(parseEpd("4k3/8/8/8/8/8/4P3/4K3 w - - 12 40\r", &record), EPD_OK);
+  EXPECT_EQ(record.position.halfmove_clock, 12);
+  EXPECT_EQ(record.position.fullmove_number, 40);
+}
+
+TEST(AnalyzeTest, ParseEpd) {
+  EpdRecord record;
+  ASSERT_EQ(parseEpd("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - "
+                     "bm e4 Nf3; id \"Start; position\"; c0 \"ignored\";",
+                     &record),
+            EPD_OK);
+  EXPECT_EQ(record.position.ToFen(),
+            "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  EXPECT_EQ(record.id, "Start; position");
+  EXPECT_THAT(record.best_moves, testing::ElementsAre("e2e4", "g1f3"));
+
+  // UCI best moves, and a last operation without a semicolon.
+  ASSERT_EQ(parseEpd("3r1k2/4P3/8/8/8/8/8/4K3 w - - bm e7d8n", &record),
+            EPD_OK);
+  EXPECT_THAT(record.best_moves, testing::ElementsAre("e7d8n"));
+  ASSERT_EQ(parseEpd("3r1k2/4P3/8/8/8/8/8/4K3 w - - bm exd8=Q+;", &record),
+            EPD_OK);
+  EXPECT_THAT(record.best_moves, testing::ElementsAre("e7d8q"));
+}
+
+TEST(AnalyzeTest, ParseEpdErrors) {
+  EpdRecord record;
+  EXPECT_EQ(parseEpd("", &record), EPD_BAD_POSITION);
+  EXPECT_EQ(parseEpd("not a fen", &record), EPD_BAD_POSITION);
+  EXPECT_EQ(parseEpd("4k3/8/8/8/8/8/4P3/4K3 x - - bm e4;", &record),
+            EPD_BAD_POSITION);
+  EXPECT_EQ(record.fen_error, FEN_BAD_ACTIVE_COLOR);
+  EXPECT_EQ(parseEpd("4k3/8/8/8/8/8/4P3/4K3 w - - id \"unterminated;",
+                     &record),
+            EPD_BAD_OPERATION);
+  EXPECT_EQ(parseEpd("4k3/8/8/8/8/8/4P3/4K3 w - - bm;", &record),
+            EPD_BAD_OPERATION);
+  EXPECT_EQ(parseEpd("4k3/8/8/8/8/8/4P3/4K3 w - - bm e5;", &record),
+            EPD_BAD_BEST_MOVE);
+  EXPECT_EQ(parseEpd("4k3/8/8/8/8/8/4P3/4K3 w - - bm e2e5;", &record),
+            EPD_BAD_BEST_MOVE);
+}
+
+TEST(AnalyzeTest, AnalyzeLine) {
+  AnalyzeStats stats;
+  nlohmann::json result = analyzeLine(
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - bm e4; id \"a\";",
+      3, &stats);
+  EXPECT_EQ(result["line"], 3);
+  EXPECT_EQ(result["id"], "a");
+  EXPECT_EQ(result["move"], "e2e4");
+  EXPECT_EQ(result["rule"], "initial move");
+  EXPECT_EQ(result["legal"].size(), 10);
+  EXPECT_TRUE(result["control"].is_object());
+  EXPECT_EQ(result["correct"], true);
+
+  result = analyzeLine(
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - bm d4;", 4,
+      &stats);
+  EXPECT_EQ(result["correct"], false);
+
+  result = analyzeLine("8/8/8 w - -", 5, &stats);
+  EXPECT_EQ(result["line"], 5);
+  EXPECT_EQ(result["error"], fenErrorName(FEN_BAD_BOARD));
+
+  EXPECT_EQ(stats.positions, 2);
+  EXPECT_EQ(stats.errors, 1);
+  EXPECT_EQ(stats.scored, 2);
+  EXPECT_EQ(stats.correct, 1);
+}
+
+TEST(AnalyzeTest, AnalyzeLineOptions) {
+  AnalyzeStats stats;
+  AnalyzeOptions options;
+  options.legal = false;
+  options.best_move = false;
+  nlohmann::json result = analyzeLine(
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - bm e4;", 1, &stats,
+      options);
+  EXPECT_TRUE(result["control"].is_object());
+  EXPECT_FALSE(result.contains("legal"));
+  EXPECT_FALSE(result.contains("move"));
+  EXPECT_FALSE(result.contains("correct"));
+  EXPECT_EQ(stats.positions, 1);
+  EXPECT_EQ(stats.scored, 0);
+
+  options.legal = true;
+  options.control = false;
+  result = analyzeLine("4k3/8/8/8/8/8/4P3/4K3 w - -", 2, &stats, options);
+  EXPECT_EQ(result["legal"].size(), 2);
+  EXPECT_FALSE(result.contains("control"));
+}
+
+TEST(AnalyzeTest, AnalyzeStream) {
+  std::stringstream input;
+  input << "# A comment, and a blank line\n\n";
+  for (int i = 0; i < 1000; i++) {
+    if (i % 3 == 0) {
+      input << "4k3/8/8/8/8/8/4P3/4K3 w - - 0 " << i + 1 << "\n";
+    } else if (i % 3 == 1) {
+      input << "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - bm e4; "
+               "id \"" << i << "\";\n";
+    } else {
+      input << "bad\n";
+    }
+  }
+  std::stringstream output;
+  AnalyzeStats stats = analyzeStream(input, output, 4);
+  EXPECT_EQ(stats.positions, 667);
+  EXPECT_EQ(stats.errors, 333);
+  EXPECT_EQ(stats.scored, 333);
+  EXPECT_EQ(stats.correct, 333);
+  EXPECT_GT(stats.PositionsPerSecond(), 0.0);
+
+  std::string line;
+  int lines = 0;
+  while (std::getline(output, line)) {
+    nlohmann::json result = nlohmann::json::parse(line);
+    // The results are in input order, after the two skipped lines.
+    EXPECT_EQ(result["line"], lines + 3);
+    if (lines % 3 == 1) {
+      EXPECT_EQ(result["id"], std::to_string(lines));
+    }
+    lines++;
+  }
+  EXPECT_EQ(lines, 1000);
+}
+
+TEST(AnalyzeTest, AnalyzePositions) {
+  std::vector<std::string> positions;
+  for (int i = 0; i < 1000; i++) {
+    if (i % 4 == 0) {
+      positions.push_back("4k3/8/8/8/8/8/4P3/4K3 w - - 0 " +
+                          std::to_string(i + 1));
+    } else if (i % 4 == 1) {
+      positions.push_back(
+          "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - bm e4; id \"" +
+          std::to_string(i) + "\";");
+    } else if (i % 4 == 2) {
+      positions.push_back("bad");
+    } else {
+      // Blank positions aren't skipped, they are errors like any other.
+      positions.push_back("");
+    }
+  }
+
+  // Also with a pool that takes no tasks, which leaves all the chunks to the
+  // calling thread.
+  WorkerPool pool(4, 16);
+  WorkerPool full_pool(1, 0);
+  for (WorkerPool* p : {&pool, &full_pool}) {
+    AnalyzeStats stats;
+    std::stringstream output(analyzePositions(positions, p, &stats));
+    EXPECT_EQ(stats.positions, 500);
+    EXPECT_EQ(stats.errors, 500);
+    EXPECT_EQ(stats.correct, 250);
+
+    std::string line;
+    int lines = 0;
+    while (std::getline(output, line)) {
+      nlohmann::json result = nlohmann::json::parse(line);
+      EXPECT_EQ(result["line"], lines + 1);
+      EXPECT_EQ(result.contains("error"), lines % 4 >= 2);
+      if (lines % 4 == 1) {
+        EXPECT_EQ(result["id"], std::to_string(lines));
+      }
+      lines++;
+    }
+    EXPECT_EQ(lines, 1000);
+  }
+
+  AnalyzeStats stats;
+  EXPECT_EQ(analyzePositions({}, &pool, &stats), "");
+}
+
+}  // namespace
+}  // namespace habits
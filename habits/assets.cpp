@@ -0,0 +1,281 @@
+#include "assets.hpp"
+
+#include <brotli/encode.h>
+#include <zlib.h>
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace habits {
+
+namespace {
+
+std::string contentType(const std::filesystem::path& path) {
+  static const std::unordered_map<std::string, std::string> CONTENT_TYPES = {
+      {".html", "text/html; charset=utf-8"},
+      {".js", "text/javascript; charset=utf-8"},
+      {".css", "text/css; charset=utf-8"},
+      {".json", "application/json"},
+      {".map", "application/json"},
+      {".txt", "text/plain; charset=utf-8"},
+      {".svg", "image/svg+xml"},
+      {".png", "image/png"},
+      {".ico", "image/x-icon"},
+  };
+  auto it = CONTENT_TYPES.find(path.extension().string());
+  if (it == CONTENT_TYPES.end()) {
+    return "application/octet-stream";
+  }
+  return it->second;
+}
+
+// A strong ETag from a 64 bit FNV-1a hash and the length of the contents.
+std::string etag(std::string_view body) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (char c : body) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+  }
+  char etag[48];
+  std::snprintf(etag, sizeof(etag), "\"%016llx-%zx\"",
+                static_cast<unsigned long long>(hash), body.size());
+  return etag;
+}
+
+// The ETag of an encoded variant, the identity one with a suffix for the
+// encoding inside the quotes.
+std::string suffixedEtag(const std::string& etag, std::string_view suffix) {
+  return etag.substr(0, etag.size() - 1) + std::string(suffix) + '"';
+}
+
+// Compress with gzip, returning an empty string on failure.
+std::string gzip(std::string_view body) {
+  z_stream stream = {};
+  // Adding 16 to the window bits writes a gzip header instead of zlib's.
+  if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return "";
+  }
+  std::string compressed(deflateBound(&stream, body.size()), '\0');
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(body.data()));
+  stream.avail_in = body.size();
+  stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+  stream.avail_out = compressed.size();
+  int result = deflate(&stream, Z_FINISH);
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+  return result == Z_STREAM_END ? compressed : "";
+}
+
+// Compress with brotli, returning an empty string on failure.
+std::string brotli(std::string_view body) {
+  size_t size = BrotliEncoderMaxCompressedSize(body.size());
+  if (size == 0) {
+    return "";
+  }
+  std::string compressed(size, '\0');
+  if (!BrotliEncoderCompress(
+          BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE,
+          body.size(), reinterpret_cast<const uint8_t*>(body.data()), &size,
+          reinterpret_cast<uint8_t*>(compressed.data()))) {
+    return "";
+  }
+  compressed.resize(size);
+  return compressed;
+}
+
+std::string_view trim(std::string_view value) {
+  while (!value.empty() && std::isspace(static_cast<unsigned char>(value[0]))) {
+    value.remove_prefix(1);
+  }
+  while (!value.empty() &&
+         std::isspace(static_cast<unsigned char>(value.back()))) {
+    value.remove_suffix(1);
+  }
+  return value;
+}
+
+// Whether the Accept-Encoding header accepts the coding, either by name or
+// with "*", and without a zero quality value.
+bool acceptsEncoding(std::string_view accept_encoding,
+                     std::string_view coding) {
+  while (!accept_encoding.empty()) {
+    size_t comma = accept_encoding.find(',');
+    std::string_view item = accept_encoding.substr(0, comma);
+    std::string_view name = trim(item.substr(0, item.find(';')));
+    if (name == coding || name == "*") {
+      size_t quality = item.find("q=");
+      return quality == std::string_view::npos ||
+             std::strtod(std::string(item.substr(quality + 2)).c_str(),
+                         nullptr) > 0.0;
+    }
+    if (comma == std::string_view::npos) {
+      break;
+    }
+    accept_encoding.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+}  // namespace
+
+const char* contentEncodingName(ContentEncoding encoding) {
+  switch (encoding) {
+    case ENCODING_IDENTITY:
+      return "identity";
+    case ENCODING_GZIP:
+      return "gzip";
+    case ENCODING_BROTLI:
+      return "br";
+  }
+  return "identity";
+}
+
+ContentEncoding chooseEncoding(const StaticAsset& asset,
+                               std::string_view accept_encoding) {
+  ContentEncoding best = ENCODING_IDENTITY;
+  size_t best_size = asset.body.size();
+  if (!asset.gzip_body.empty() && asset.gzip_body.size() < best_size &&
+      acceptsEncoding(accept_encoding, "gzip")) {
+    best = ENCODING_GZIP;
+    best_size = asset.gzip_body.size();
+  }
+  if (!asset.brotli_body.empty() && asset.brotli_body.size() < best_size &&
+      acceptsEncoding(accept_encoding, "br")) {
+    best = ENCODING_BROTLI;
+  }
+  return best;
+}
+
+const std::string& encodedBody(const StaticAsset& asset,
+                               ContentEncoding encoding) {
+  switch (encoding) {
+    case ENCODING_GZIP:
+      return asset.gzip_body;
+    case ENCODING_BROTLI:
+      return asset.brotli_body;
+    case ENCODING_IDENTITY:
+      break;
+  }
+  return asset.body;
+}
+
+const std::string& encodedEtag(const StaticAsset& asset,
+                               ContentEncoding encoding) {
+  switch (encoding) {
+    case ENCODING_GZIP:
+      return asset.gzip_etag;
+    case ENCODING_BROTLI:
+      return asset.brotli_etag;
+    case ENCODING_IDENTITY:
+      break;
+  }
+  return asset.etag;
+}
+
+bool etagMatches(std::string_view if_none_match, const StaticAsset& asset) {
+  while (!if_none_match.empty()) {
+    size_t comma = if_none_match.find(',');
+    std::string_view tag = trim(if_none_match.substr(0, comma));
+    // Weak comparison is used for If-None-Match, ignoring a W/ prefix.
+    if (tag.substr(0, 2) == "W/") {
+      tag.remove_prefix(2);
+    }
+    if (tag == "*" || tag == asset.etag ||
+        (!asset.gzip_etag.empty() && tag == asset.gzip_etag) ||
+        (!asset.brotli_etag.empty() && tag == asset.brotli_etag)) {
+      return true;
+    }
+    if (comma == std::string_view::npos) {
+      break;
+    }
+    if_none_match.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+int StaticAssets::Load(const std::string& directory) {
+  std::error_code error;
+  if (!std::filesystem::is_directory(directory, error)) {
+    return 1;
+  }
+  std::unordered_map<std::string, StaticAsset> assets;
+  for (auto it = std::filesystem::recursive_directory_iterator(directory,
+                                                               error);
+       it != std::filesystem::recursive_directory_iterator();
+       it.increment(error)) {
+    if (error) {
+      return 1;
+    }
+    const std::filesystem::path& path = it->path();
+    if (path.filename().string().rfind('.', 0) == 0) {
+      if (it->is_directory()) {
+        it.disable_recursion_pending();
+      }
+      continue;
+    }
+    if (!it->is_regular_file()) {
+      continue;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      return 1;
+    }
+    StaticAsset asset;
+    asset.body.assign(std::istreambuf_iterator<char>(file),
+                      std::istreambuf_iterator<char>());
+    if (file.bad()) {
+      return 1;
+    }
+    asset.content_type = contentType(path);
+    asset.etag = etag(asset.body);
+    asset.gzip_body = gzip(asset.body);
+    if (asset.gzip_body.size() >= asset.body.size()) {
+      asset.gzip_body.clear();
+    }
+    asset.brotli_body = brotli(asset.body);
+    if (asset.brotli_body.size() >= asset.body.size()) {
+      asset.brotli_body.clear();
+    }
+    if (!asset.gzip_body.empty()) {
+      asset.gzip_etag = suffixedEtag(asset.etag, "-gz");
+    }
+    if (!asset.brotli_body.empty()) {
+      asset.brotli_etag = suffixedEtag(asset.etag, "-br");
+    }
+    std::string relative =
+        std::filesystem::relative(path, directory).generic_string();
+    assets["/" + relative] = std::move(asset);
+  }
+  if (error) {
+    return 1;
+  }
+  assets_ = std::move(assets);
+  return 0;
+}
+
+const StaticAsset* StaticAssets::Find(std::string_view path) const {
+  std::string key(path.substr(0, path.find('?')));
+  if (key.empty() || key.back() == '/') {
+    key += key.empty() ? "/index.html" : "index.html";
+  }
+  auto it = assets_.find(key);
+  if (it == assets_.end()) {
+    // A directory without the trailing slash.
+    it = assets_.find(key + "/index.html");
+    if (it == assets_.end()) {
+      return nullptr;
+    }
+  }
+  return &it->second;
+}
+
+}  // namespace habits
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace habits {
+
+// A file from the static directory, held in memory along with its compressed
+// variants.
+struct StaticAsset {
+  std::string content_type;
+  // A strong ETag (including the quotes) computed from the contents.
+  std::string etag;
+  std::string body;
+  // The body compressed with gzip and brotli, or empty if compressing didn't
+  // make it smaller.
+  std::string gzip_body;
+  std::string brotli_body;
+  // The ETags of the compressed bodies, which differ from the identity one as
+  // their bytes do, or empty along with their body.
+  std::string gzip_etag;
+  std::string brotli_etag;
+};
+
+enum ContentEncoding {
+  ENCODING_IDENTITY,
+  ENCODING_GZIP,
+  ENCODING_BROTLI,
+};
+
+// The name of the encoding in the Content-Encoding header.
+const char* contentEncodingName(ContentEncoding encoding);
+
+// Choose the smallest variant of the asset that the client accepts, going by
+// its Accept-Encoding header.
+ContentEncoding chooseEncoding(const StaticAsset& asset,
+                               std::string_view accept_encoding);
+
+// The body of the asset in the encoding.
+const std::string& encodedBody(const StaticAsset& asset,
+                               ContentEncoding encoding);
+
+// The ETag of the asset in the encoding.
+const std::string& encodedEtag(const StaticAsset& asset,
+                               ContentEncoding encoding);
+
+// Whether an If-None-Match header matches any of the asset's ETags, meaning
+// the client's copy is still current in whichever encoding it has.
+bool etagMatches(std::string_view if_none_match, const StaticAsset& asset);
+
+// All the files of a directory, loaded once so requests are served from
+// memory.
+class StaticAssets {
+ public:
+  // Load all the files under the directory, except hidden ones, replacing any
+  // loaded before. Returns 0 on success, or 1 if the directory doesn't exist or
+  // a file couldn't be read.
+  int Load(const std::string& directory);
+
+  // Find the asset for a request path, such as "/index.html". Paths of
+  // directories find their index.html. Returns nullptr if there is no asset.
+  const StaticAsset* Find(std::string_view path) const;
+
+  size_t Size() const { return assets_.size(); }
+
+ private:
+  // The assets by their path, starting with "/".
+  std::unordered_map<std::string, StaticAsset> assets_;
+};
+
+}  // namespace habits
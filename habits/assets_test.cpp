@@ -0,0 +1,124 @@
+#include "assets.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace habits {
+
+namespace {
+
+// Make a directory of static files for a test, removing any left by an earlier
+// run.
+std::filesystem::path makeStaticDirectory(const std::string& name) {
+  std::filesystem::path directory =
+      std::filesystem::path(testing::TempDir()) / name;
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory / "js");
+  std::ofstream(directory / "index.html")
+      << "<html>" << std::string(2000, ' ') << "</html>";
+  std::ofstream(directory / "js" / "index.js") << "let x = 1;";
+  std::ofstream(directory / ".gitignore") << "*.js";
+  return directory;
+}
+
+std::string gunzip(const std::string& compressed) {
+  z_stream stream = {};
+  inflateInit2(&stream, 15 + 16);
+  std::string body(64 * 1024, '\0');
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+  stream.avail_in = compressed.size();
+  stream.next_out = reinterpret_cast<Bytef*>(body.data());
+  stream.avail_out = body.size();
+  EXPECT_EQ(inflate(&stream, Z_FINISH), Z_STREAM_END);
+  body.resize(stream.total_out);
+  inflateEnd(&stream);
+  return body;
+}
+
+TEST(AssetsTest, Load) {
+  std::filesystem::path directory = makeStaticDirectory("assets_test_load");
+  StaticAssets assets;
+  ASSERT_EQ(assets.Load(directory.string()), 0);
+  // Hidden files aren't served.
+  EXPECT_EQ(assets.Size(), 2);
+  EXPECT_EQ(assets.Find("/.gitignore"), nullptr);
+  EXPECT_EQ(assets.Find("/missing.html"), nullptr);
+
+  const StaticAsset* index = assets.Find("/");
+  ASSERT_NE(index, nullptr);
+  EXPECT_EQ(assets.Find("/index.html"), index);
+  EXPECT_EQ(assets.Find("/index.html?game=1"), index);
+  EXPECT_EQ(index->content_type, "text/html; charset=utf-8");
+  EXPECT_EQ(index->body.size(), 2013);
+  ASSERT_FALSE(index->gzip_body.empty());
+  EXPECT_LT(index->gzip_body.size(), index->body.size());
+  EXPECT_EQ(gunzip(index->gzip_body), index->body);
+  ASSERT_FALSE(index->brotli_body.empty());
+  EXPECT_LT(index->brotli_body.size(), index->body.size());
+  // Each encoding has its own ETag.
+  EXPECT_EQ(index->gzip_etag,
+            index->etag.substr(0, index->etag.size() - 1) + "-gz\"");
+  EXPECT_EQ(index->brotli_etag,
+            index->etag.substr(0, index->etag.size() - 1) + "-br\"");
+  EXPECT_EQ(encodedEtag(*index, ENCODING_GZIP), index->gzip_etag);
+  EXPECT_EQ(encodedEtag(*index, ENCODING_IDENTITY), index->etag);
+
+  const StaticAsset* script = assets.Find("/js/index.js");
+  ASSERT_NE(script, nullptr);
+  EXPECT_EQ(script->content_type, "text/javascript; charset=utf-8");
+  // Too small to be made smaller by compressing.
+  EXPECT_TRUE(script->gzip_body.empty());
+  EXPECT_TRUE(script->gzip_etag.empty());
+  EXPECT_NE(script->etag, index->etag);
+  EXPECT_EQ(script->etag.front(), '"');
+  EXPECT_EQ(script->etag.back(), '"');
+}
+
+TEST(AssetsTest, LoadMissingDirectory) {
+  StaticAssets assets;
+  EXPECT_EQ(assets.Load("/no/such/static/directory"), 1);
+  EXPECT_EQ(assets.Size(), 0);
+}
+
+TEST(AssetsTest, ChooseEncoding) {
+  StaticAsset asset;
+  asset.body = std::string(100, 'a');
+  asset.gzip_body = std::string(20, 'g');
+  asset.brotli_body = std::string(10, 'b');
+  EXPECT_EQ(chooseEncoding(asset, ""), ENCODING_IDENTITY);
+  EXPECT_EQ(chooseEncoding(asset, "gzip, deflate"), ENCODING_GZIP);
+  EXPECT_EQ(chooseEncoding(asset, "gzip, deflate, br"), ENCODING_BROTLI);
+  EXPECT_EQ(chooseEncoding(asset, "br;q=0, gzip;q=0.5"), ENCODING_GZIP);
+  EXPECT_EQ(chooseEncoding(asset, "*"), ENCODING_BROTLI);
+  EXPECT_EQ(encodedBody(asset, ENCODING_BROTLI), asset.brotli_body);
+  EXPECT_STREQ(contentEncodingName(ENCODING_BROTLI), "br");
+
+  asset.brotli_body.clear();
+  EXPECT_EQ(chooseEncoding(asset, "br"), ENCODING_IDENTITY);
+}
+
+TEST(AssetsTest, EtagMatches) {
+  StaticAsset asset;
+  asset.etag = "\"abc\"";
+  EXPECT_TRUE(etagMatches("\"abc\"", asset));
+  EXPECT_TRUE(etagMatches("\"x\", W/\"abc\"", asset));
+  EXPECT_TRUE(etagMatches("*", asset));
+  EXPECT_FALSE(etagMatches("", asset));
+  EXPECT_FALSE(etagMatches("\"abcd\"", asset));
+  // The tags of the encoded bodies match too, but only if there are any.
+  EXPECT_FALSE(etagMatches("\"abc-gz\"", asset));
+  asset.gzip_etag = "\"abc-gz\"";
+  asset.brotli_etag = "\"abc-br\"";
+  EXPECT_TRUE(etagMatches("\"abc-gz\"", asset));
+  EXPECT_TRUE(etagMatches("\"x\", \"abc-br\"", asset));
+  EXPECT_FALSE(etagMatches("\"abc-deflate\"", asset));
+}
+
+}  // namespace
+}  // namespace habits
@@ -1,83 +1,53 @@
 #include "bot.hpp"
 
-#include <curl/curl.h>
-
-#include <iostream>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "lichess_api.hpp"
+#include "log.hpp"
 #include "moves.hpp"
 #include "position.hpp"
 #include "search.hpp"
+#include "stats.hpp"
 
 namespace habits {
 
-namespace {
-
-static size_t ReceiveGameState(void *contents, size_t size, size_t nmemb,
-                               void *game) {
-  size_t realsize = size * nmemb;
-  std::string str;
-  str.assign((char *)contents, realsize);
-  ((LichessGame *)game)->receiveGameState(str);
-  return realsize;
-}
-
-static size_t ReceiveIncomingEvent(void *contents, size_t size, size_t nmemb,
-                                   void *bot) {
-  size_t realsize = size * nmemb;
-  std::string str;
-  str.assign((char *)contents, realsize);
-  ((LichessBot *)bot)->receiveIncomingEvent(str);
-  return realsize;
-}
-
-static size_t LogResponse(void *contents, size_t size, size_t nmemb,
-                          void *bot) {
-  size_t realsize = size * nmemb;
-  std::string str;
-  str.assign((char *)contents, realsize);
-  std::cout << "Received response: " << str << std::endl;
-  return realsize;
-}
-
-}  // namespace
-
-void LichessGame::startGame() {
-  curl_global_init(CURL_GLOBAL_DEFAULT);
-
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    std::cerr << "Failed to initialize CURL for game state" << std::endl;
-    return;
+bool LichessGame::queueGameState(std::string data) {
+  std::lock_guard<std::mutex> lock(queued_mutex_);
+  queued_states_.push_back(std::move(data));
+  if (handling_) {
+    return false;
   }
+  handling_ = true;
+  return true;
+}
 
-  CURLcode res;
-  char errbuf[CURL_ERROR_SIZE];
-  std::string url = "https://lichess.org/api/bot/game/stream/" + game_id_;
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_HTTPAUTH, (long)CURLAUTH_BEARER);
-  curl_easy_setopt(curl, CURLOPT_XOAUTH2_BEARER, token_.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ReceiveGameState);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)this);
-  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
-  errbuf[0] = 0;
-  res = curl_easy_perform(curl);
-  if (res != CURLE_OK) {
-    std::cerr << "ERROR getting game state " << curl_easy_strerror(res) << ": "
-              << errbuf << std::endl;
-    return;
+void LichessGame::handleQueuedStates() {
+  while (true) {
+    std::string data;
+    {
+      std::lock_guard<std::mutex> lock(queued_mutex_);
+      if (queued_states_.empty()) {
+        handling_ = false;
+        return;
+      }
+      data = std::move(queued_states_.front());
+      queued_states_.pop_front();
+    }
+    receiveGameState(std::move(data));
   }
-  curl_easy_cleanup(curl);
-  curl_global_cleanup();
-  std::cout << "Game loop exiting" << std::endl;
 }
 
 void LichessGame::initializeState(const nlohmann::json &state) {
   position_ = Position::FromFen(initial_fen_);
+  history_.Reset(position_);
   status_ = state["status"].get<std::string>();
 
   std::string initial_moves = state["moves"].get<std::string>();
@@ -87,9 +57,10 @@ void LichessGame::initializeState(const nlohmann::json &state) {
   while (std::getline(iss, initial_move, ' ')) {
     int result = habits::move(&position_, initial_move);
     if (result != 0) {
-      std::cerr << "Received illegal move " << initial_move
-                << " in position: " << position_.ToFen() << std::endl;
+      LogMessage(LOG_ERROR) << "Received illegal move " << initial_move
+                            << " in position: " << position_.ToFen();
     }
+    history_.Push(position_);
     if (myTurn()) {
       game_.opponentMove(initial_move);
     }
@@ -110,8 +81,8 @@ void LichessGame::updateState(const nlohmann::json &state) {
       continue;
     }
     if (currentMoveIndex < moves_.size()) {
-      std::cerr << "New list of moves doesn't match existing list: "
-                << new_moves << std::endl;
+      LogMessage(LOG_WARNING)
+          << "New list of moves doesn't match existing list: " << new_moves;
       // Reinitialize the state from the initial FEN with these moves.
       initializeState(new_moves);
       return;
@@ -119,9 +90,10 @@ void LichessGame::updateState(const nlohmann::json &state) {
 
     int result = habits::move(&position_, new_move);
     if (result != 0) {
-      std::cerr << "Received illegal move " << new_move
-                << " in position: " << position_.ToFen() << std::endl;
+      LogMessage(LOG_ERROR) << "Received illegal move " << new_move
+                            << " in position: " << position_.ToFen();
     }
+    history_.Push(position_);
     game_.opponentMove(new_move);
     moves_.push_back(new_move);
     currentMoveIndex++;
@@ -135,40 +107,33 @@ bool LichessGame::myTurn() const {
 }
 
 void LichessGame::makeBestMove() {
-  std::string move = game_.bestMove(position_);
+  Decision decision = game_.bestMove(position_, &history_);
+  LogMessage(LOG_INFO) << "Best move in game " << game_id_ << ": "
+                       << decision;
+  if (decision.move.empty()) {
+    LogMessage(LOG_WARNING) << "No legal moves in position: "
+                            << position_.ToFen();
+    return;
+  }
+  const std::string& move = decision.move;
   int result = habits::move(&position_, move);
   if (result != 0) {
-    std::cerr << "Best move was illegal move " << move
-              << " in position: " << position_.ToFen() << std::endl;
+    LogMessage(LOG_ERROR) << "Best move was illegal move " << move
+                          << " in position: " << position_.ToFen();
   }
+  history_.Push(position_);
   moves_.push_back(move);
 
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    std::cerr << "Failed to initialize CURL to make a move" << std::endl;
-    return;
-  }
-
-  CURLcode res;
-  char errbuf[CURL_ERROR_SIZE];
-  std::string url =
-      "https://lichess.org/api/bot/game/" + game_id_ + "/move/" + move;
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_POST, 1L);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0);
-  curl_easy_setopt(curl, CURLOPT_HTTPAUTH, (long)CURLAUTH_BEARER);
-  curl_easy_setopt(curl, CURLOPT_XOAUTH2_BEARER, token_.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, LogResponse);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)this);
-  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
-  errbuf[0] = 0;
-  res = curl_easy_perform(curl);
-  if (res != CURLE_OK) {
-    std::cerr << "ERROR making a move " << curl_easy_strerror(res) << ": "
-              << errbuf << std::endl;
-    return;
-  }
-  curl_easy_cleanup(curl);
+  // The time to send the move is taken from the clock, so log it.
+  api_->Post("/api/bot/game/" + game_id_ + "/move/" + move, "",
+             [move, game_id = game_id_](bool ok, const RequestTiming &timing) {
+               if (ok) {
+                 LogMessage(LOG_INFO)
+                     << "Sent move " << move << " in game " << game_id
+                     << " in " << timing.total_ms << "ms"
+                     << (timing.new_connection ? " (new connection)" : "");
+               }
+             });
 }
 
 void LichessGame::receiveGameState(std::string data) {
@@ -179,21 +144,21 @@ void LichessGame::receiveGameState(std::string data) {
 
   nlohmann::json json = nlohmann::json::parse(data, nullptr, false);
   if (json.is_discarded()) {
-    std::cerr << "Failed to parse JSON from data: " << data << std::endl;
+    LogMessage(LOG_ERROR) << "Failed to parse JSON from data: " << data;
     return;
   }
   if (json.empty()) {
-    std::cout << "Ignoring keep-alive empty json." << std::endl;
+    LogMessage(LOG_DEBUG) << "Ignoring keep-alive empty json.";
     return;
   }
   if (!json.contains("type")) {
-    std::cerr << "Ignoring message with no type: " << data << std::endl;
+    LogMessage(LOG_WARNING) << "Ignoring message with no type: " << data;
     return;
   }
 
   std::string type = json["type"].get<std::string>();
   if (type.compare("gameFull") == 0) {
-    std::cout << "Full game state: " << json << std::endl;
+    LogMessage(LOG_DEBUG) << "Full game state: " << json;
     initial_fen_ = json["initialFen"].get<std::string>();
     if (initial_fen_.compare("startpos") == 0) {
       initial_fen_ = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
@@ -205,7 +170,7 @@ void LichessGame::receiveGameState(std::string data) {
     return;
   }
   if (type.compare("gameState") == 0) {
-    std::cout << "Received game state update: " << json << std::endl;
+    LogMessage(LOG_DEBUG) << "Received game state update: " << json;
     updateState(json);
     if (myTurn()) {
       makeBestMove();
@@ -213,49 +178,34 @@ void LichessGame::receiveGameState(std::string data) {
     return;
   }
   if (type.compare("chatLine") == 0) {
-    std::cout << "Received chat meesage: " << json << std::endl;
+    LogMessage(LOG_DEBUG) << "Received chat message: " << json;
     return;
   }
   if (type.compare("opponentGone") == 0) {
-    std::cout << "Opponent might be gone: " << json << std::endl;
+    LogMessage(LOG_INFO) << "Opponent might be gone in game " << game_id_;
+    LogMessage(LOG_DEBUG) << "Opponent gone message: " << json;
     return;
   }
-  std::cerr << "Received invalid type for /api/bot/game/stream/" << game_id_
-            << " " << type << ": " << json << std::endl;
+  LogMessage(LOG_WARNING) << "Received invalid type for /api/bot/game/stream/"
+                          << game_id_ << " " << type << ": " << json;
 }
 
 void LichessBot::acceptChallenge(std::string challenge_id) {
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    std::cerr << "Failed to initialize CURL to accept challenge" << std::endl;
-    return;
-  }
-
-  CURLcode res;
-  char errbuf[CURL_ERROR_SIZE];
-  std::string url =
-      "https://lichess.org/api/challenge/" + challenge_id + "/accept";
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_POST, 1L);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0);
-  curl_easy_setopt(curl, CURLOPT_HTTPAUTH, (long)CURLAUTH_BEARER);
-  curl_easy_setopt(curl, CURLOPT_XOAUTH2_BEARER, token_.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, LogResponse);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)this);
-  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
-  errbuf[0] = 0;
-  res = curl_easy_perform(curl);
-  if (res != CURLE_OK) {
-    std::cerr << "ERROR accepting challenge " << curl_easy_strerror(res) << ": "
-              << errbuf << std::endl;
-    return;
-  }
-  curl_easy_cleanup(curl);
+  // Counted towards the limit straight away, so challenges arriving before the
+  // response don't go over it.
+  accepted_challenges_.insert(challenge_id);
+  api_.Post("/api/challenge/" + challenge_id + "/accept", "",
+            [this, challenge_id](bool ok, const RequestTiming &) {
+              if (!ok) {
+                accepted_challenges_.erase(challenge_id);
+              }
+            });
 }
 
 bool LichessBot::rejectChallenge(nlohmann::json challenge) {
   std::string reason;
-  if (current_game_ != nullptr) {
+  if (games_.size() + accepted_challenges_.size() >=
+      static_cast<size_t>(max_games_)) {
     reason = "later";
   } else if (challenge["timeControl"]["type"].get<std::string>().compare(
                  "clock") != 0) {
@@ -277,73 +227,108 @@ bool LichessBot::rejectChallenge(nlohmann::json challenge) {
     return false;
   }
 
-  std::cout << "Rejecting a challenge with reason " << reason << ": "
-            << challenge << std::endl;
   std::string challenge_id = challenge["id"].get<std::string>();
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    std::cerr << "Failed to initialize CURL to reject challenge" << std::endl;
-    return true;
-  }
-
-  CURLcode res;
-  char errbuf[CURL_ERROR_SIZE];
-  std::string url =
-      "https://lichess.org/api/challenge/" + challenge_id + "/decline";
-  std::string body = "reason=" + reason;
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, body.size());
-  curl_easy_setopt(curl, CURLOPT_HTTPAUTH, (long)CURLAUTH_BEARER);
-  curl_easy_setopt(curl, CURLOPT_XOAUTH2_BEARER, token_.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, LogResponse);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)this);
-  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
-  errbuf[0] = 0;
-  res = curl_easy_perform(curl);
-  if (res != CURLE_OK) {
-    std::cerr << "ERROR rejecting challenge " << curl_easy_strerror(res) << ": "
-              << errbuf << std::endl;
-  }
-  curl_easy_cleanup(curl);
+  LogMessage(LOG_INFO) << "Rejecting challenge " << challenge_id
+                       << " with reason " << reason;
+  LogMessage(LOG_DEBUG) << "Rejected challenge: " << challenge;
+  api_.Post("/api/challenge/" + challenge_id + "/decline", "reason=" + reason);
   return true;
 }
 
 int LichessBot::listenForChallenges() {
-  curl_global_init(CURL_GLOBAL_DEFAULT);
+  LogMessage(LOG_INFO) << "Listening for incoming challenge requests. "
+                          "Challenge the bot at "
+                          "https://lichess.org/@/camrdale-test-bot";
+  bool ok = true;
+  api_.Stream(
+      "/api/stream/event",
+      [this](std::string_view line) {
+        receiveIncomingEvent(std::string(line));
+      },
+      [this, &ok](bool stream_ok) {
+        ok = stream_ok;
+        LogMessage(LOG_INFO) << "Event stream ended, waiting for "
+                             << games_.size() << " games to finish.";
+      });
+  // Returns once the event stream and the streams of all the games have ended.
+  if (api_.Run() != 0) {
+    return 3;
+  }
+  return ok ? 0 : 3;
+}
 
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    std::cerr << "Failed to initialize CURL" << std::endl;
-    return 2;
+void LichessBot::startGame(const nlohmann::json &game) {
+  std::string game_id = game["gameId"].get<std::string>();
+  bool accepted = accepted_challenges_.erase(game_id) > 0;
+  if (games_.count(game_id) > 0) {
+    LogMessage(LOG_WARNING) << "Received gameStart for already started game: "
+                            << game;
+    return;
+  }
+  // Games that weren't accepted here, such as ones already running when the
+  // bot started, are still played if there's room for them.
+  if (!accepted && games_.size() + accepted_challenges_.size() >=
+                       static_cast<size_t>(max_games_)) {
+    LogMessage(LOG_WARNING) << "Received gameStart but already playing "
+                            << games_.size() << " games: " << game;
+    return;
   }
 
-  std::cout << "Listening for incoming challenge requests. Challenge the bot "
-               "at https://lichess.org/@/camrdale-test-bot"
-            << std::endl;
-  CURLcode res;
-  char errbuf[CURL_ERROR_SIZE];
-  curl_easy_setopt(curl, CURLOPT_URL, "https://lichess.org/api/stream/event");
-  curl_easy_setopt(curl, CURLOPT_HTTPAUTH, (long)CURLAUTH_BEARER);
-  curl_easy_setopt(curl, CURLOPT_XOAUTH2_BEARER, token_.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ReceiveIncomingEvent);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)this);
-  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
-  errbuf[0] = 0;
-  res = curl_easy_perform(curl);
-  if (res != CURLE_OK) {
-    std::cerr << "ERROR " << curl_easy_strerror(res) << ": " << errbuf
-              << std::endl;
-    return 3;
+  auto lichess_game = std::make_shared<LichessGame>(game, &api_);
+  games_[game_id] = lichess_game;
+  api_.Stream(
+      "/api/bot/game/stream/" + game_id,
+      [this, lichess_game](std::string_view line) {
+        if (lichess_game->queueGameState(std::string(line))) {
+          // Keeps the loop running until the move found has been sent.
+          api_.BeginWork();
+          runGame(lichess_game);
+        }
+      },
+      [this, game_id](bool) {
+        LogMessage(LOG_INFO) << "Game stream ended: " << game_id;
+        games_.erase(game_id);
+      });
+  LogMessage(LOG_INFO) << "Playing " << games_.size() << " of " << max_games_
+                       << " games";
+}
+
+void LichessBot::runGame(std::shared_ptr<LichessGame> game) {
+  // Held while submitting, so a task finishing in between can't miss the game
+  // being added to the waiting games.
+  std::lock_guard<std::mutex> lock(waiting_mutex_);
+  if (pool_.TrySubmit([this, game]() {
+        game->handleQueuedStates();
+        runWaitingGames();
+        api_.EndWork();
+      })) {
+    return;
   }
-  std::cout << "Event stream ended, shutting down." << std::endl;
-  curl_easy_cleanup(curl);
-  curl_global_cleanup();
+  // The pool is only full while it has tasks queued, and the first of those
+  // to finish starts the game.
+  LogMessage(LOG_WARNING) << "Compute pool is full, delaying game "
+                          << game->getGameId();
+  waiting_games_.push_back(std::move(game));
+}
 
-  return 0;
+void LichessBot::runWaitingGames() {
+  std::vector<std::shared_ptr<LichessGame>> waiting;
+  {
+    std::lock_guard<std::mutex> lock(waiting_mutex_);
+    waiting.swap(waiting_games_);
+  }
+  for (std::shared_ptr<LichessGame>& game : waiting) {
+    runGame(std::move(game));
+  }
 }
 
 void LichessBot::receiveIncomingEvent(std::string data) {
+  // Lichess sends keep-alive messages regularly, so dump requests are handled
+  // promptly even with no games running.
+  if (takeRuleStatsDumpRequest()) {
+    LogMessage(LOG_INFO) << "Rule statistics:\n" << ruleStatsReport();
+  }
+
   if (data.find_first_not_of(" \t\n\r\f\v") == std::string::npos) {
     // Ignore empty keep-alive message.
     return;
@@ -351,15 +336,15 @@ void LichessBot::receiveIncomingEvent(std::string data) {
 
   nlohmann::json json = nlohmann::json::parse(data, nullptr, false);
   if (json.is_discarded()) {
-    std::cerr << "Failed to parse JSON from data: " << data << std::endl;
+    LogMessage(LOG_ERROR) << "Failed to parse JSON from data: " << data;
     return;
   }
   if (json.empty()) {
-    std::cout << "Ignoring keep-alive empty json." << std::endl;
+    LogMessage(LOG_DEBUG) << "Ignoring keep-alive empty json.";
     return;
   }
   if (!json.contains("type")) {
-    std::cerr << "Ignoring message with no type: " << data << std::endl;
+    LogMessage(LOG_WARNING) << "Ignoring message with no type: " << data;
     return;
   }
 
@@ -368,55 +353,39 @@ void LichessBot::receiveIncomingEvent(std::string data) {
     if (rejectChallenge(json["challenge"])) {
       return;
     }
-    std::cout << "Accepting challenge: " << json["challenge"] << std::endl;
+    LogMessage(LOG_INFO) << "Accepting challenge "
+                         << json["challenge"]["id"].get<std::string>();
+    LogMessage(LOG_DEBUG) << "Accepted challenge: " << json["challenge"];
     acceptChallenge(json["challenge"]["id"].get<std::string>());
     return;
   }
   if (type.compare("challengeCanceled") == 0) {
-    std::cout << "Challenge was cancelled: " << json["challenge"] << std::endl;
+    LogMessage(LOG_INFO) << "Challenge was cancelled: "
+                         << json["challenge"]["id"];
+    accepted_challenges_.erase(json["challenge"]["id"].get<std::string>());
     return;
   }
   if (type.compare("challengeDeclined") == 0) {
-    std::cout << "Declined challenge: " << json["challenge"] << std::endl;
+    LogMessage(LOG_INFO) << "Declined challenge: " << json["challenge"]["id"];
     return;
   }
   if (type.compare("gameStart") == 0) {
-    std::cout << "Game started: " << json["game"] << std::endl;
-    if (current_game_ != nullptr) {
-      if (current_game_->getGameId().compare(
-              json["game"]["gameId"].get<std::string>()) == 0) {
-        std::cerr << "Received gameStart for already started game: "
-                  << json["game"] << std::endl;
-        return;
-      }
-      std::cerr << "Received gameStart but already playing game "
-                << current_game_->getGameId() << ": " << json["game"]
-                << std::endl;
-      return;
-    }
-    current_game_ = std::make_unique<LichessGame>(json["game"], token_);
-    current_game_thread_ = std::make_unique<std::thread>(
-        &LichessGame::startGame, current_game_.get());
+    LogMessage(LOG_INFO) << "Game started: " << json["game"]["gameId"];
+    LogMessage(LOG_DEBUG) << "Started game: " << json["game"];
+    startGame(json["game"]);
     return;
   }
   if (type.compare("gameFinish") == 0) {
-    if (current_game_ != nullptr &&
-        current_game_->getGameId().compare(
-            json["game"]["gameId"].get<std::string>()) == 0) {
-      std::cout << "Waiting for game thread to exit: " << json["game"]
-                << std::endl;
-      current_game_thread_->join();
-      std::cout << "Cleaning up finished game" << std::endl;
-      current_game_thread_.reset();
-      current_game_.reset();
-    } else {
-      std::cerr << "Received gameFinish for unknown game: " << json["game"]
-                << std::endl;
+    // The game is removed when Lichess ends its stream.
+    LogMessage(LOG_INFO) << "Game finished: " << json["game"]["gameId"];
+    if (games_.count(json["game"]["gameId"].get<std::string>()) == 0) {
+      LogMessage(LOG_WARNING) << "Received gameFinish for unknown game: "
+                              << json["game"];
     }
     return;
   }
-  std::cerr << "Received invalid type for /api/stream/event " << type << ": "
-            << json << std::endl;
+  LogMessage(LOG_WARNING) << "Received invalid type for /api/stream/event "
+                          << type << ": " << json;
 }
 
 }  // namespace habits
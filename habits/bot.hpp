@@ -1,26 +1,44 @@
 #pragma once
 
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
+#include <set>
 #include <string>
-#include <thread>
+#include <utility>
+#include <vector>
 
+#include "history.hpp"
+#include "lichess_api.hpp"
 #include "position.hpp"
 #include "search.hpp"
+#include "worker_pool.hpp"
 
 namespace habits {
 
+// A game being played, whose state is handled on the compute pool. Owned by
+// shared_ptr, so the game lives until its last queued task has run.
 class LichessGame {
  public:
-  explicit LichessGame(const nlohmann::json& game, std::string token)
+  // Requests for the game are sent with `api`, which is shared by all games.
+  LichessGame(const nlohmann::json& game, LichessApi* api)
       : game_id_(game["gameId"].get<std::string>()),
         color_(game["color"].get<std::string>()[0]),
-        token_(token) {}
-
-  void startGame();
+        api_(api) {}
 
   std::string getGameId() { return game_id_; }
 
+  // Queue a line from the game's stream, without blocking the event loop.
+  // Returns true if no task is handling the game's lines, in which case one
+  // must be started to call handleQueuedStates(). The lines of a game are
+  // handled in order, one at a time.
+  bool queueGameState(std::string data);
+
+  // Handle the queued lines until there are none left.
+  void handleQueuedStates();
+
   void receiveGameState(std::string data);
 
  private:
@@ -31,7 +49,13 @@ class LichessGame {
 
   std::string game_id_;
   char color_;
-  std::string token_;
+  LichessApi* api_;
+
+  std::mutex queued_mutex_;
+  // Lines from the stream waiting to be handled.
+  std::deque<std::string> queued_states_;
+  // Whether a task has been started to handle the queued lines.
+  bool handling_ = false;
 
   Game game_;
   std::string initial_fen_ =
@@ -39,25 +63,57 @@ class LichessGame {
   Position position_ = Position::FromFen(
       "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
   std::vector<std::string> moves_;
+  PositionHistory history_;
   std::string status_;
 };
 
+// Plays games on Lichess. The event stream, the streams of all the games and
+// the moves sent are driven by a single event loop on the calling thread, and
+// the moves are found on a pool of compute threads.
 class LichessBot {
  public:
-  explicit LichessBot(std::string token) : token_(token) {}
+  // Plays up to `max_games` games at the same time, finding their moves on
+  // `threads` threads.
+  LichessBot(std::string token, int max_games, int threads)
+      : api_(std::move(token)),
+        max_games_(max_games),
+        // A game only queues one task at a time.
+        pool_(threads, max_games) {}
 
   int listenForChallenges();
 
+  // Called on the event loop with each line of the event stream.
   void receiveIncomingEvent(std::string data);
 
  private:
   void acceptChallenge(std::string challenge_id);
   bool rejectChallenge(nlohmann::json challenge);
-
-  std::string token_;
-
-  std::unique_ptr<LichessGame> current_game_;
-  std::unique_ptr<std::thread> current_game_thread_;
+  void startGame(const nlohmann::json& game);
+  // Handle the game's queued lines on the compute pool. If the pool is full,
+  // the game waits for one of the running tasks to finish.
+  void runGame(std::shared_ptr<LichessGame> game);
+  // Start the games waiting for the pool.
+  void runWaitingGames();
+
+  // Declared first, so it outlives the games using it.
+  LichessApi api_;
+  int max_games_;
+
+  // The games being played, by their id, until their streams end. Only used
+  // on the event loop.
+  std::map<std::string, std::shared_ptr<LichessGame>> games_;
+  // Challenges being accepted, whose games haven't started yet. They count
+  // towards the limit on games, so accepting doesn't go over it.
+  std::set<std::string> accepted_challenges_;
+
+  std::mutex waiting_mutex_;
+  // Games with lines to handle that the full pool turned away. They are
+  // started as the pool's tasks finish.
+  std::vector<std::shared_ptr<LichessGame>> waiting_games_;
+
+  // Declared last, so its queued tasks finish before anything else is
+  // destroyed.
+  WorkerPool pool_;
 };
 
 }  // namespace habits
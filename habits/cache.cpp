@@ -0,0 +1,77 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace habits {
+
+std::string cacheStatsReport(const CacheStats& stats) {
+  char line[160];
+  std::snprintf(line, sizeof(line),
+                "cache hits %llu, misses %llu (%.2f%% hit rate), evictions "
+                "%llu, entries %llu\n",
+                static_cast<unsigned long long>(stats.hits),
+                static_cast<unsigned long long>(stats.misses),
+                100.0 * stats.HitRate(),
+                static_cast<unsigned long long>(stats.evictions),
+                static_cast<unsigned long long>(stats.size));
+  return line;
+}
+
+ResponseCache::ResponseCache(size_t capacity)
+    : shard_capacity_(std::max<size_t>(1, capacity / SHARDS)) {}
+
+std::shared_ptr<const std::string> ResponseCache::Find(
+    const std::string& key) {
+  Shard& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.index.find(key);
+  if (it == s.index.end()) {
+    s.misses++;
+    return nullptr;
+  }
+  s.hits++;
+  s.entries.splice(s.entries.begin(), s.entries, it->second);
+  return it->second->second;
+}
+
+void ResponseCache::Insert(const std::string& key,
+                           std::shared_ptr<const std::string> response) {
+  Shard& s = shard(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.index.find(key);
+  if (it != s.index.end()) {
+    it->second->second = std::move(response);
+    s.entries.splice(s.entries.begin(), s.entries, it->second);
+    return;
+  }
+  if (s.entries.size() >= shard_capacity_) {
+    // Reuse the least recently used entry's node for the new one.
+    s.index.erase(s.entries.back().first);
+    s.entries.splice(s.entries.begin(), s.entries, std::prev(s.entries.end()));
+    s.entries.front() = {key, std::move(response)};
+    s.evictions++;
+  } else {
+    s.entries.emplace_front(key, std::move(response));
+  }
+  s.index.emplace(key, s.entries.begin());
+}
+
+CacheStats ResponseCache::Stats() const {
+  CacheStats stats;
+  for (const Shard& s : shards_) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    stats.hits += s.hits;
+    stats.misses += s.misses;
+    stats.evictions += s.evictions;
+    stats.size += s.entries.size();
+  }
+  return stats;
+}
+
+}  // namespace habits
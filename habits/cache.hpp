@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace habits {
+
+// Counts of how well a ResponseCache is doing.
+struct CacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t size = 0;
+
+  double HitRate() const {
+    return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses)
+                             : 0.0;
+  }
+};
+
+// A human readable line of the cache statistics.
+std::string cacheStatsReport(const CacheStats& stats);
+
+// A bounded cache of serialized responses, evicting the least recently used
+// ones once full. The entries are split over shards with a lock each, so
+// concurrent requests rarely wait on each other, and each shard evicts on its
+// own.
+class ResponseCache {
+ public:
+  explicit ResponseCache(size_t capacity);
+
+  // Find the response for the key, or nullptr if it's not cached.
+  std::shared_ptr<const std::string> Find(const std::string& key);
+
+  // Cache the response for the key, replacing any already cached.
+  void Insert(const std::string& key,
+              std::shared_ptr<const std::string> response);
+
+  CacheStats Stats() const;
+
+ private:
+  static constexpr int SHARDS = 16;
+
+  struct Shard {
+    using Entry = std::pair<std::string, std::shared_ptr<const std::string>>;
+
+    mutable std::mutex mutex;
+    // The most recently used entry first.
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+  };
+
+  Shard& shard(const std::string& key) {
+    return shards_[std::hash<std::string>()(key) % SHARDS];
+  }
+
+  const size_t shard_capacity_;
+  Shard shards_[SHARDS];
+};
+
+}  // namespace habits
@@ -0,0 +1,99 @@
+#include "cache.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace habits {
+
+namespace {
+
+std::shared_ptr<const std::string> response(const std::string& s) {
+  return std::make_shared<const std::string>(s);
+}
+
+TEST(CacheTest, FindAndInsert) {
+  ResponseCache cache(64);
+  EXPECT_EQ(cache.Find("a"), nullptr);
+  cache.Insert("a", response("1"));
+  cache.Insert("b", response("2"));
+  ASSERT_NE(cache.Find("a"), nullptr);
+  EXPECT_EQ(*cache.Find("a"), "1");
+  EXPECT_EQ(*cache.Find("b"), "2");
+
+  cache.Insert("a", response("3"));
+  EXPECT_EQ(*cache.Find("a"), "3");
+
+  CacheStats stats = cache.Stats();
+  EXPECT_EQ(stats.hits, 4);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.evictions, 0);
+  EXPECT_EQ(stats.size, 2);
+  EXPECT_DOUBLE_EQ(stats.HitRate(), 0.8);
+  EXPECT_EQ(cacheStatsReport(stats),
+            "cache hits 4, misses 1 (80.00% hit rate), evictions 0, "
+            "entries 2\n");
+}
+
+TEST(CacheTest, EvictsLeastRecentlyUsed) {
+  // Each of the 16 shards holds a single entry, so every key with the same
+  // shard as "a" evicts it.
+  ResponseCache cache(16);
+  cache.Insert("a", response("a"));
+  std::vector<std::string> keys;
+  for (int i = 0; i < 1000; i++) {
+    std::string key = std::to_string(i);
+    cache.Insert(key, response(key));
+    keys.push_back(key);
+  }
+  CacheStats stats = cache.Stats();
+  EXPECT_EQ(stats.size, 16);
+  EXPECT_EQ(stats.evictions, 1001 - 16);
+  EXPECT_EQ(cache.Find("a"), nullptr);
+
+  // The most recently inserted key is always kept.
+  EXPECT_EQ(*cache.Find("999"), "999");
+}
+
+TEST(CacheTest, KeepsRecentlyFound) {
+  ResponseCache cache(32);
+  // Fill past capacity while keeping "a" in use, which should never be
+  // evicted.
+  cache.Insert("a", response("a"));
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_NE(cache.Find("a"), nullptr) << i;
+    cache.Insert(std::to_string(i), response(""));
+  }
+  EXPECT_LE(cache.Stats().size, 32);
+}
+
+TEST(CacheTest, Concurrent) {
+  ResponseCache cache(256);
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < 4; thread++) {
+    threads.emplace_back([&cache]() {
+      for (int i = 0; i < 10000; i++) {
+        std::string key = std::to_string(i % 500);
+        std::shared_ptr<const std::string> found = cache.Find(key);
+        if (found == nullptr) {
+          cache.Insert(key, response(key));
+        } else {
+          EXPECT_EQ(*found, key);
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  CacheStats stats = cache.Stats();
+  EXPECT_EQ(stats.hits + stats.misses, 40000);
+  EXPECT_LE(stats.size, 256);
+}
+
+}  // namespace
+}  // namespace habits
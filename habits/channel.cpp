@@ -0,0 +1,415 @@
+#include "channel.hpp"
+
+#include <netinet/in.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "codec.hpp"
+#include "log.hpp"
+#include "moves.hpp"
+#include "position.hpp"
+#include "response.hpp"
+#include "search.hpp"
+#include "websocket.hpp"
+
+namespace habits {
+
+namespace {
+
+// Close codes sent to clients, from RFC 6455.
+constexpr uint16_t CLOSE_NORMAL = 1000;
+constexpr uint16_t CLOSE_GOING_AWAY = 1001;
+constexpr uint16_t CLOSE_PROTOCOL_ERROR = 1002;
+constexpr uint16_t CLOSE_UNSUPPORTED_DATA = 1003;
+constexpr uint16_t CLOSE_TOO_BIG = 1009;
+
+// The string value of a member of a JSON object, or an empty string if it's
+// missing or not a string.
+std::string stringField(const nlohmann::json& object, const char* key) {
+  auto it = object.find(key);
+  if (it == object.end() || !it->is_string()) {
+    return "";
+  }
+  return it->get<std::string>();
+}
+
+// Whether the move, in UCI form, is one of the legal moves in the position.
+bool isLegalMove(const Position& p, std::string_view move) {
+  LegalMoves legal_moves(p);
+  for (const auto& [piece_on_square, targets] : legal_moves.Moves()) {
+    for (const PieceMove& target : targets) {
+      if (move == piece_on_square.square.Algebraic() + target.Algebraic()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Send all the data, returning false if the connection failed.
+bool sendAll(int socket, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t sent = send(socket, data.data(), data.size(), MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data.remove_prefix(sent);
+  }
+  return true;
+}
+
+// Make receives on the socket fail after `timeout` without data, and sends
+// after `send_timeout` without progress.
+void setTimeouts(int socket, std::chrono::seconds timeout,
+                 std::chrono::seconds send_timeout) {
+  timeval receive = {static_cast<time_t>(timeout.count()), 0};
+  setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &receive, sizeof(receive));
+  timeval send = {static_cast<time_t>(send_timeout.count()), 0};
+  setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &send, sizeof(send));
+}
+
+void sendClose(int socket, uint16_t code) {
+  const char status[] = {static_cast<char>(code >> 8), static_cast<char>(code)};
+  std::string frame;
+  appendWebSocketFrame(WS_CLOSE, std::string_view(status, sizeof(status)),
+                       &frame);
+  sendAll(socket, frame);
+}
+
+}  // namespace
+
+void GameChannel::HandleMessage(std::string_view message) {
+  LogMessage(LOG_DEBUG) << "Channel message: " << message;
+  nlohmann::json json = nlohmann::json::parse(message, nullptr, false);
+  if (!json.is_object()) {
+    sendError("Invalid JSON message");
+    return;
+  }
+  std::string type = stringField(json, "type");
+  if (type == "newgame") {
+    newGame(json);
+  } else if (type == "move") {
+    makeMove(json);
+  } else if (type == "search") {
+    if (session_ == nullptr) {
+      sendError("No game, send a 'newgame' message first");
+      return;
+    }
+    engineMove();
+  } else {
+    sendError("Unknown message type: " + type);
+  }
+}
+
+void GameChannel::newGame(const nlohmann::json& message) {
+  Position p;
+  std::string pos = stringField(message, "pos");
+  std::string fen = stringField(message, "fen");
+  if (!pos.empty()) {
+    PackedPosition packed;
+    if (PackedPosition::FromBase64(pos, &packed) != 0 ||
+        unpackPosition(packed, &p) != 0) {
+      sendError("Invalid 'pos'");
+      return;
+    }
+  } else if (!fen.empty()) {
+    FenError fen_error = Position::ParseFen(fen, &p);
+    if (fen_error != FEN_OK) {
+      sendError(std::string("Invalid 'fen': ") + fenErrorName(fen_error));
+      return;
+    }
+  } else {
+    sendError("Missing 'fen' or 'pos'");
+    return;
+  }
+
+  std::string engine = stringField(message, "engine");
+  if (engine == "w") {
+    engine_color_ = WHITE;
+  } else if (engine == "b") {
+    engine_color_ = BLACK;
+  } else if (engine.empty()) {
+    engine_color_.reset();
+  } else {
+    sendError("Invalid 'engine', must be 'w' or 'b'");
+    return;
+  }
+
+  std::string fields_names = stringField(message, "fields");
+  int fields = ALL_RESPONSE_FIELDS;
+  if (!fields_names.empty() &&
+      parseResponseFields(fields_names, &fields) != 0) {
+    sendError("Invalid 'fields', must be a comma separated list of legal, "
+              "control, check and status");
+    return;
+  }
+
+  fields_ = fields;
+  session_ = sessions_->Create(&game_id_);
+  position_ = p;
+  std::string response;
+  {
+    std::lock_guard<std::mutex> lock(session_->mutex);
+    session_->history.Reset(p);
+    response = gameResponse(cache_, game_id_, p, "", session_->history,
+                            fields_);
+  }
+  send_(response);
+
+  if (isEngineTurn()) {
+    engineMove();
+  }
+}
+
+void GameChannel::makeMove(const nlohmann::json& message) {
+  if (session_ == nullptr) {
+    sendError("No game, send a 'newgame' message first");
+    return;
+  }
+  std::string move = stringField(message, "move");
+  Position p = position_;
+  if (!isLegalMove(p, move) || habits::move(&p, move) != 0) {
+    LogMessage(LOG_WARNING) << "Illegal move " << move
+                            << " in position: " << position_.ToFen();
+    sendError("Illegal move");
+    return;
+  }
+
+  position_ = p;
+  std::string response;
+  {
+    std::lock_guard<std::mutex> lock(session_->mutex);
+    session_->game.opponentMove(move);
+    session_->history.Push(p);
+    response = gameResponse(cache_, game_id_, p, move, session_->history,
+                            fields_);
+  }
+  send_(response);
+
+  if (isEngineTurn()) {
+    engineMove();
+  }
+}
+
+void GameChannel::engineMove() {
+  std::string response;
+  {
+    std::lock_guard<std::mutex> lock(session_->mutex);
+    Decision decision = session_->game.bestMove(position_, &session_->history);
+    LogMessage(LOG_DEBUG) << "Found best move: " << decision;
+    Position p = position_;
+    if (!decision.move.empty() && habits::move(&p, decision.move) == 0) {
+      position_ = p;
+      session_->history.Push(p);
+      response = gameResponse(cache_, game_id_, p, decision.move,
+                              session_->history, fields_);
+    }
+  }
+  if (response.empty()) {
+    sendError("No legal moves");
+    return;
+  }
+  send_(response);
+}
+
+bool GameChannel::isEngineTurn() {
+  if (engine_color_ != position_.active_color) {
+    return false;
+  }
+  // Don't move once the game is over.
+  std::lock_guard<std::mutex> lock(session_->mutex);
+  return hasLegalMove(position_) && !position_.IsDraw() &&
+         session_->history.Repetitions() < 2;
+}
+
+void GameChannel::sendError(const std::string& error) {
+  nlohmann::json json;
+  json["error"] = error;
+  send_(json.dump());
+}
+
+int GameChannelServer::Listen(uint16_t port) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0) {
+    return 1;
+  }
+  int reuse = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (bind(listener, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    close(listener);
+    return 1;
+  }
+
+  while (true) {
+    int connection = accept(listener, nullptr, nullptr);
+    if (connection < 0) {
+      LogMessage(LOG_ERROR) << "Failed to accept channel connection";
+      close(listener);
+      return 0;
+    }
+    if (connections_ >= MAX_CONNECTIONS) {
+      LogMessage(LOG_WARNING) << "Too many channel connections, rejecting";
+      sendAll(connection,
+              "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+      close(connection);
+      continue;
+    }
+    connections_++;
+    std::thread([this, connection]() { serve(connection); }).detach();
+  }
+}
+
+void GameChannelServer::serve(int socket) {
+  std::string received;
+  char buffer[4096];
+  setTimeouts(socket, HANDSHAKE_TIMEOUT, SEND_TIMEOUT);
+
+  // Read the handshake's headers, up to the blank line.
+  size_t headers_end;
+  while ((headers_end = received.find("\r\n\r\n")) == std::string::npos) {
+    ssize_t length = recv(socket, buffer, sizeof(buffer), 0);
+    if (length <= 0 || received.size() + length > MAX_HANDSHAKE_SIZE) {
+      close(socket);
+      connections_--;
+      return;
+    }
+    received.append(buffer, length);
+  }
+  std::string path;
+  std::string key;
+  if (parseWebSocketUpgrade(received.substr(0, headers_end + 4), &path,
+                            &key) != 0 ||
+      path.substr(0, path.find('?')) != "/engine/channel") {
+    sendAll(socket, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+    close(socket);
+    connections_--;
+    return;
+  }
+  received.erase(0, headers_end + 4);
+  sendAll(socket, webSocketUpgradeResponse(key));
+  setTimeouts(socket, IDLE_TIMEOUT, SEND_TIMEOUT);
+
+  GameChannel channel(sessions_, cache_, [socket](const std::string& message) {
+    std::string frame;
+    appendWebSocketFrame(WS_TEXT, message, &frame);
+    sendAll(socket, frame);
+  });
+
+  // The text of a message split over several frames, and whether one has
+  // been started and not yet finished.
+  std::string message;
+  bool fragmented = false;
+  bool open = true;
+  while (open) {
+    WebSocketFrame frame;
+    size_t frame_size;
+    FrameError error =
+        parseWebSocketFrame(received, MAX_MESSAGE_SIZE, &frame, &frame_size);
+    if (error == FRAME_INCOMPLETE) {
+      ssize_t length = recv(socket, buffer, sizeof(buffer), 0);
+      if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        LogMessage(LOG_INFO) << "Closing idle channel connection";
+        sendClose(socket, CLOSE_GOING_AWAY);
+        break;
+      }
+      if (length <= 0) {
+        break;
+      }
+      received.append(buffer, length);
+      continue;
+    }
+    if (error != FRAME_OK) {
+      LogMessage(LOG_WARNING) << "Bad channel frame: "
+                              << frameErrorName(error);
+      sendClose(socket,
+                error == FRAME_TOO_LARGE ? CLOSE_TOO_BIG : CLOSE_PROTOCOL_ERROR);
+      break;
+    }
+    received.erase(0, frame_size);
+
+    switch (frame.opcode) {
+      case WS_TEXT:
+      case WS_CONTINUATION:
+        // A continuation must follow an unfinished message, and a new message
+        // must not start until the last one is finished.
+        if ((frame.opcode == WS_CONTINUATION) != fragmented) {
+          LogMessage(LOG_WARNING) << "Unexpected "
+                                  << (fragmented ? "text" : "continuation")
+                                  << " frame on channel";
+          sendClose(socket, CLOSE_PROTOCOL_ERROR);
+          open = false;
+          break;
+        }
+        fragmented = !frame.fin;
+        message += frame.payload;
+        if (message.size() > MAX_MESSAGE_SIZE) {
+          sendClose(socket, CLOSE_TOO_BIG);
+          open = false;
+        } else if (frame.fin) {
+          if (!handleOnPool(&channel, message)) {
+            LogMessage(LOG_WARNING) << "Engine is busy, rejecting channel "
+                                       "message";
+            nlohmann::json busy;
+            busy["error"] = "Engine is busy, try again";
+            std::string reply;
+            appendWebSocketFrame(WS_TEXT, busy.dump(), &reply);
+            sendAll(socket, reply);
+          }
+          message.clear();
+        }
+        break;
+      case WS_BINARY:
+        sendClose(socket, CLOSE_UNSUPPORTED_DATA);
+        open = false;
+        break;
+      case WS_PING: {
+        std::string pong;
+        appendWebSocketFrame(WS_PONG, frame.payload, &pong);
+        sendAll(socket, pong);
+        break;
+      }
+      case WS_PONG:
+        break;
+      case WS_CLOSE:
+        sendClose(socket, CLOSE_NORMAL);
+        open = false;
+        break;
+    }
+  }
+  close(socket);
+  connections_--;
+}
+
+bool GameChannelServer::handleOnPool(GameChannel* channel,
+                                     const std::string& message) {
+  std::promise<void> handled;
+  std::future<void> done = handled.get_future();
+  if (!pool_->TrySubmit([channel, &message, &handled]() {
+        channel->HandleMessage(message);
+        handled.set_value();
+      })) {
+    return false;
+  }
+  done.wait();
+  return true;
+}
+
+}  // namespace habits
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "cache.hpp"
+#include "position.hpp"
+#include "response.hpp"
+#include "sessions.hpp"
+#include "worker_pool.hpp"
+
+namespace habits {
+
+// A game played over a persistent connection. The client only sends its moves,
+// and is sent the position after each one, followed by the engine's reply as
+// soon as it has been found, so there's no request per move and no FEN sent
+// back and forth. The client sends JSON messages:
+//
+//   {"type": "newgame", "fen": <FEN>, "engine": "b"}
+//     Start a new game from the position in "fen" (or a PackedPosition in
+//     "pos"), with the engine playing the color in "engine". Without
+//     "engine", the engine only moves when asked with a "search" message.
+//     An optional "fields" limits the positions sent to the listed fields, as
+//     with the HTTP server's 'fields' query param.
+//   {"type": "move", "move": <move in UCI form>}
+//   {"type": "search"}
+//
+// Positions are sent as the same JSON objects the HTTP server responds with,
+// and errors as {"error": <description>}.
+class GameChannel {
+ public:
+  using Sender = std::function<void(const std::string& message)>;
+
+  // New games are added to `sessions`, so they can also be played over HTTP.
+  // Messages for the client are passed to `send`.
+  GameChannel(GameSessions* sessions, ResponseCache* cache, Sender send)
+      : sessions_(sessions), cache_(cache), send_(std::move(send)) {}
+
+  // Handle a message from the client, sending any replies before returning.
+  void HandleMessage(std::string_view message);
+
+ private:
+  void newGame(const nlohmann::json& message);
+  void makeMove(const nlohmann::json& message);
+  // Find and play the engine's move, and send the position after it.
+  void engineMove();
+  // Whether the engine should move next in the current game.
+  bool isEngineTurn();
+  void sendError(const std::string& error);
+
+  GameSessions* sessions_;
+  ResponseCache* cache_;
+  Sender send_;
+
+  // The current game, unset until the first "newgame" message.
+  std::string game_id_;
+  std::shared_ptr<GameSession> session_;
+  Position position_;
+  // The color the engine plays, if it should reply to moves by itself.
+  std::optional<Color> engine_color_;
+  // The ResponseFields sent for each position of the current game.
+  int fields_ = ALL_RESPONSE_FIELDS;
+};
+
+// Accepts WebSocket connections to /engine/channel, and plays a GameChannel
+// over each one on its own thread. The messages are handled on the shared
+// WorkerPool, so the engine work is bounded along with the HTTP requests.
+class GameChannelServer {
+ public:
+  GameChannelServer(GameSessions* sessions, ResponseCache* cache,
+                    WorkerPool* pool)
+      : sessions_(sessions), cache_(cache), pool_(pool) {}
+
+  // Listen for connections on the port, blocking until accepting fails.
+  // Returns 1 if it couldn't listen on the port.
+  int Listen(uint16_t port);
+
+ private:
+  // Connections beyond this are turned away, as each one takes a thread.
+  static constexpr int MAX_CONNECTIONS = 64;
+  static constexpr size_t MAX_HANDSHAKE_SIZE = 8 * 1024;
+  static constexpr size_t MAX_MESSAGE_SIZE = 64 * 1024;
+  // Connections are closed when the client sends nothing for this long (a ping
+  // keeps them open), so idle clients can't hold on to all the connections.
+  static constexpr std::chrono::seconds HANDSHAKE_TIMEOUT{10};
+  static constexpr std::chrono::seconds IDLE_TIMEOUT{300};
+  // Sends to a client that stops reading fail after this long.
+  static constexpr std::chrono::seconds SEND_TIMEOUT{10};
+
+  // Run the handshake, then the game channel, on a connected socket, closing
+  // it when done.
+  void serve(int socket);
+  // Handle the message on the pool, waiting for it to finish. Returns false
+  // if the pool is too busy to take it.
+  bool handleOnPool(GameChannel* channel, const std::string& message);
+
+  GameSessions* sessions_;
+  ResponseCache* cache_;
+  WorkerPool* pool_;
+  std::atomic<int> connections_{0};
+};
+
+}  // namespace habits
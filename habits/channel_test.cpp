@@ -0,0 +1,145 @@
+#include "channel.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "cache.hpp"
+#include "sessions.hpp"
+
+namespace habits {
+
+namespace {
+
+class GameChannelTest : public testing::Test {
+ protected:
+  // Handle the message, and return the messages sent back.
+  std::vector<nlohmann::json> Send(const std::string& message) {
+    std::vector<nlohmann::json> replies;
+    sent_.clear();
+    channel_.HandleMessage(message);
+    for (const std::string& reply : sent_) {
+      replies.push_back(nlohmann::json::parse(reply));
+    }
+    return replies;
+  }
+
+  GameSessions sessions_;
+  ResponseCache cache_{16};
+  std::vector<std::string> sent_;
+  GameChannel channel_{&sessions_, &cache_, [this](const std::string& message) {
+                         sent_.push_back(message);
+                       }};
+};
+
+TEST_F(GameChannelTest, PlaysAgainstEngine) {
+  auto replies = Send(
+      R"({"type": "newgame", "engine": "b", "fen": )"
+      R"("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"})");
+  ASSERT_EQ(replies.size(), 1);
+  std::string game = replies[0]["game"].get<std::string>();
+  EXPECT_EQ(replies[0]["turn"], "w");
+  EXPECT_EQ(sessions_.Size(), 1);
+
+  // The move is sent back, followed by the engine's reply.
+  replies = Send(R"({"type": "move", "move": "e2e4"})");
+  ASSERT_EQ(replies.size(), 2);
+  EXPECT_EQ(replies[0]["game"], game);
+  EXPECT_EQ(replies[0]["last_move"], "e2e4");
+  EXPECT_EQ(replies[0]["turn"], "b");
+  EXPECT_EQ(replies[1]["game"], game);
+  EXPECT_EQ(replies[1]["turn"], "w");
+  EXPECT_NE(replies[1]["last_move"], "");
+
+  // The game can be continued over HTTP with the same session.
+  EXPECT_NE(sessions_.Find(game), nullptr);
+}
+
+TEST_F(GameChannelTest, EngineMovesFirst) {
+  auto replies = Send(
+      R"({"type": "newgame", "engine": "w", "fen": )"
+      R"("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"})");
+  ASSERT_EQ(replies.size(), 2);
+  EXPECT_EQ(replies[1]["turn"], "b");
+}
+
+TEST_F(GameChannelTest, SearchesWhenAsked) {
+  auto replies = Send(
+      R"({"type": "newgame", "fen": )"
+      R"("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"})");
+  ASSERT_EQ(replies.size(), 1);
+  replies = Send(R"({"type": "move", "move": "e2e4"})");
+  ASSERT_EQ(replies.size(), 1);
+  replies = Send(R"({"type": "search"})");
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_EQ(replies[0]["turn"], "w");
+}
+
+TEST_F(GameChannelTest, DoesNotMoveAfterGameOver) {
+  // White mates with the queen, so the engine has nothing to play.
+  auto replies = Send(R"({"type": "newgame", "engine": "b", )"
+                      R"("fen": "7k/8/6K1/8/8/8/8/5Q2 w - - 0 1"})");
+  ASSERT_EQ(replies.size(), 1);
+  replies = Send(R"({"type": "move", "move": "f1f8"})");
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_EQ(replies[0]["in_checkmate"], true);
+}
+
+TEST_F(GameChannelTest, SendsSelectedFields) {
+  auto replies = Send(
+      R"({"type": "newgame", "engine": "b", "fields": "legal,status", )"
+      R"("fen": "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"})");
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_TRUE(replies[0].contains("legal"));
+  EXPECT_TRUE(replies[0].contains("in_draw"));
+  EXPECT_FALSE(replies[0].contains("control"));
+  EXPECT_FALSE(replies[0].contains("in_check"));
+
+  // The engine's replies have the same fields.
+  replies = Send(R"({"type": "move", "move": "e2e4"})");
+  ASSERT_EQ(replies.size(), 2);
+  EXPECT_FALSE(replies[1].contains("control"));
+
+  replies = Send(R"({"type": "newgame", "fields": "moves", "fen": )"
+                 R"("8/8/8/3k4/8/8/8/4K3 w - - 0 1"})");
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_THAT(replies[0]["error"].get<std::string>(),
+              testing::StartsWith("Invalid 'fields'"));
+}
+
+TEST_F(GameChannelTest, SendsErrors) {
+  auto replies = Send("not json");
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_EQ(replies[0]["error"], "Invalid JSON message");
+
+  replies = Send(R"({"type": "move", "move": "e2e4"})");
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_EQ(replies[0]["error"], "No game, send a 'newgame' message first");
+
+  replies = Send(R"({"type": "newgame", "fen": "bad"})");
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_THAT(replies[0]["error"].get<std::string>(),
+              testing::StartsWith("Invalid 'fen'"));
+
+  replies = Send(R"({"type": "newgame", "engine": "x", "fen": )"
+                 R"("8/8/8/3k4/8/8/8/4K3 w - - 0 1"})");
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_EQ(replies[0]["error"], "Invalid 'engine', must be 'w' or 'b'");
+
+  replies = Send(R"({"type": "newgame", "fen": )"
+                 R"("8/8/8/3k4/8/8/8/4K3 w - - 0 1"})");
+  ASSERT_EQ(replies.size(), 1);
+  replies = Send(R"({"type": "move", "move": "e1e5"})");
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_EQ(replies[0]["error"], "Illegal move");
+
+  replies = Send(R"({"type": "resign"})");
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_EQ(replies[0]["error"], "Unknown message type: resign");
+}
+
+}  // namespace
+}  // namespace habits
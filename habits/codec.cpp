@@ -0,0 +1,225 @@
+#include "codec.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+constexpr size_t OCCUPANCY_OFFSET = 0;
+constexpr size_t PIECES_OFFSET = 8;
+constexpr size_t FLAGS_OFFSET = 24;
+constexpr size_t EN_PASSANT_OFFSET = 25;
+constexpr size_t HALFMOVE_CLOCK_OFFSET = 26;
+constexpr size_t FULLMOVE_NUMBER_OFFSET = 28;
+constexpr size_t RESERVED_OFFSET = 30;
+
+constexpr int MAX_PIECES = 32;
+constexpr uint8_t BLACK_TO_MOVE_FLAG = 1;
+constexpr uint8_t CASTLING_FLAGS_SHIFT = 1;
+constexpr uint8_t VALID_FLAGS = 0x1f;
+constexpr uint8_t NO_EN_PASSANT = 0xff;
+
+constexpr std::string_view BASE64_ALPHABET =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// Lookup from a base64url character to its 6-bit value, -1 for other
+// characters.
+struct Base64Table {
+  int8_t values[256];
+
+  constexpr Base64Table() : values() {
+    for (int c = 0; c < 256; c++) {
+      values[c] = -1;
+    }
+    for (size_t value = 0; value < BASE64_ALPHABET.size(); value++) {
+      values[static_cast<unsigned char>(BASE64_ALPHABET[value])] = value;
+    }
+  }
+
+  int Find(char c) const { return values[static_cast<unsigned char>(c)]; }
+};
+
+constexpr Base64Table BASE64_TABLE;
+
+void writeLittleEndian(uint64_t value, int size, uint8_t* bytes) {
+  for (int i = 0; i < size; i++) {
+    bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+uint64_t readLittleEndian(const uint8_t* bytes, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; i++) {
+    value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+  }
+  return value;
+}
+
+int pieceNibble(const PackedPosition& packed, int n) {
+  return (packed.bytes[PIECES_OFFSET + n / 2] >> (4 * (n % 2))) & 0xf;
+}
+
+}  // namespace
+
+std::string PackedPosition::ToBase64() const {
+  std::string base64(PACKED_POSITION_BASE64_SIZE, '\0');
+  WriteBase64(base64.data());
+  return base64;
+}
+
+void PackedPosition::WriteBase64(char* buffer) const {
+  size_t out = 0;
+  for (size_t i = 0; i < PACKED_POSITION_SIZE; i += 3) {
+    uint32_t group = bytes[i] << 16;
+    if (i + 1 < PACKED_POSITION_SIZE) {
+      group |= bytes[i + 1] << 8;
+    }
+    if (i + 2 < PACKED_POSITION_SIZE) {
+      group |= bytes[i + 2];
+    }
+    for (int shift = 18; shift >= 0 && out < PACKED_POSITION_BASE64_SIZE;
+         shift -= 6) {
+      buffer[out++] = BASE64_ALPHABET[(group >> shift) & 0x3f];
+    }
+  }
+}
+
+int PackedPosition::FromBase64(std::string_view base64,
+                               PackedPosition* packed) {
+  if (base64.size() != PACKED_POSITION_BASE64_SIZE) {
+    return 1;
+  }
+  size_t out = 0;
+  uint32_t bits = 0;
+  int num_bits = 0;
+  for (char c : base64) {
+    int value = BASE64_TABLE.Find(c);
+    if (value < 0) {
+      return 1;
+    }
+    bits = (bits << 6) | value;
+    num_bits += 6;
+    if (num_bits >= 8) {
+      num_bits -= 8;
+      packed->bytes[out++] = static_cast<uint8_t>(bits >> num_bits);
+    }
+  }
+  // The unused low bits of the last character must be 0, so that each packed
+  // position has a single encoding.
+  if ((bits & ((1u << num_bits) - 1)) != 0) {
+    return 1;
+  }
+  return 0;
+}
+
+bool PackedPosition::operator==(const PackedPosition& other) const {
+  return std::memcmp(bytes, other.bytes, PACKED_POSITION_SIZE) == 0;
+}
+
+int packPosition(const Position& p, PackedPosition* packed) {
+  uint64_t occupancy = 0ull;
+  int num_pieces = 0;
+  int8_t mailbox[64];
+  for (int piece = WPAWN; piece <= BKING; piece++) {
+    occupancy |= p.bitboards[piece];
+    for (Square square : Squares(p.bitboards[piece])) {
+      mailbox[square.index] = piece;
+      num_pieces++;
+    }
+  }
+  // Overlapping pieces would also make the counts differ.
+  if (num_pieces > MAX_PIECES ||
+      num_pieces != __builtin_popcountll(occupancy)) {
+    return 1;
+  }
+
+  *packed = PackedPosition();
+  writeLittleEndian(occupancy, 8, packed->bytes + OCCUPANCY_OFFSET);
+  int n = 0;
+  for (Square square : Squares(occupancy)) {
+    packed->bytes[PIECES_OFFSET + n / 2] |= mailbox[square.index]
+                                            << (4 * (n % 2));
+    n++;
+  }
+
+  uint8_t flags = p.active_color == BLACK ? BLACK_TO_MOVE_FLAG : 0;
+  flags |= p.castling << CASTLING_FLAGS_SHIFT;
+  packed->bytes[FLAGS_OFFSET] = flags;
+  packed->bytes[EN_PASSANT_OFFSET] =
+      p.en_passant_target_square.IsSet() ? p.en_passant_target_square.index
+                                         : NO_EN_PASSANT;
+  writeLittleEndian(p.halfmove_clock, 2,
+                    packed->bytes + HALFMOVE_CLOCK_OFFSET);
+  writeLittleEndian(p.fullmove_number, 2,
+                    packed->bytes + FULLMOVE_NUMBER_OFFSET);
+  return 0;
+}
+
+int unpackPosition(const PackedPosition& packed, Position* p) {
+  const uint8_t* bytes = packed.bytes;
+  uint64_t occupancy = readLittleEndian(bytes + OCCUPANCY_OFFSET, 8);
+  int num_pieces = __builtin_popcountll(occupancy);
+  uint8_t flags = bytes[FLAGS_OFFSET];
+  uint8_t en_passant = bytes[EN_PASSANT_OFFSET];
+  if (num_pieces > MAX_PIECES || (flags & ~VALID_FLAGS) != 0 ||
+      bytes[RESERVED_OFFSET] != 0 || bytes[RESERVED_OFFSET + 1] != 0) {
+    return 1;
+  }
+  if (en_passant != NO_EN_PASSANT &&
+      (en_passant >= 64 || (Square(en_passant).Rank() != 3 &&
+                            Square(en_passant).Rank() != 6))) {
+    return 1;
+  }
+  for (int n = num_pieces; n < MAX_PIECES; n++) {
+    if (pieceNibble(packed, n) != 0) {
+      return 1;
+    }
+  }
+
+  *p = Position();
+  int n = 0;
+  for (Square square : Squares(occupancy)) {
+    int piece = pieceNibble(packed, n++);
+    if (piece > BKING) {
+      return 1;
+    }
+    p->bitboards[piece] |= square.BitboardMask();
+  }
+  p->active_color = (flags & BLACK_TO_MOVE_FLAG) != 0 ? BLACK : WHITE;
+  p->castling = flags >> CASTLING_FLAGS_SHIFT;
+  if (en_passant != NO_EN_PASSANT) {
+    p->en_passant_target_square = Square(en_passant);
+  }
+  p->halfmove_clock = readLittleEndian(bytes + HALFMOVE_CLOCK_OFFSET, 2);
+  p->fullmove_number = readLittleEndian(bytes + FULLMOVE_NUMBER_OFFSET, 2);
+  return 0;
+}
+
+size_t packPositions(const Position* positions, size_t count,
+                     PackedPosition* packed) {
+  for (size_t i = 0; i < count; i++) {
+    if (packPosition(positions[i], &packed[i]) != 0) {
+      return i;
+    }
+  }
+  return count;
+}
+
+size_t unpackPositions(const PackedPosition* packed, size_t count,
+                       Position* positions) {
+  for (size_t i = 0; i < count; i++) {
+    if (unpackPosition(packed[i], &positions[i]) != 0) {
+      return i;
+    }
+  }
+  return count;
+}
+
+}  // namespace habits
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "position.hpp"
+
+namespace habits {
+
+// The number of bytes in a PackedPosition.
+constexpr size_t PACKED_POSITION_SIZE = 32;
+
+// The length of a PackedPosition in unpadded base64url.
+constexpr size_t PACKED_POSITION_BASE64_SIZE = 43;
+
+// A fixed size binary encoding of a Position, for storing and sending
+// positions more cheaply than FEN strings. All values are little endian:
+//
+//   bytes  0-7:  occupancy bitboard of all the pieces.
+//   bytes  8-23: a 4-bit ColoredPiece for each set bit of the occupancy, in
+//                square order, low nibble first. Unused nibbles are 0.
+//   byte  24:    bit 0 is set if black is to move, bits 1-4 are the castling
+//                availability for each ColoredCastle.
+//   byte  25:    the en passant target square index, or 0xff if unset.
+//   bytes 26-27: the halfmove clock.
+//   bytes 28-29: the fullmove number.
+//   bytes 30-31: reserved, always 0.
+//
+// Positions with more than 32 pieces can't be packed. Equal positions always
+// have equal encodings.
+struct PackedPosition {
+  uint8_t bytes[PACKED_POSITION_SIZE] = {0};
+
+  // Encode as an unpadded base64url string, which is safe in URLs without
+  // escaping.
+  std::string ToBase64() const;
+
+  // Write the unpadded base64url encoding into `buffer`, which must be at least
+  // PACKED_POSITION_BASE64_SIZE long. No null character is written.
+  void WriteBase64(char* buffer) const;
+
+  // Decode an unpadded base64url string into `packed`. Returns 0 on success,
+  // or 1 if the string is not a valid encoding of a PackedPosition.
+  static int FromBase64(std::string_view base64, PackedPosition* packed);
+
+  bool operator==(const PackedPosition& other) const;
+  bool operator!=(const PackedPosition& other) const {
+    return !(*this == other);
+  }
+};
+
+// Encode the position into `packed`. Returns 0 on success, or 1 if the
+// position can't be packed.
+int packPosition(const Position& p, PackedPosition* packed);
+
+// Decode `packed` into the position. Returns 0 on success, or 1 if `packed`
+// is not a valid encoding.
+int unpackPosition(const PackedPosition& packed, Position* p);
+
+// Encode `count` positions into `packed`, which must have room for them.
+// Returns the number of positions encoded, which is less than `count` if a
+// position can't be packed.
+size_t packPositions(const Position* positions, size_t count,
+                     PackedPosition* packed);
+
+// Decode `count` packed positions into `positions`, which must have room for
+// them. Returns the number of positions decoded, which is less than `count` if
+// an encoding is invalid.
+size_t unpackPositions(const PackedPosition* packed, size_t count,
+                       Position* positions);
+
+}  // namespace habits
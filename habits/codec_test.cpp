@@ -0,0 +1,146 @@
+#include "codec.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+TEST(CodecTest, PackStartPos) {
+  PackedPosition packed;
+  ASSERT_EQ(packPosition(Position::FromFen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/"
+                                           "RNBQKBNR w KQkq - 0 1"),
+                         &packed),
+            0);
+  EXPECT_EQ(packed.ToBase64(), "__8AAAAA__8TQiUxAAAAAGZmZmZ5qIuXHv8AAAEAAAA");
+
+  Position p;
+  ASSERT_EQ(unpackPosition(packed, &p), 0);
+  EXPECT_EQ(p.ToFen(),
+            "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+}
+
+TEST(CodecTest, PackState) {
+  std::string fen = "4k3/8/8/3pP3/8/8/8/R3K3 w Q d6 12 34";
+  PackedPosition packed;
+  ASSERT_EQ(packPosition(Position::FromFen(fen), &packed), 0);
+  Position p;
+  ASSERT_EQ(unpackPosition(packed, &p), 0);
+  EXPECT_EQ(p.ToFen(), fen);
+
+  fen = "4k3/8/8/8/3Pp3/8/8/4K2R b K d3 0 60000";
+  ASSERT_EQ(packPosition(Position::FromFen(fen), &packed), 0);
+  ASSERT_EQ(unpackPosition(packed, &p), 0);
+  EXPECT_EQ(p.ToFen(), fen);
+}
+
+TEST(CodecTest, PackErrors) {
+  PackedPosition packed;
+  Position p = Position::FromFen("4k3/8/8/8/8/8/8/4K3 w - - 0 1");
+  p.bitboards[WQUEEN] = p.bitboards[WKING];
+  EXPECT_EQ(packPosition(p, &packed), 1);
+
+  p = Position::FromFen("4k3/8/8/8/8/8/8/4K3 w - - 0 1");
+  p.bitboards[WPAWN] = 0xffffffff00ull;
+  EXPECT_EQ(packPosition(p, &packed), 1);
+}
+
+TEST(CodecTest, UnpackErrors) {
+  PackedPosition valid;
+  ASSERT_EQ(packPosition(Position::FromFen("4k3/8/8/8/8/8/8/4K3 w - - 0 1"),
+                         &valid),
+            0);
+  Position p;
+  ASSERT_EQ(unpackPosition(valid, &p), 0);
+
+  // A piece code that is not a ColoredPiece.
+  PackedPosition packed = valid;
+  packed.bytes[8] = 0xfb;
+  EXPECT_EQ(unpackPosition(packed, &p), 1);
+
+  // A piece code for a square that is not occupied.
+  packed = valid;
+  packed.bytes[9] = 0x01;
+  EXPECT_EQ(unpackPosition(packed, &p), 1);
+
+  // Unknown flags.
+  packed = valid;
+  packed.bytes[24] = 0x20;
+  EXPECT_EQ(unpackPosition(packed, &p), 1);
+
+  // An en passant square on the wrong rank.
+  packed = valid;
+  packed.bytes[25] = 30;
+  EXPECT_EQ(unpackPosition(packed, &p), 1);
+
+  // Reserved bytes.
+  packed = valid;
+  packed.bytes[31] = 1;
+  EXPECT_EQ(unpackPosition(packed, &p), 1);
+}
+
+TEST(CodecTest, Base64) {
+  PackedPosition packed;
+  for (size_t i = 0; i < PACKED_POSITION_SIZE; i++) {
+    packed.bytes[i] = i * 8 + 3;
+  }
+  std::string base64 = packed.ToBase64();
+  EXPECT_EQ(base64.size(), PACKED_POSITION_BASE64_SIZE);
+
+  PackedPosition decoded;
+  ASSERT_EQ(PackedPosition::FromBase64(base64, &decoded), 0);
+  EXPECT_EQ(decoded, packed);
+
+  EXPECT_EQ(PackedPosition::FromBase64(base64.substr(1), &decoded), 1);
+  EXPECT_EQ(PackedPosition::FromBase64(base64 + "A", &decoded), 1);
+  EXPECT_EQ(PackedPosition::FromBase64(base64.replace(3, 1, "+"), &decoded),
+            1);
+  // The last character has unused bits that must be 0.
+  EXPECT_EQ(PackedPosition::FromBase64(
+                std::string(PACKED_POSITION_BASE64_SIZE - 1, 'A') + "B",
+                &decoded),
+            1);
+}
+
+TEST(CodecTest, PackTestSuite) {
+  std::vector<Position> positions;
+  for (const std::filesystem::directory_entry& file :
+       std::filesystem::directory_iterator("./testdata")) {
+    std::filesystem::path path = file.path();
+    if (path.extension() == ".json") {
+      std::ifstream f(path);
+      nlohmann::json testcases = nlohmann::json::parse(f);
+      for (nlohmann::json testcase : testcases["testCases"]) {
+        positions.push_back(Position::FromFen(
+            testcase["start"]["fen"].template get<std::string>()));
+        for (nlohmann::json expected : testcase["expected"]) {
+          positions.push_back(
+              Position::FromFen(expected["fen"].template get<std::string>()));
+        }
+      }
+    }
+  }
+  ASSERT_FALSE(positions.empty());
+
+  std::vector<PackedPosition> packed(positions.size());
+  ASSERT_EQ(packPositions(positions.data(), positions.size(), packed.data()),
+            positions.size());
+  std::vector<Position> unpacked(positions.size());
+  ASSERT_EQ(unpackPositions(packed.data(), packed.size(), unpacked.data()),
+            positions.size());
+  for (size_t i = 0; i < positions.size(); i++) {
+    EXPECT_EQ(unpacked[i].ToFen(), positions[i].ToFen());
+  }
+}
+
+}  // namespace
+}  // namespace habits
@@ -0,0 +1,73 @@
+// Measures the time to parse and write FEN strings, run from the build
+// directory with:
+//   ./habits/fen_benchmark
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+const std::vector<std::string> FENS = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1",
+    "r3k2r/pbppqppp/np3n2/2b1p3/2B1P3/NP3N2/PBPPQPPP/R3K2R w KQkq - 6 8",
+    "2rqr1k1/1ppbbppR/2n1pn2/3pN3/p2P1P2/2PBP1Q1/PP1N2PP/R1B3K1 b - - 1 15",
+    "8/3p2p1/8/8/8/8/P2P3P/8 b - - 56 199",
+    "3k1n2/6P1/8/8/8/8/p7/1R4K1 w - - 0 30",
+};
+
+constexpr int ITERATIONS = 200000;
+
+// Run `f` ITERATIONS times for every FEN, and print the average time per call.
+template <typename F>
+void benchmark(const char* name, F f) {
+  uint64_t checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; i++) {
+    for (const std::string& fen : FENS) {
+      checksum += f(fen);
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double ns = std::chrono::duration<double, std::nano>(elapsed).count() /
+              (static_cast<double>(ITERATIONS) * FENS.size());
+  std::cout << name << ": " << ns << " ns/op (checksum " << checksum << ")"
+            << std::endl;
+}
+
+}  // namespace
+
+}  // namespace habits
+
+int main() {
+  using habits::Position;
+
+  habits::benchmark("ParseFen", [](const std::string& fen) {
+    Position p;
+    Position::ParseFen(fen, &p);
+    return p.bitboards[habits::WKING];
+  });
+
+  std::vector<Position> positions;
+  for (const std::string& fen : habits::FENS) {
+    positions.push_back(Position::FromFen(fen));
+  }
+  size_t next = 0;
+  habits::benchmark("WriteFen", [&](const std::string&) {
+    char buffer[habits::FEN_BUFFER_SIZE];
+    const Position& p = positions[next++ % positions.size()];
+    return p.WriteFen(buffer, sizeof(buffer));
+  });
+  habits::benchmark("ToFen", [&](const std::string&) {
+    const Position& p = positions[next++ % positions.size()];
+    return p.ToFen().size();
+  });
+  return 0;
+}
@@ -0,0 +1,43 @@
+#include "history.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "position.hpp"
+
+namespace habits {
+
+void PositionHistory::Reset(const Position& p) {
+  size_ = 0;
+  Push(p);
+}
+
+void PositionHistory::Push(const Position& p) {
+  hashes_[size_ & (SIZE - 1)] = p.Hash();
+  size_++;
+  halfmove_clock_ = p.halfmove_clock;
+}
+
+int PositionHistory::Repetitions() const {
+  if (size_ == 0) {
+    return 0;
+  }
+  return count(hashes_[(size_ - 1) & (SIZE - 1)], halfmove_clock_, size_ - 1);
+}
+
+int PositionHistory::Occurrences(const Position& next) const {
+  return count(next.Hash(), next.halfmove_clock, size_);
+}
+
+int PositionHistory::count(uint64_t hash, int halfmove_clock, int end) const {
+  int first = std::max({end - halfmove_clock, size_ - SIZE, 0});
+  int occurrences = 0;
+  for (int i = end - 2; i >= first; i -= 2) {
+    if (hashes_[i & (SIZE - 1)] == hash) {
+      occurrences++;
+    }
+  }
+  return occurrences;
+}
+
+}  // namespace habits
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+#include "position.hpp"
+
+namespace habits {
+
+// The hashes of the positions played in a game, for detecting repetitions.
+//
+// A position can only repeat one with the same side to move that was played
+// since the last capture or pawn move, so only the last halfmove clock's worth
+// of positions are kept, in a ring, and checks only scan every other one of
+// them.
+class PositionHistory {
+ public:
+  // Start the history of a new game from the position.
+  void Reset(const Position& p);
+
+  // Add the position reached by the latest move.
+  void Push(const Position& p);
+
+  // The number of times the latest position occurred earlier in the game. The
+  // game is drawn by threefold repetition once this is 2.
+  int Repetitions() const;
+
+  // The number of times a position that could follow the latest position
+  // occurred earlier in the game, for checking moves before they are made.
+  int Occurrences(const Position& next) const;
+
+ private:
+  // Must be a power of 2, and more than the 100 halfmoves of the 50-move rule.
+  static constexpr int SIZE = 128;
+
+  // Count the positions before `end` with the hash, that have the same side to
+  // move and were played since the last irreversible move.
+  int count(uint64_t hash, int halfmove_clock, int end) const;
+
+  uint64_t hashes_[SIZE];
+  // The number of positions pushed, including ones that have been overwritten
+  // in the ring.
+  int size_ = 0;
+  // The halfmove clock of the latest position.
+  int halfmove_clock_ = 0;
+};
+
+}  // namespace habits
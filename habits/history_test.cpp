@@ -0,0 +1,91 @@
+#include "history.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "moves.hpp"
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+// Play the moves from the position, pushing each new position to the history.
+void play(Position* p, PositionHistory* history,
+          const std::vector<std::string>& moves) {
+  for (const std::string& m : moves) {
+    ASSERT_EQ(move(p, m), 0) << m;
+    history->Push(*p);
+  }
+}
+
+TEST(HistoryTest, ThreefoldRepetition) {
+  Position p = Position::FromFen(
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  PositionHistory history;
+  history.Reset(p);
+  EXPECT_EQ(history.Repetitions(), 0);
+
+  play(&p, &history, {"g1f3", "g8f6", "f3g1"});
+  EXPECT_EQ(history.Repetitions(), 0);
+  play(&p, &history, {"f6g8"});
+  EXPECT_EQ(history.Repetitions(), 1);
+  play(&p, &history, {"g1f3", "g8f6", "f3g1"});
+  EXPECT_EQ(history.Repetitions(), 1);
+
+  // The next knight move back would repeat the start position a third time.
+  Position next = p.Duplicate();
+  ASSERT_EQ(move(&next, "f6g8"), 0);
+  EXPECT_EQ(history.Occurrences(next), 2);
+
+  play(&p, &history, {"f6g8"});
+  EXPECT_EQ(history.Repetitions(), 2);
+}
+
+TEST(HistoryTest, SideToMoveMustMatch) {
+  Position p = Position::FromFen("4k3/8/8/8/8/8/8/R3K3 w - - 0 1");
+  PositionHistory history;
+  history.Reset(p);
+
+  // The rook takes three moves to get back, so black is to move.
+  play(&p, &history, {"a1a3", "e8d8", "a3a2", "d8e8", "a2a1"});
+  EXPECT_EQ(p.ToFen(), "4k3/8/8/8/8/8/8/R3K3 b - - 5 3");
+  EXPECT_EQ(history.Repetitions(), 0);
+}
+
+TEST(HistoryTest, IrreversibleMove) {
+  Position p = Position::FromFen("4k3/8/8/8/8/8/4P3/4K1N1 w - - 0 1");
+  PositionHistory history;
+  history.Reset(p);
+
+  play(&p, &history, {"g1f3", "e8d8", "f3g1", "d8e8"});
+  EXPECT_EQ(history.Repetitions(), 1);
+
+  // The pawn move can't be undone, so the halfmove clock is reset and only
+  // the positions from then on are checked.
+  play(&p, &history, {"e2e3", "e8d8", "g1f3", "d8e8"});
+  EXPECT_EQ(p.halfmove_clock, 3);
+  EXPECT_EQ(history.Repetitions(), 0);
+  play(&p, &history, {"f3g1"});
+  EXPECT_EQ(history.Repetitions(), 1);
+}
+
+TEST(HistoryTest, LongerThanRing) {
+  Position p = Position::FromFen("4k3/8/8/8/8/8/8/R3K3 w - - 0 1");
+  PositionHistory history;
+  history.Reset(p);
+
+  // Only the positions still in the ring are counted, every 4th one is the
+  // same as the latest.
+  for (int i = 0; i < 50; i++) {
+    play(&p, &history, {"a1a2", "e8d8", "a2a1", "d8e8"});
+  }
+  EXPECT_EQ(p.halfmove_clock, 200);
+  EXPECT_EQ(history.Repetitions(), 31);
+}
+
+}  // namespace
+}  // namespace habits
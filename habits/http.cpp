@@ -3,20 +3,33 @@
 #include <curl/curl.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "analyze.hpp"
+#include "assets.hpp"
+#include "cache.hpp"
+#include "codec.hpp"
 #include "expresscpp/console.hpp"
 #include "expresscpp/expresscpp.hpp"
-#include "expresscpp/middleware/serve_static_provider.hpp"
+#include "history.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
 #include "moves.hpp"
 #include "position.hpp"
+#include "response.hpp"
 #include "search.hpp"
+#include "sessions.hpp"
+#include "stats.hpp"
 
 namespace habits {
 
@@ -33,116 +46,362 @@ std::string url_decode(std::string encoded) {
   return result;
 }
 
-nlohmann::json buildResponse(const Position& p, const std::string& last_move) {
-  nlohmann::json response;
-  response["fen"] = p.ToFen();
-  response["last_move"] = last_move;
-  response["turn"] = p.active_color == WHITE ? "w" : "b";
-  response["legal"] = LegalMoves(p).ToJson();
-  // Always send the control squares from white's perspective.
-  response["control"] =
-      ControlSquares(p.active_color == WHITE ? p : p.ForOpponent()).ToJson();
-  bool is_check = isActiveColorInCheck(p);
-  response["in_check"] = is_check;
-  response["in_checkmate"] = is_check && response["legal"].empty();
-  response["in_draw"] = (!is_check && response["legal"].empty()) || p.IsDraw();
-  return response;
+// Whether the flag in the query param is on, which it is unless it's set to
+// "0" or "false". Returns `default_value` if the param is missing.
+bool queryFlag(expresscpp::request_t req, const std::string& name,
+               bool default_value) {
+  const auto& query_params = req->GetQueryParams();
+  auto param = query_params.find(name);
+  if (param == query_params.end()) {
+    return default_value;
+  }
+  return param->second != "0" && param->second != "false";
+}
+
+// Read the ResponseFields to compute from the comma separated names in the
+// 'fields' query param, defaulting to all of them. Sends an error response and
+// returns false if a name is unknown.
+bool readFields(expresscpp::request_t req, expresscpp::response_t res,
+                int* fields) {
+  const auto& query_params = req->GetQueryParams();
+  auto fields_param = query_params.find("fields");
+  if (fields_param == query_params.end()) {
+    *fields = ALL_RESPONSE_FIELDS;
+    return true;
+  }
+  if (parseResponseFields(url_decode(fields_param->second), fields) != 0) {
+    res->SetStatus(400);
+    res->Send("Invalid 'fields' query param, must be a comma separated list "
+              "of legal, control, check and status");
+    return false;
+  }
+  return true;
+}
+
+// Read the position from the request, either from a FEN string in the 'fen'
+// query param, or from a base64url PackedPosition in the 'pos' query param. The
+// param is put in `position` for logging. Sends an error response and returns
+// false if there is no valid position.
+bool readPosition(expresscpp::request_t req, expresscpp::response_t res,
+                  Position* p, std::string* position) {
+  const auto& query_params = req->GetQueryParams();
+  auto pos_param = query_params.find("pos");
+  if (pos_param != query_params.end()) {
+    *position = url_decode(pos_param->second);
+    PackedPosition packed;
+    if (PackedPosition::FromBase64(*position, &packed) != 0 ||
+        unpackPosition(packed, p) != 0) {
+      LogMessage(LOG_WARNING) << "Invalid packed position: " << *position;
+      res->SetStatus(400);
+      res->Send("Invalid 'pos' query param");
+      return false;
+    }
+    return true;
+  }
+
+  auto fen_param = query_params.find("fen");
+  if (fen_param == query_params.end()) {
+    res->SetStatus(400);
+    res->Send("Missing 'fen' or 'pos' query param");
+    return false;
+  }
+  *position = url_decode(fen_param->second);
+  FenError fen_error = Position::ParseFen(*position, p);
+  if (fen_error != FEN_OK) {
+    LogMessage(LOG_WARNING) << "Invalid FEN: " << *position;
+    res->SetStatus(400);
+    res->Send(std::string("Invalid 'fen' query param: ") +
+              fenErrorName(fen_error));
+    return false;
+  }
+  return true;
 }
 
 }  // namespace
 
-void HttpServer::newGame(expresscpp::request_t req,
-                         expresscpp::response_t res) {
-  auto fen_param = req->GetQueryParams().find("fen");
-  if (fen_param == req->GetQueryParams().end()) {
+HttpServer::HttpServer()
+    : pool_(std::max(1u, std::thread::hardware_concurrency()),
+            std::max(1u, std::thread::hardware_concurrency()) *
+                QUEUED_REQUESTS_PER_WORKER) {}
+
+void HttpServer::runOnPool(Route route, Handler handler,
+                           expresscpp::request_t req,
+                           expresscpp::response_t res) {
+  // The latency includes the time spent waiting for a worker.
+  const auto start = std::chrono::steady_clock::now();
+  bool queued = pool_.TrySubmit([this, route, handler, req, res, start]() {
+    bool ok = (this->*handler)(req, res);
+    metrics_.RecordRequest(route, ok, std::chrono::steady_clock::now() - start);
+  });
+  if (!queued) {
+    LogMessage(LOG_WARNING) << "Too many requests queued, rejecting: "
+                            << req->GetPath();
+    res->SetStatus(503);
+    res->Send("Server busy, try again later");
+    metrics_.RecordRequest(route, false,
+                           std::chrono::steady_clock::now() - start);
+  }
+}
+
+std::shared_ptr<GameSession> HttpServer::findSession(
+    expresscpp::request_t req, expresscpp::response_t res,
+    std::string* game_id) {
+  const auto& query_params = req->GetQueryParams();
+  auto game_param = query_params.find("game");
+  if (game_param == query_params.end()) {
     res->SetStatus(400);
-    res->Send("Missing 'fen' query param");
-    return;
+    res->Send("Missing 'game' query param");
+    return nullptr;
   }
-  const std::string& fen = url_decode(fen_param->second);
+  *game_id = game_param->second;
+  std::shared_ptr<GameSession> session = sessions_.Find(*game_id);
+  if (session == nullptr) {
+    LogMessage(LOG_WARNING) << "Unknown game: " << *game_id;
+    res->SetStatus(404);
+    res->Send("Unknown game, it may have been idle for too long");
+  }
+  return session;
+}
 
-  expresscpp::Console::Log("Request: new game in position: " + fen);
+bool HttpServer::newGame(expresscpp::request_t req,
+                         expresscpp::response_t res) {
+  Position p;
+  std::string position;
+  if (!readPosition(req, res, &p, &position)) {
+    return false;
+  }
+  int fields;
+  if (!readFields(req, res, &fields)) {
+    return false;
+  }
 
-  Position p = Position::FromFen(fen);
+  LogMessage(LOG_DEBUG) << "Request: new game in position: " << position;
 
-  game_ = Game();
+  std::string game_id;
+  std::shared_ptr<GameSession> session = sessions_.Create(&game_id);
+  std::lock_guard<std::mutex> lock(session->mutex);
+  session->history.Reset(p);
 
-  nlohmann::json response = buildResponse(p, "");
-  std::string response_string = response.dump();
-  expresscpp::Console::Log("Response: " + response_string);
+  std::string response_string =
+      gameResponse(&response_cache_, game_id, p, "", session->history,
+                   fields);
+  LogMessage(LOG_DEBUG) << "Response: " << response_string;
   res->Json(response_string);
+  return true;
 }
 
-void HttpServer::makeMove(expresscpp::request_t req,
+bool HttpServer::makeMove(expresscpp::request_t req,
                           expresscpp::response_t res) {
   auto move_param = req->GetParams().find("move");
   if (move_param == req->GetParams().end()) {
     res->SetStatus(400);
     res->Send("Missing 'move' param");
-    return;
+    return false;
   }
   const std::string& move = url_decode(move_param->second);
-  auto fen_param = req->GetQueryParams().find("fen");
-  if (fen_param == req->GetQueryParams().end()) {
-    res->SetStatus(400);
-    res->Send("Missing 'fen' query param");
-    return;
+
+  Position p;
+  std::string position;
+  if (!readPosition(req, res, &p, &position)) {
+    return false;
+  }
+  int fields;
+  if (!readFields(req, res, &fields)) {
+    return false;
+  }
+
+  std::string game_id;
+  std::shared_ptr<GameSession> session = findSession(req, res, &game_id);
+  if (session == nullptr) {
+    return false;
   }
-  const std::string& fen = url_decode(fen_param->second);
 
-  expresscpp::Console::Log("Request: move " + move + " in position: " + fen);
+  LogMessage(LOG_DEBUG) << "Request: move " << move
+                        << " in position: " << position;
 
-  Position p = Position::FromFen(fen);
   int result = habits::move(&p, move);
 
   if (result != 0) {
-    expresscpp::Console::Error("ERROR: illegal move");
+    LogMessage(LOG_WARNING) << "Illegal move " << move
+                            << " in position: " << position;
     res->SetStatus(400);
     res->Send("Illegal move");
-    return;
+    return false;
   }
 
-  game_.opponentMove(move);
+  std::lock_guard<std::mutex> lock(session->mutex);
+  session->game.opponentMove(move);
+  session->history.Push(p);
 
-  nlohmann::json response = buildResponse(p, move);
-  std::string response_string = response.dump();
-  expresscpp::Console::Log("Response: " + response_string);
+  std::string response_string =
+      gameResponse(&response_cache_, game_id, p, move, session->history,
+                   fields);
+  LogMessage(LOG_DEBUG) << "Response: " << response_string;
   res->Json(response_string);
+  return true;
 }
 
-void HttpServer::search(expresscpp::request_t req, expresscpp::response_t res) {
-  auto fen_param = req->GetQueryParams().find("fen");
-  if (fen_param == req->GetQueryParams().end()) {
-    res->SetStatus(400);
-    res->Send("Missing 'fen' query param");
-    return;
+bool HttpServer::search(expresscpp::request_t req, expresscpp::response_t res) {
+  Position p;
+  std::string position;
+  if (!readPosition(req, res, &p, &position)) {
+    return false;
+  }
+  int fields;
+  if (!readFields(req, res, &fields)) {
+    return false;
   }
-  const std::string& fen = url_decode(fen_param->second);
 
-  expresscpp::Console::Log("Request: find best move in position: " + fen);
+  std::string game_id;
+  std::shared_ptr<GameSession> session = findSession(req, res, &game_id);
+  if (session == nullptr) {
+    return false;
+  }
 
-  Position p = Position::FromFen(fen);
+  LogMessage(LOG_DEBUG) << "Request: find best move in position: "
+                        << position;
 
-  std::string move = game_.bestMove(p);
+  std::lock_guard<std::mutex> lock(session->mutex);
+  Decision decision = session->game.bestMove(p, &session->history);
+  const std::string& move = decision.move;
 
-  expresscpp::Console::Log("Intermediate: found best move: " + move);
+  LogMessage(LOG_DEBUG) << "Found best move: " << decision;
+
+  if (move.empty()) {
+    res->SetStatus(400);
+    res->Send("No legal moves");
+    return false;
+  }
 
   int result = habits::move(&p, move);
 
   if (result != 0) {
-    expresscpp::Console::Error("ERROR: illegal move");
+    LogMessage(LOG_ERROR) << "Best move was illegal move " << move
+                          << " in position: " << position;
     res->SetStatus(400);
     res->Send("Illegal move");
-    return;
+    return false;
   }
 
-  nlohmann::json response = buildResponse(p, move);
-  std::string response_string = response.dump();
-  expresscpp::Console::Log("Response: " + response_string);
+  session->history.Push(p);
+
+  std::string response_string =
+      gameResponse(&response_cache_, game_id, p, move, session->history,
+                   fields);
+  LogMessage(LOG_DEBUG) << "Response: " << response_string;
   res->Json(response_string);
+  return true;
+}
+
+bool HttpServer::batch(expresscpp::request_t req, expresscpp::response_t res) {
+  nlohmann::json fens = nlohmann::json::parse(req->GetBody(), nullptr, false);
+  if (!fens.is_array()) {
+    res->SetStatus(400);
+    res->Send("Body must be a JSON array of FEN strings");
+    return false;
+  }
+  if (fens.size() > MAX_BATCH_POSITIONS) {
+    res->SetStatus(413);
+    res->Send("Too many positions, the most in a batch is " +
+              std::to_string(MAX_BATCH_POSITIONS));
+    return false;
+  }
+  std::vector<std::string> positions;
+  positions.reserve(fens.size());
+  for (const nlohmann::json& fen : fens) {
+    if (!fen.is_string()) {
+      res->SetStatus(400);
+      res->Send("Body must be a JSON array of FEN strings");
+      return false;
+    }
+    positions.push_back(fen.get<std::string>());
+  }
+
+  AnalyzeOptions options;
+  options.legal = queryFlag(req, "legal", true);
+  options.control = queryFlag(req, "control", true);
+  options.best_move = queryFlag(req, "bestmove", true);
+
+  // The chunks run on the shared pool rather than on threads of the batch's
+  // own, so concurrent batches stay within the pool's bound.
+  AnalyzeStats stats;
+  std::string output = analyzePositions(positions, &pool_, &stats, options);
+  LogMessage(LOG_DEBUG) << "Analyzed a batch of " << stats.positions
+                        << " positions in " << stats.seconds << "s";
+  res->SetHeader("Content-Type", "application/x-ndjson");
+  res->Send(output);
+  return true;
+}
+
+void HttpServer::stats(expresscpp::request_t req, expresscpp::response_t res) {
+  res->Send(ruleStatsReport() + "\nResponse " +
+            cacheStatsReport(response_cache_.Stats()));
+}
+
+void HttpServer::metrics(expresscpp::request_t req,
+                         expresscpp::response_t res) {
+  std::string out;
+  metrics_.WritePrometheus(&out);
+  writeMetric("habits_worker_queue_depth", "gauge",
+              "Engine requests waiting for a worker.", pool_.Queued(), &out);
+  writeMetric("habits_worker_rejected_total", "counter",
+              "Engine requests rejected because too many were waiting.",
+              pool_.Rejected(), &out);
+  writeMetric("habits_sessions", "gauge", "Game sessions being played.",
+              sessions_.Size(), &out);
+  CacheStats cache_stats = response_cache_.Stats();
+  writeMetric("habits_response_cache_hits_total", "counter",
+              "Responses found in the cache.", cache_stats.hits, &out);
+  writeMetric("habits_response_cache_misses_total", "counter",
+              "Responses not found in the cache.", cache_stats.misses, &out);
+  writeMetric("habits_response_cache_evictions_total", "counter",
+              "Responses evicted from the cache.", cache_stats.evictions,
+              &out);
+  writeMetric("habits_response_cache_size", "gauge",
+              "Responses in the cache.", cache_stats.size, &out);
+  writeEngineMetrics(&out);
+  res->SetHeader("Content-Type", "text/plain; version=0.0.4");
+  res->Send(out);
+}
+
+bool HttpServer::serveStatic(expresscpp::request_t req,
+                             expresscpp::response_t res) {
+  const StaticAsset* asset = static_assets_.Find(req->GetPath());
+  if (asset == nullptr) {
+    res->SetStatus(404);
+    res->Send("Not found");
+    return false;
+  }
+  const ContentEncoding encoding =
+      chooseEncoding(*asset, req->GetHeader("Accept-Encoding"));
+  // Each encoding has its own strong ETag, as its bytes differ.
+  res->SetHeader("ETag", encodedEtag(*asset, encoding));
+  // Revalidate every time, which is cheap as unchanged files get a 304.
+  res->SetHeader("Cache-Control", "no-cache");
+  res->SetHeader("Vary", "Accept-Encoding");
+  if (etagMatches(req->GetHeader("If-None-Match"), *asset)) {
+    res->SetStatus(304);
+    res->Send("");
+    return true;
+  }
+  if (encoding != ENCODING_IDENTITY) {
+    res->SetHeader("Content-Encoding", contentEncodingName(encoding));
+  }
+  res->SetHeader("Content-Type", asset->content_type);
+  res->Send(encodedBody(*asset, encoding));
+  return true;
 }
 
-void HttpServer::listenHttp(bool debug) {
+void HttpServer::listenHttp(const std::string& static_directory, bool debug) {
+  // Fail before listening, rather than serving 404s for everything.
+  if (static_assets_.Load(static_directory) != 0) {
+    std::cerr << "ERROR: Failed to load the static files from "
+              << static_directory << std::endl;
+    exit(1);
+  }
+  LogMessage(LOG_INFO) << "Loaded " << static_assets_.Size()
+                       << " static files from " << static_directory;
+
   std::shared_ptr<expresscpp::ExpressCpp> expresscpp =
       std::make_shared<expresscpp::ExpressCpp>();
   if (debug) {
@@ -152,16 +411,49 @@ void HttpServer::listenHttp(bool debug) {
   // Rest RPC API endpoints.
   expresscpp->Get("/engine/newgame",
                   [this](expresscpp::request_t req,
-                         expresscpp::response_t res) { newGame(req, res); });
+                         expresscpp::response_t res) {
+                    runOnPool(ROUTE_NEWGAME, &HttpServer::newGame, req, res);
+                  });
   expresscpp->Get("/engine/move/:move",
                   [this](expresscpp::request_t req,
-                         expresscpp::response_t res) { makeMove(req, res); });
+                         expresscpp::response_t res) {
+                    runOnPool(ROUTE_MOVE, &HttpServer::makeMove, req, res);
+                  });
   expresscpp->Get("/engine/search",
                   [this](expresscpp::request_t req,
-                         expresscpp::response_t res) { search(req, res); });
-
-  // Fall back to attempting to serve static files.
-  expresscpp->Use(expresscpp::StaticFileProvider("../static"));
+                         expresscpp::response_t res) {
+                    runOnPool(ROUTE_SEARCH, &HttpServer::search, req, res);
+                  });
+  expresscpp->Post("/engine/batch",
+                   [this](expresscpp::request_t req,
+                          expresscpp::response_t res) {
+                     runOnPool(ROUTE_BATCH, &HttpServer::batch, req, res);
+                   });
+  expresscpp->Get("/engine/stats",
+                  [this](expresscpp::request_t req,
+                         expresscpp::response_t res) { stats(req, res); });
+
+  // Games played over a WebSocket, on their own port as expresscpp can't
+  // upgrade connections.
+  std::thread([this]() {
+    if (channel_server_.Listen(CHANNEL_PORT) != 0) {
+      LogMessage(LOG_ERROR) << "Failed to listen for game channels on port "
+                            << CHANNEL_PORT;
+    }
+  }).detach();
+
+  expresscpp->Get("/metrics",
+                  [this](expresscpp::request_t req,
+                         expresscpp::response_t res) { metrics(req, res); });
+
+  // Fall back to serving the static files from memory.
+  expresscpp->Use([this](expresscpp::request_t req,
+                         expresscpp::response_t res, expresscpp::next_t) {
+    const auto start = std::chrono::steady_clock::now();
+    const bool ok = serveStatic(req, res);
+    metrics_.RecordRequest(ROUTE_STATIC, ok,
+                           std::chrono::steady_clock::now() - start);
+  });
 
   const uint16_t port = 8080u;
 
@@ -1,22 +1,76 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "assets.hpp"
+#include "cache.hpp"
+#include "channel.hpp"
 #include "expresscpp/expresscpp.hpp"
-#include "search.hpp"
+#include "metrics.hpp"
+#include "sessions.hpp"
+#include "worker_pool.hpp"
 
 namespace habits {
 
 class HttpServer {
  public:
-  HttpServer() = default;
+  HttpServer();
 
-  void listenHttp(bool debug = false);
+  // Serve the files in the static directory, which are loaded into memory
+  // first. Exits if the directory can't be loaded.
+  void listenHttp(const std::string& static_directory, bool debug = false);
 
  private:
-  void newGame(expresscpp::request_t req, expresscpp::response_t res);
-  void makeMove(expresscpp::request_t req, expresscpp::response_t res);
-  void search(expresscpp::request_t req, expresscpp::response_t res);
+  // The handlers of the engine endpoints return false if they responded with
+  // an error.
+  using Handler = bool (HttpServer::*)(expresscpp::request_t req,
+                                       expresscpp::response_t res);
+
+  // Run a handler that does engine work on the worker pool, so it doesn't hold
+  // up the server's I/O thread. Responds with 503 straight away if too many
+  // requests are already waiting for a worker. The request is recorded in the
+  // metrics of the route.
+  void runOnPool(Route route, Handler handler, expresscpp::request_t req,
+                 expresscpp::response_t res);
+
+  bool newGame(expresscpp::request_t req, expresscpp::response_t res);
+  bool makeMove(expresscpp::request_t req, expresscpp::response_t res);
+  bool search(expresscpp::request_t req, expresscpp::response_t res);
+  bool batch(expresscpp::request_t req, expresscpp::response_t res);
+  void stats(expresscpp::request_t req, expresscpp::response_t res);
+  void metrics(expresscpp::request_t req, expresscpp::response_t res);
+  // Serve a static file, or 304 if the client's copy is current. Returns false
+  // if there is no such file.
+  bool serveStatic(expresscpp::request_t req, expresscpp::response_t res);
+
+  // Find the session of the game in the 'game' query param, and put the id in
+  // `game_id`. Sends an error response and returns nullptr if there is no such
+  // session.
+  std::shared_ptr<GameSession> findSession(expresscpp::request_t req,
+                                           expresscpp::response_t res,
+                                           std::string* game_id);
+
+  // The port the game channel accepts WebSocket connections on.
+  static constexpr uint16_t CHANNEL_PORT = 8081;
+  // The number of responses to positions to keep cached.
+  static constexpr size_t RESPONSE_CACHE_SIZE = 4096;
+  // The most positions analyzed by one /engine/batch request.
+  static constexpr size_t MAX_BATCH_POSITIONS = 10000;
+  // The number of engine requests that may wait for a worker, per worker.
+  static constexpr size_t QUEUED_REQUESTS_PER_WORKER = 16;
 
-  Game game_;
+  // The games being played, started by /engine/newgame.
+  GameSessions sessions_;
+  ResponseCache response_cache_{RESPONSE_CACHE_SIZE};
+  // Only keeps a pointer to the pool, which is used once listening starts.
+  GameChannelServer channel_server_{&sessions_, &response_cache_, &pool_};
+  ServerMetrics metrics_;
+  StaticAssets static_assets_;
+  // Declared last, so the workers finish before the state they use is
+  // destroyed.
+  WorkerPool pool_;
 };
 
 }  // namespace habits
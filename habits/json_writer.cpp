@@ -0,0 +1,119 @@
+#include "json_writer.hpp"
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace habits {
+
+void JsonWriter::BeginObject() {
+  separate();
+  *out_ += '{';
+  empty_[depth_++] = true;
+}
+
+void JsonWriter::EndObject() {
+  depth_--;
+  *out_ += '}';
+}
+
+void JsonWriter::BeginArray() {
+  separate();
+  *out_ += '[';
+  empty_[depth_++] = true;
+}
+
+void JsonWriter::EndArray() {
+  depth_--;
+  *out_ += ']';
+}
+
+void JsonWriter::Key(std::string_view key) {
+  separate();
+  escaped(key);
+  *out_ += ':';
+  after_key_ = true;
+}
+
+void JsonWriter::String(std::string_view value) {
+  separate();
+  escaped(value);
+}
+
+void JsonWriter::Int(int64_t value) {
+  separate();
+  char buffer[24];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  out_->append(buffer, result.ptr - buffer);
+}
+
+void JsonWriter::Bool(bool value) {
+  separate();
+  *out_ += value ? "true" : "false";
+}
+
+void JsonWriter::Null() {
+  separate();
+  *out_ += "null";
+}
+
+void JsonWriter::separate() {
+  if (after_key_) {
+    after_key_ = false;
+    return;
+  }
+  if (depth_ > 0) {
+    if (empty_[depth_ - 1]) {
+      empty_[depth_ - 1] = false;
+    } else {
+      *out_ += ',';
+    }
+  }
+}
+
+void JsonWriter::escaped(std::string_view value) {
+  *out_ += '"';
+  // Copy runs of characters that don't need escaping in one go.
+  size_t run_start = 0;
+  for (size_t i = 0; i < value.size(); i++) {
+    const unsigned char c = value[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    out_->append(value.data() + run_start, i - run_start);
+    run_start = i + 1;
+    switch (c) {
+      case '"':
+        *out_ += "\\\"";
+        break;
+      case '\\':
+        *out_ += "\\\\";
+        break;
+      case '\b':
+        *out_ += "\\b";
+        break;
+      case '\f':
+        *out_ += "\\f";
+        break;
+      case '\n':
+        *out_ += "\\n";
+        break;
+      case '\r':
+        *out_ += "\\r";
+        break;
+      case '\t':
+        *out_ += "\\t";
+        break;
+      default: {
+        static constexpr char HEX[] = "0123456789abcdef";
+        const char unicode[] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xf]};
+        out_->append(unicode, sizeof(unicode));
+      }
+    }
+  }
+  out_->append(value.data() + run_start, value.size() - run_start);
+  *out_ += '"';
+}
+
+}  // namespace habits
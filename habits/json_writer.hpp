@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace habits {
+
+// Writes JSON straight into a string, without building a document first. The
+// output is the same as nlohmann::json's dump() (with no indentation), as long
+// as object keys are written in sorted order, which is how nlohmann::json keeps
+// them.
+class JsonWriter {
+ public:
+  // Append the JSON to `out`.
+  explicit JsonWriter(std::string* out) : out_(out) {}
+
+  void BeginObject();
+  void EndObject();
+  void BeginArray();
+  void EndArray();
+
+  // Write an object member's key, to be followed by its value.
+  void Key(std::string_view key);
+
+  void String(std::string_view value);
+  void Int(int64_t value);
+  void Bool(bool value);
+  void Null();
+
+ private:
+  static constexpr int MAX_DEPTH = 16;
+
+  // Write the separator needed before the next value.
+  void separate();
+  void escaped(std::string_view value);
+
+  std::string* out_;
+  // The depth of the open objects and arrays, and whether each one is still
+  // empty.
+  int depth_ = 0;
+  bool empty_[MAX_DEPTH] = {};
+  // Whether a key was just written, so no separator is needed for its value.
+  bool after_key_ = false;
+};
+
+}  // namespace habits
@@ -0,0 +1,66 @@
+#include "json_writer.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <nlohmann/json.hpp>
+#include <string>
+
+namespace habits {
+
+namespace {
+
+TEST(JsonWriterTest, WritesNestedValues) {
+  std::string out;
+  JsonWriter writer(&out);
+  writer.BeginObject();
+  writer.Key("a");
+  writer.BeginArray();
+  writer.Int(1);
+  writer.Int(-20);
+  writer.BeginObject();
+  writer.EndObject();
+  writer.BeginArray();
+  writer.EndArray();
+  writer.EndArray();
+  writer.Key("b");
+  writer.Bool(true);
+  writer.Key("c");
+  writer.Bool(false);
+  writer.Key("d");
+  writer.Null();
+  writer.Key("e");
+  writer.String("x");
+  writer.EndObject();
+
+  nlohmann::json expected = {{"a", {1, -20, nlohmann::json::object(),
+                                    nlohmann::json::array()}},
+                             {"b", true},
+                             {"c", false},
+                             {"d", nullptr},
+                             {"e", "x"}};
+  EXPECT_EQ(out, expected.dump());
+}
+
+TEST(JsonWriterTest, EscapesStringsLikeNlohmann) {
+  std::string value = "quote\" backslash\\ /\b\f\n\r\t\x01\x1f\x7f caf\xc3\xa9";
+  std::string out;
+  JsonWriter writer(&out);
+  writer.BeginObject();
+  writer.Key(value);
+  writer.String(value);
+  writer.EndObject();
+
+  nlohmann::json expected = {{value, value}};
+  EXPECT_EQ(out, expected.dump());
+}
+
+TEST(JsonWriterTest, AppendsToOutput) {
+  std::string out = "prefix ";
+  JsonWriter writer(&out);
+  writer.Int(42);
+  EXPECT_EQ(out, "prefix 42");
+}
+
+}  // namespace
+}  // namespace habits
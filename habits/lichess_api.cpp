@@ -0,0 +1,372 @@
+#include "lichess_api.hpp"
+
+#include <curl/curl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "log.hpp"
+
+namespace habits {
+
+namespace {
+
+// The most socket events handled per wait.
+constexpr int MAX_EVENTS = 64;
+
+double milliseconds(CURL* curl, CURLINFO info) {
+  curl_off_t microseconds = 0;
+  curl_easy_getinfo(curl, info, &microseconds);
+  return microseconds / 1000.0;
+}
+
+}  // namespace
+
+LichessApi::LichessApi(std::string token, std::string base_url)
+    : token_(std::move(token)), base_url_(std::move(base_url)) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  multi_ = curl_multi_init();
+  curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, socketCallback);
+  curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, timerCallback);
+  curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+  curl_multi_setopt(multi_, CURLMOPT_PIPELINING,
+                    static_cast<long>(CURLPIPE_MULTIPLEX));
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd_ >= 0 && wake_fd_ >= 0) {
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+  }
+}
+
+LichessApi::~LichessApi() {
+  for (auto& [curl, transfer] : running_) {
+    curl_multi_remove_handle(multi_, curl);
+    curl_easy_cleanup(curl);
+  }
+  for (CURL* curl : idle_handles_) {
+    curl_easy_cleanup(curl);
+  }
+  curl_multi_cleanup(multi_);
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+  }
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+  curl_global_cleanup();
+}
+
+void LichessApi::Post(const std::string& path, const std::string& body,
+                      PostCallback done) {
+  auto transfer = std::make_unique<Transfer>();
+  transfer->path = path;
+  transfer->url = base_url_ + path;
+  transfer->is_post = true;
+  transfer->body = body;
+  transfer->on_post_done = std::move(done);
+  queue(std::move(transfer));
+}
+
+void LichessApi::Stream(const std::string& path, LineCallback on_line,
+                        StreamDoneCallback done) {
+  auto transfer = std::make_unique<Transfer>();
+  transfer->path = path;
+  transfer->url = base_url_ + path;
+  transfer->on_line = std::move(on_line);
+  transfer->on_stream_done = std::move(done);
+  queue(std::move(transfer));
+}
+
+void LichessApi::BeginWork() {
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  outstanding_work_++;
+}
+
+void LichessApi::EndWork() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    outstanding_work_--;
+  }
+  // The loop may be waiting only for this work to end.
+  wake();
+}
+
+void LichessApi::wake() {
+  const uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) < 0) {
+    LogMessage(LOG_ERROR) << "Failed to wake the Lichess event loop";
+  }
+}
+
+void LichessApi::queue(std::unique_ptr<Transfer> transfer) {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    queued_.push_back(std::move(transfer));
+  }
+  wake();
+}
+
+int LichessApi::Run() {
+  if (epoll_fd_ < 0 || wake_fd_ < 0) {
+    LogMessage(LOG_ERROR) << "Failed to set up the Lichess event loop";
+    return 1;
+  }
+  epoll_event events[MAX_EVENTS];
+  while (true) {
+    startQueued();
+    if (running_.empty()) {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      if (queued_.empty() && outstanding_work_ == 0) {
+        return 0;
+      }
+      if (!queued_.empty()) {
+        continue;
+      }
+      // Otherwise wait to be woken by more requests or the work ending.
+    }
+
+    int timeout_ms = -1;
+    if (timer_deadline_) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          *timer_deadline_ - std::chrono::steady_clock::now());
+      timeout_ms = std::max<int>(0, remaining.count());
+    }
+    int count = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout_ms);
+    if (count < 0 && errno != EINTR) {
+      LogMessage(LOG_ERROR) << "Failed waiting for Lichess events: " << errno;
+      return 1;
+    }
+
+    int running = 0;
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.fd == wake_fd_) {
+        uint64_t value;
+        while (read(wake_fd_, &value, sizeof(value)) > 0) {
+        }
+        continue;
+      }
+      int action = 0;
+      if (events[i].events & (EPOLLIN | EPOLLHUP)) {
+        action |= CURL_CSELECT_IN;
+      }
+      if (events[i].events & EPOLLOUT) {
+        action |= CURL_CSELECT_OUT;
+      }
+      if (events[i].events & EPOLLERR) {
+        action |= CURL_CSELECT_ERR;
+      }
+      curl_multi_socket_action(multi_, events[i].data.fd, action, &running);
+    }
+    if (timer_deadline_ &&
+        std::chrono::steady_clock::now() >= *timer_deadline_) {
+      // CURL sets a new timer from the action if it needs one.
+      timer_deadline_.reset();
+      curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &running);
+    }
+    finishDone();
+  }
+}
+
+void LichessApi::startQueued() {
+  std::vector<std::unique_ptr<Transfer>> queued;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    queued.swap(queued_);
+  }
+  for (std::unique_ptr<Transfer>& transfer : queued) {
+    CURL* curl = acquireHandle();
+    if (curl == nullptr) {
+      LogMessage(LOG_ERROR) << "Failed to initialize CURL for "
+                            << transfer->path;
+      if (transfer->on_post_done) {
+        transfer->on_post_done(false, RequestTiming());
+      }
+      if (transfer->on_stream_done) {
+        transfer->on_stream_done(false);
+      }
+      continue;
+    }
+    transfer->errbuf[0] = 0;
+    curl_easy_setopt(curl, CURLOPT_URL, transfer->url.c_str());
+    if (transfer->is_post) {
+      curl_easy_setopt(curl, CURLOPT_POST, 1L);
+      curl_easy_setopt(curl, CURLOPT_POSTFIELDS, transfer->body.c_str());
+      curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+                       static_cast<long>(transfer->body.size()));
+    } else {
+      curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    }
+    transfer->curl = curl;
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer.get());
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, transfer->errbuf);
+    running_[curl] = std::move(transfer);
+    curl_multi_add_handle(multi_, curl);
+  }
+}
+
+void LichessApi::finishDone() {
+  CURLMsg* message;
+  int remaining;
+  while ((message = curl_multi_info_read(multi_, &remaining)) != nullptr) {
+    if (message->msg == CURLMSG_DONE) {
+      finish(message->easy_handle, message->data.result);
+    }
+  }
+}
+
+void LichessApi::finish(CURL* curl, CURLcode result) {
+  curl_multi_remove_handle(multi_, curl);
+  auto it = running_.find(curl);
+  std::unique_ptr<Transfer> transfer = std::move(it->second);
+  running_.erase(it);
+
+  long status = 0;
+  long connects = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+  RequestTiming timing;
+  timing.total_ms = milliseconds(curl, CURLINFO_TOTAL_TIME_T);
+  timing.connect_ms = milliseconds(curl, CURLINFO_CONNECT_TIME_T);
+  timing.tls_ms = milliseconds(curl, CURLINFO_APPCONNECT_TIME_T);
+  timing.first_byte_ms = milliseconds(curl, CURLINFO_STARTTRANSFER_TIME_T);
+  timing.new_connection = connects > 0;
+  // Don't keep pointers to the finished transfer on the idle handle.
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, nullptr);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, nullptr);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, nullptr);
+  idle_handles_.push_back(curl);
+
+  bool ok = result == CURLE_OK && status < 400;
+  if (result != CURLE_OK) {
+    LogMessage(LOG_ERROR) << "Failed " << transfer->path << " "
+                          << curl_easy_strerror(result) << ": "
+                          << transfer->errbuf;
+  } else if (status >= 400) {
+    LogMessage(LOG_WARNING) << transfer->path << " returned " << status
+                            << ": " << transfer->response;
+  }
+
+  if (transfer->is_post) {
+    LogMessage(LOG_DEBUG) << "POST " << transfer->path << ": " << status
+                          << " in " << timing.total_ms << "ms ("
+                          << (timing.new_connection ? "new connection"
+                                                    : "reused connection")
+                          << ", connect " << timing.connect_ms << "ms, TLS "
+                          << timing.tls_ms << "ms, first byte "
+                          << timing.first_byte_ms
+                          << "ms): " << transfer->response;
+    if (transfer->on_post_done) {
+      transfer->on_post_done(ok, timing);
+    }
+    return;
+  }
+  // Pass on a last line that didn't end with a newline.
+  if (!transfer->response.empty() && status < 400) {
+    transfer->on_line(transfer->response);
+  }
+  if (transfer->on_stream_done) {
+    transfer->on_stream_done(ok);
+  }
+}
+
+CURL* LichessApi::acquireHandle() {
+  if (!idle_handles_.empty()) {
+    CURL* curl = idle_handles_.back();
+    idle_handles_.pop_back();
+    return curl;
+  }
+  CURL* curl = curl_easy_init();
+  if (curl == nullptr) {
+    return nullptr;
+  }
+  curl_easy_setopt(curl, CURLOPT_HTTPAUTH, static_cast<long>(CURLAUTH_BEARER));
+  curl_easy_setopt(curl, CURLOPT_XOAUTH2_BEARER, token_.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, receiveData);
+  // Use HTTP/2 over TLS when the server supports it, and wait for a
+  // connection that can be multiplexed rather than opening another one.
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+                   static_cast<long>(CURL_HTTP_VERSION_2TLS));
+  curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+  curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  return curl;
+}
+
+size_t LichessApi::receiveData(char* data, size_t size, size_t nmemb,
+                               void* transfer_data) {
+  Transfer* transfer = static_cast<Transfer*>(transfer_data);
+  const size_t length = size * nmemb;
+  transfer->response.append(data, length);
+  if (transfer->is_post) {
+    return length;
+  }
+  // An error response is only logged when the stream ends, never passed on as
+  // lines to be handled like the events of a stream.
+  long status = 0;
+  curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &status);
+  if (status >= 400) {
+    return length;
+  }
+  // Pass on the complete lines, keeping the start of the next one.
+  size_t start = 0;
+  size_t newline;
+  while ((newline = transfer->response.find('\n', start)) !=
+         std::string::npos) {
+    transfer->on_line(
+        std::string_view(transfer->response).substr(start, newline - start));
+    start = newline + 1;
+  }
+  transfer->response.erase(0, start);
+  return length;
+}
+
+int LichessApi::socketCallback(CURL*, curl_socket_t socket, int what,
+                               void* api_data, void*) {
+  LichessApi* api = static_cast<LichessApi*>(api_data);
+  if (what == CURL_POLL_REMOVE) {
+    epoll_ctl(api->epoll_fd_, EPOLL_CTL_DEL, socket, nullptr);
+    return 0;
+  }
+  epoll_event event = {};
+  if (what == CURL_POLL_IN || what == CURL_POLL_INOUT) {
+    event.events |= EPOLLIN;
+  }
+  if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) {
+    event.events |= EPOLLOUT;
+  }
+  event.data.fd = socket;
+  if (epoll_ctl(api->epoll_fd_, EPOLL_CTL_MOD, socket, &event) != 0 &&
+      errno == ENOENT) {
+    epoll_ctl(api->epoll_fd_, EPOLL_CTL_ADD, socket, &event);
+  }
+  return 0;
+}
+
+int LichessApi::timerCallback(CURLM*, long timeout_ms, void* api_data) {
+  LichessApi* api = static_cast<LichessApi*>(api_data);
+  if (timeout_ms < 0) {
+    api->timer_deadline_.reset();
+  } else {
+    api->timer_deadline_ = std::chrono::steady_clock::now() +
+                           std::chrono::milliseconds(timeout_ms);
+  }
+  return 0;
+}
+
+}  // namespace habits
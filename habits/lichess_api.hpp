@@ -0,0 +1,136 @@
+#pragma once
+
+#include <curl/curl.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace habits {
+
+// How long a request to the Lichess API took, from CURL's timings.
+struct RequestTiming {
+  // The total time of the request.
+  double total_ms = 0.0;
+  // The time to connect and do the TLS handshake, which are 0 when an open
+  // connection was reused.
+  double connect_ms = 0.0;
+  double tls_ms = 0.0;
+  // The time until the first byte of the response arrived.
+  double first_byte_ms = 0.0;
+  // Whether a new connection had to be opened for the request.
+  bool new_connection = false;
+};
+
+// Sends requests to the Lichess API from a single event loop, which drives
+// every stream and request at once with curl_multi and epoll, so any number of
+// games can be played without a thread for each. Connections are reused between
+// requests, and HTTP/2 is used to multiplex them over one connection when the
+// server supports it.
+//
+// Requests can be started from any thread. Their callbacks run on the thread
+// running the loop, so they must not block.
+class LichessApi {
+ public:
+  // Called with each line of a streamed response, without the newline. Lichess
+  // sends empty lines to keep streams alive.
+  using LineCallback = std::function<void(std::string_view line)>;
+  // Called when a stream ends, with whether it ended without an error.
+  using StreamDoneCallback = std::function<void(bool ok)>;
+  // Called when a POST finishes, with whether it succeeded without an HTTP
+  // error.
+  using PostCallback =
+      std::function<void(bool ok, const RequestTiming& timing)>;
+
+  explicit LichessApi(std::string token,
+                      std::string base_url = "https://lichess.org");
+  ~LichessApi();
+
+  LichessApi(const LichessApi&) = delete;
+  LichessApi& operator=(const LichessApi&) = delete;
+
+  // POST to the path (such as "/api/bot/game/<id>/move/e2e4") with the form
+  // body, which may be empty. `done` may be empty.
+  void Post(const std::string& path, const std::string& body,
+            PostCallback done = nullptr);
+
+  // GET the path and pass each line of the body to `on_line` as it arrives.
+  void Stream(const std::string& path, LineCallback on_line,
+              StreamDoneCallback done = nullptr);
+
+  // Keep Run() going until the matching EndWork(), for work on another thread
+  // that may still start requests, such as finding a move to send.
+  void BeginWork();
+  void EndWork();
+
+  // Run the event loop until there are no streams or requests left, including
+  // any started by callbacks, and no work begun on other threads. Returns 1 if
+  // the loop couldn't be set up.
+  int Run();
+
+ private:
+  // A stream or request, from being queued until it's done.
+  struct Transfer {
+    std::string path;
+    std::string url;
+    // The handle running the transfer, once it has started.
+    CURL* curl = nullptr;
+    bool is_post = false;
+    std::string body;
+    // The response to a POST, or the part of the last line of a stream
+    // received so far.
+    std::string response;
+    LineCallback on_line;
+    StreamDoneCallback on_stream_done;
+    PostCallback on_post_done;
+    char errbuf[CURL_ERROR_SIZE];
+  };
+
+  // Wake the loop from another thread.
+  void wake();
+  // Queue the transfer and wake the loop to start it.
+  void queue(std::unique_ptr<Transfer> transfer);
+  // Start the queued transfers on the loop.
+  void startQueued();
+  // Finish the transfers that are done, calling their callbacks.
+  void finishDone();
+  void finish(CURL* curl, CURLcode result);
+  // Take an idle handle, or make a new one.
+  CURL* acquireHandle();
+
+  static size_t receiveData(char* data, size_t size, size_t nmemb,
+                            void* transfer);
+  static int socketCallback(CURL* curl, curl_socket_t socket, int what,
+                            void* api, void* socket_data);
+  static int timerCallback(CURLM* multi, long timeout_ms, void* api);
+
+  std::string token_;
+  std::string base_url_;
+
+  CURLM* multi_;
+  int epoll_fd_ = -1;
+  // Written to wake the loop when a transfer is queued from another thread.
+  int wake_fd_ = -1;
+  // When CURL next needs to be told that its timeout expired.
+  std::optional<std::chrono::steady_clock::time_point> timer_deadline_;
+
+  // The transfers running on the loop, by their handles. Only used by the
+  // loop's thread.
+  std::map<CURL*, std::unique_ptr<Transfer>> running_;
+  // Handles of finished transfers, kept to avoid setting up new ones.
+  std::vector<CURL*> idle_handles_;
+
+  std::mutex queue_mutex_;
+  // Transfers started but not yet added to the loop.
+  std::vector<std::unique_ptr<Transfer>> queued_;
+  // The work begun on other threads that hasn't ended yet.
+  int outstanding_work_ = 0;
+};
+
+}  // namespace habits
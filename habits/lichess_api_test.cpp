@@ -0,0 +1,307 @@
+#include "lichess_api.hpp"
+
+#include <arpa/inet.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace habits {
+
+namespace {
+
+// A minimal HTTP/1.1 server on localhost, which keeps connections open and
+// records the requests it receives.
+class TestServer {
+ public:
+  TestServer() {
+    listen_socket_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    bind(listen_socket_, reinterpret_cast<sockaddr*>(&address),
+         sizeof(address));
+    socklen_t length = sizeof(address);
+    getsockname(listen_socket_, reinterpret_cast<sockaddr*>(&address),
+                &length);
+    port_ = ntohs(address.sin_port);
+    listen(listen_socket_, 16);
+    accept_thread_ = std::thread([this]() { acceptConnections(); });
+  }
+
+  ~TestServer() {
+    shutdown(listen_socket_, SHUT_RDWR);
+    close(listen_socket_);
+    accept_thread_.join();
+    std::vector<std::thread> threads;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (int socket : sockets_) {
+        shutdown(socket, SHUT_RDWR);
+      }
+      threads = std::move(connection_threads_);
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+  std::string Url() const {
+    return "http://127.0.0.1:" + std::to_string(port_);
+  }
+
+  int Connections() const { return connections_; }
+
+  std::vector<std::string> Requests() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return requests_;
+  }
+
+ private:
+  void acceptConnections() {
+    while (true) {
+      int socket = accept(listen_socket_, nullptr, nullptr);
+      if (socket < 0) {
+        return;
+      }
+      connections_++;
+      std::lock_guard<std::mutex> lock(mutex_);
+      sockets_.push_back(socket);
+      connection_threads_.emplace_back([this, socket]() { serve(socket); });
+    }
+  }
+
+  // Answer requests on the connection until the client closes it.
+  void serve(int socket) {
+    std::string buffer;
+    char data[4096];
+    while (true) {
+      size_t header_end;
+      while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t received = recv(socket, data, sizeof(data), 0);
+        if (received <= 0) {
+          close(socket);
+          return;
+        }
+        buffer.append(data, received);
+      }
+      std::string headers = buffer.substr(0, header_end);
+      size_t content_length = 0;
+      size_t length_header = headers.find("Content-Length: ");
+      if (length_header != std::string::npos) {
+        content_length = std::stoul(headers.substr(length_header + 16));
+      }
+      while (buffer.size() < header_end + 4 + content_length) {
+        ssize_t received = recv(socket, data, sizeof(data), 0);
+        if (received <= 0) {
+          close(socket);
+          return;
+        }
+        buffer.append(data, received);
+      }
+      std::string body = buffer.substr(header_end + 4, content_length);
+      buffer.erase(0, header_end + 4 + content_length);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests_.push_back(headers + "\n\n" + body);
+      }
+
+      // The stream is sent in two parts, splitting a line, with a pause
+      // between them.
+      std::vector<std::string> parts;
+      if (headers.find(" /stream ") != std::string::npos) {
+        parts = {"HTTP/1.1 200 OK\r\nContent-Length: 13\r\n\r\nline1\n\nli",
+                 "ne2\n"};
+      } else if (headers.find(" /bad ") != std::string::npos) {
+        parts = {
+            "HTTP/1.1 400 Bad Request\r\nContent-Length: 4\r\n\r\nbad\n"};
+      } else {
+        parts = {"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"};
+      }
+      for (size_t i = 0; i < parts.size(); i++) {
+        if (i > 0) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        send(socket, parts[i].data(), parts[i].size(), MSG_NOSIGNAL);
+      }
+    }
+  }
+
+  int listen_socket_;
+  uint16_t port_;
+  std::atomic<int> connections_{0};
+  std::thread accept_thread_;
+  std::mutex mutex_;
+  std::vector<int> sockets_;
+  std::vector<std::thread> connection_threads_;
+  std::vector<std::string> requests_;
+};
+
+TEST(LichessApiTest, PostReusesConnection) {
+  TestServer server;
+  LichessApi api("secret", server.Url());
+  std::vector<RequestTiming> timings;
+  // Each request is sent when the one before it finishes.
+  api.Post("/api/challenge/abc/accept", "",
+           [&](bool ok, const RequestTiming& timing) {
+             EXPECT_TRUE(ok);
+             timings.push_back(timing);
+             api.Post("/api/challenge/abc/decline", "reason=later",
+                      [&](bool ok, const RequestTiming& timing) {
+                        EXPECT_TRUE(ok);
+                        timings.push_back(timing);
+                        api.Post("/api/bot/game/abc/move/e2e4", "",
+                                 [&](bool ok, const RequestTiming& timing) {
+                                   EXPECT_TRUE(ok);
+                                   timings.push_back(timing);
+                                 });
+                      });
+           });
+  ASSERT_EQ(api.Run(), 0);
+
+  ASSERT_EQ(timings.size(), 3);
+  EXPECT_TRUE(timings[0].new_connection);
+  EXPECT_FALSE(timings[1].new_connection);
+  EXPECT_GT(timings[1].total_ms, 0.0);
+  EXPECT_FALSE(timings[2].new_connection);
+  EXPECT_EQ(server.Connections(), 1);
+
+  std::vector<std::string> requests = server.Requests();
+  ASSERT_EQ(requests.size(), 3);
+  EXPECT_THAT(requests[0],
+              testing::StartsWith("POST /api/challenge/abc/accept HTTP/1.1"));
+  EXPECT_THAT(requests[0], testing::HasSubstr("Authorization: Bearer secret"));
+  EXPECT_THAT(requests[1], testing::EndsWith("\n\nreason=later"));
+}
+
+TEST(LichessApiTest, PostFailsOnHttpError) {
+  TestServer server;
+  LichessApi api("secret", server.Url());
+  std::vector<std::pair<std::string, bool>> results;
+  api.Post("/bad", "", [&](bool ok, const RequestTiming&) {
+    results.emplace_back("/bad", ok);
+  });
+  api.Post("/good", "", [&](bool ok, const RequestTiming&) {
+    results.emplace_back("/good", ok);
+  });
+  ASSERT_EQ(api.Run(), 0);
+  EXPECT_THAT(results, testing::UnorderedElementsAre(
+                           std::make_pair(std::string("/bad"), false),
+                           std::make_pair(std::string("/good"), true)));
+}
+
+TEST(LichessApiTest, PostFailsWithoutServer) {
+  // Nothing listens on port 1.
+  LichessApi api("secret", "http://127.0.0.1:1");
+  int failed = 0;
+  api.Post("/api/challenge/abc/accept", "",
+           [&](bool ok, const RequestTiming&) { failed += !ok; });
+  ASSERT_EQ(api.Run(), 0);
+  EXPECT_EQ(failed, 1);
+}
+
+TEST(LichessApiTest, StreamSplitsLines) {
+  TestServer server;
+  LichessApi api("secret", server.Url());
+  std::vector<std::string> lines;
+  int done = 0;
+  api.Stream(
+      "/stream", [&](std::string_view line) { lines.emplace_back(line); },
+      [&](bool ok) {
+        EXPECT_TRUE(ok);
+        done++;
+      });
+  ASSERT_EQ(api.Run(), 0);
+  EXPECT_THAT(lines, testing::ElementsAre("line1", "", "line2"));
+  EXPECT_EQ(done, 1);
+}
+
+TEST(LichessApiTest, StreamDoesNotPassOnErrors) {
+  TestServer server;
+  LichessApi api("secret", server.Url());
+  std::vector<std::string> lines;
+  std::vector<bool> done;
+  api.Stream(
+      "/bad", [&](std::string_view line) { lines.emplace_back(line); },
+      [&](bool ok) { done.push_back(ok); });
+  ASSERT_EQ(api.Run(), 0);
+  EXPECT_THAT(lines, testing::IsEmpty());
+  EXPECT_THAT(done, testing::ElementsAre(false));
+}
+
+TEST(LichessApiTest, PostWhileStreaming) {
+  TestServer server;
+  LichessApi api("secret", server.Url());
+  std::vector<std::string> events;
+  api.Stream(
+      "/stream",
+      [&](std::string_view line) {
+        events.emplace_back(line);
+        if (line == "line1") {
+          api.Post("/api/bot/game/abc/move/e2e4", "",
+                   [&](bool ok, const RequestTiming&) {
+                     EXPECT_TRUE(ok);
+                     events.push_back("posted");
+                   });
+        }
+      },
+      [&](bool) { events.push_back("done"); });
+  ASSERT_EQ(api.Run(), 0);
+  // The move is sent while the stream waits for the rest of its body.
+  EXPECT_THAT(events,
+              testing::ElementsAre("line1", "", "posted", "line2", "done"));
+}
+
+TEST(LichessApiTest, PostsFromOtherThreads) {
+  TestServer server;
+  LichessApi api("secret", server.Url());
+  int succeeded = 0;
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < 4; thread++) {
+    threads.emplace_back([&api, &succeeded]() {
+      for (int i = 0; i < 10; i++) {
+        // The callbacks all run on the loop's thread.
+        api.Post("/api/bot/game/abc/move/e2e4", "",
+                 [&succeeded](bool ok, const RequestTiming&) {
+                   succeeded += ok;
+                 });
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(api.Run(), 0);
+  EXPECT_EQ(succeeded, 40);
+  EXPECT_EQ(server.Requests().size(), 40);
+}
+
+TEST(LichessApiTest, RunWaitsForWork) {
+  TestServer server;
+  LichessApi api("secret", server.Url());
+  bool posted = false;
+  // Like finding a move on another thread, then sending it.
+  api.BeginWork();
+  std::thread worker([&api, &posted]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    api.Post("/api/bot/game/abc/move/e2e4", "",
+             [&posted](bool ok, const RequestTiming&) { posted = ok; });
+    api.EndWork();
+  });
+  ASSERT_EQ(api.Run(), 0);
+  worker.join();
+  EXPECT_TRUE(posted);
+}
+
+}  // namespace
+}  // namespace habits
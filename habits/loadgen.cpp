@@ -0,0 +1,343 @@
+// Replays a corpus of games against the engine endpoints of a running HTTP
+// server, and reports the throughput and latency. Run from the build directory
+// with:
+//   ./habits/habits_loadgen --concurrency 4
+//
+// Each line of the corpus is a FEN, a ';', and a sequence of moves in UCI
+// form. A game starts with /engine/newgame in the position, then each move is
+// sent to /engine/move, followed by /engine/search in the position after it.
+// The engine's move is only timed, not played: the next request is always for
+// the next move in the sequence. So the requests sent don't depend on the
+// engine's choices, and runs over the same corpus can be compared across
+// commits.
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "moves.hpp"
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+enum LoadRoute {
+  LOAD_NEWGAME,
+  LOAD_MOVE,
+  LOAD_SEARCH,
+  NUM_LOAD_ROUTES,
+};
+
+const char* loadRouteName(LoadRoute route) {
+  switch (route) {
+    case LOAD_NEWGAME:
+      return "newgame";
+    case LOAD_MOVE:
+      return "move";
+    case LOAD_SEARCH:
+      return "search";
+    case NUM_LOAD_ROUTES:
+      break;
+  }
+  return "unknown";
+}
+
+// A starting position, and the moves played from it.
+struct CorpusGame {
+  std::string fen;
+  std::vector<std::string> moves;
+};
+
+// The latencies of a route's requests, in microseconds.
+struct RouteLatencies {
+  std::vector<double> latencies;
+  uint64_t errors = 0;
+};
+
+struct LoadOptions {
+  std::string url = "http://localhost:8080";
+  std::string corpus = "../habits/testdata/loadgen.txt";
+  int concurrency = 4;
+  // The number of times every game in the corpus is played.
+  int repeat = 5;
+  // The 'fields' query param to send, or empty to get all the fields.
+  std::string fields;
+};
+
+// Find the value of a flag given as either "--flag=value" or "--flag value".
+// Returns false if the flag is not present or has no value.
+bool flagValue(int argc, char* argv[], const std::string& flag,
+               std::string* value) {
+  for (int i = 1; i < argc; i++) {
+    std::string s(argv[i]);
+    if (s.rfind(flag + "=", 0) == 0) {
+      *value = s.substr(flag.size() + 1);
+      return true;
+    }
+    if (s == flag && i + 1 < argc) {
+      *value = argv[i + 1];
+      return true;
+    }
+  }
+  return false;
+}
+
+// Read the corpus, checking that every move is legal so the server is only
+// sent valid requests. Returns 1 if the file can't be read or is invalid.
+int readCorpus(const std::string& path, std::vector<CorpusGame>* games) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "Failed to open the corpus: " << path << std::endl;
+    return 1;
+  }
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    CorpusGame game;
+    size_t separator = line.find(';');
+    game.fen = line.substr(0, separator);
+    Position p;
+    if (Position::ParseFen(game.fen, &p) != FEN_OK) {
+      std::cerr << path << ":" << line_number << ": invalid FEN" << std::endl;
+      return 1;
+    }
+    if (separator != std::string::npos) {
+      std::istringstream moves(line.substr(separator + 1));
+      std::string move;
+      while (moves >> move) {
+        LegalMoves legal_moves(p);
+        bool legal = false;
+        for (const auto& [piece_on_square, targets] : legal_moves.Moves()) {
+          for (const PieceMove& target : targets) {
+            if (move == piece_on_square.square.Algebraic() +
+                            target.Algebraic()) {
+              legal = true;
+            }
+          }
+        }
+        if (!legal || habits::move(&p, move) != 0) {
+          std::cerr << path << ":" << line_number << ": illegal move " << move
+                    << std::endl;
+          return 1;
+        }
+        game.moves.push_back(move);
+      }
+    }
+    games->push_back(std::move(game));
+  }
+  if (games->empty()) {
+    std::cerr << "The corpus has no games: " << path << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+size_t appendBody(char* data, size_t size, size_t count, void* body) {
+  static_cast<std::string*>(body)->append(data, size * count);
+  return size * count;
+}
+
+// Plays corpus games over one connection, which is kept alive between
+// requests.
+class LoadClient {
+ public:
+  explicit LoadClient(const LoadOptions& options)
+      : options_(options), curl_(curl_easy_init()) {
+    curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, appendBody);
+    curl_easy_setopt(curl_, CURLOPT_WRITEDATA, &body_);
+    curl_easy_setopt(curl_, CURLOPT_NOSIGNAL, 1L);
+  }
+
+  ~LoadClient() { curl_easy_cleanup(curl_); }
+
+  LoadClient(const LoadClient&) = delete;
+  LoadClient& operator=(const LoadClient&) = delete;
+
+  // Play the game, stopping at the first failed request.
+  void Play(const CorpusGame& game) {
+    if (!get(LOAD_NEWGAME, "/engine/newgame?fen=" + escape(game.fen))) {
+      return;
+    }
+    nlohmann::json response = nlohmann::json::parse(body_, nullptr, false);
+    if (!response.is_object() || !response["game"].is_string()) {
+      latencies_[LOAD_NEWGAME].errors++;
+      return;
+    }
+    const std::string game_id = response["game"].get<std::string>();
+
+    Position p = Position::FromFen(game.fen);
+    for (const std::string& move : game.moves) {
+      if (!get(LOAD_MOVE, "/engine/move/" + move + "?game=" + game_id +
+                              "&fen=" + escape(p.ToFen()))) {
+        return;
+      }
+      habits::move(&p, move);
+      if (!get(LOAD_SEARCH, "/engine/search?game=" + game_id +
+                                "&fen=" + escape(p.ToFen()))) {
+        return;
+      }
+    }
+  }
+
+  const RouteLatencies& Latencies(LoadRoute route) const {
+    return latencies_[route];
+  }
+
+ private:
+  // Send the request and record its latency. Returns false if it failed.
+  bool get(LoadRoute route, const std::string& path) {
+    std::string url = options_.url + path;
+    if (!options_.fields.empty()) {
+      url += "&fields=" + options_.fields;
+    }
+    body_.clear();
+    curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
+    const auto start = std::chrono::steady_clock::now();
+    CURLcode result = curl_easy_perform(curl_);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    long status = 0;
+    curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &status);
+    if (result != CURLE_OK || status != 200) {
+      latencies_[route].errors++;
+      return false;
+    }
+    latencies_[route].latencies.push_back(
+        std::chrono::duration<double, std::micro>(elapsed).count());
+    return true;
+  }
+
+  std::string escape(const std::string& value) {
+    char* escaped =
+        curl_easy_escape(curl_, value.c_str(), static_cast<int>(value.size()));
+    std::string result(escaped);
+    curl_free(escaped);
+    return result;
+  }
+
+  const LoadOptions& options_;
+  CURL* curl_;
+  std::string body_;
+  RouteLatencies latencies_[NUM_LOAD_ROUTES];
+};
+
+// The latency at the percentile of the sorted latencies, by the nearest rank.
+double percentile(const std::vector<double>& sorted, double percent) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  size_t rank = static_cast<size_t>(std::ceil(percent / 100.0 * sorted.size()));
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+void printRoute(const char* name, RouteLatencies latencies, double seconds) {
+  std::vector<double>& sorted = latencies.latencies;
+  std::sort(sorted.begin(), sorted.end());
+  std::cout << std::left << std::setw(8) << name << std::right << std::fixed
+            << std::setprecision(2) << std::setw(10) << sorted.size()
+            << std::setw(8) << latencies.errors << std::setw(10)
+            << sorted.size() / seconds << std::setw(10)
+            << percentile(sorted, 50) / 1000 << std::setw(10)
+            << percentile(sorted, 90) / 1000 << std::setw(10)
+            << percentile(sorted, 99) / 1000 << std::setw(10)
+            << (sorted.empty() ? 0.0 : sorted.back() / 1000) << std::endl;
+}
+
+}  // namespace
+
+}  // namespace habits
+
+int main(int argc, char* argv[]) {
+  using habits::flagValue;
+
+  habits::LoadOptions options;
+  flagValue(argc, argv, "--url", &options.url);
+  flagValue(argc, argv, "--corpus", &options.corpus);
+  flagValue(argc, argv, "--fields", &options.fields);
+  std::string value;
+  if (flagValue(argc, argv, "--concurrency", &value)) {
+    options.concurrency = std::max(std::atoi(value.c_str()), 1);
+  }
+  if (flagValue(argc, argv, "--repeat", &value)) {
+    options.repeat = std::max(std::atoi(value.c_str()), 1);
+  }
+
+  std::vector<habits::CorpusGame> corpus;
+  if (habits::readCorpus(options.corpus, &corpus) != 0) {
+    return 1;
+  }
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  // The games are handed out in the same order on every run.
+  const size_t total_games = corpus.size() * options.repeat;
+  std::atomic<size_t> next_game{0};
+  std::vector<std::unique_ptr<habits::LoadClient>> clients;
+  for (int i = 0; i < options.concurrency; i++) {
+    clients.push_back(std::make_unique<habits::LoadClient>(options));
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (auto& client : clients) {
+    threads.emplace_back([&, client = client.get()]() {
+      for (size_t game = next_game++; game < total_games; game = next_game++) {
+        client->Play(corpus[game % corpus.size()]);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  std::cout << total_games << " games against " << options.url
+            << " with concurrency " << options.concurrency << " in "
+            << std::fixed << std::setprecision(2) << seconds << "s"
+            << std::endl;
+  std::cout << "route     requests  errors     req/s    p50 ms    p90 ms"
+               "    p99 ms    max ms"
+            << std::endl;
+  habits::RouteLatencies all;
+  for (int route = 0; route < habits::NUM_LOAD_ROUTES; route++) {
+    habits::RouteLatencies merged;
+    for (const auto& client : clients) {
+      const habits::RouteLatencies& latencies =
+          client->Latencies(static_cast<habits::LoadRoute>(route));
+      merged.latencies.insert(merged.latencies.end(),
+                              latencies.latencies.begin(),
+                              latencies.latencies.end());
+      merged.errors += latencies.errors;
+    }
+    all.latencies.insert(all.latencies.end(), merged.latencies.begin(),
+                         merged.latencies.end());
+    all.errors += merged.errors;
+    habits::printRoute(
+        habits::loadRouteName(static_cast<habits::LoadRoute>(route)), merged,
+        seconds);
+  }
+  habits::printRoute("all", all, seconds);
+
+  clients.clear();
+  curl_global_cleanup();
+  return all.errors == 0 ? 0 : 1;
+}
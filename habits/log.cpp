@@ -0,0 +1,215 @@
+#include "log.hpp"
+
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace habits {
+
+namespace {
+
+std::atomic<int> log_level{LOG_INFO};
+std::atomic<std::ostream*> log_output{&std::cerr};
+
+// How long the writer sleeps when the queue is empty, if it misses a wake up.
+constexpr std::chrono::milliseconds MAX_IDLE_WAIT{100};
+
+struct LogEntry {
+  std::atomic<LogEntry*> next{nullptr};
+  LogLevel level = LOG_INFO;
+  std::chrono::system_clock::time_point time;
+  std::string message;
+};
+
+// Writes the logged messages from a background thread. Messages are queued on
+// an intrusive multi-producer single-consumer linked list: producers only swap
+// the head pointer and link in their entry, so they never wait on each other
+// or on the writer.
+class LogWriter {
+ public:
+  LogWriter() : head_(&stub_), tail_(&stub_) {
+    std::thread([this]() { run(); }).detach();
+    // The writer is never destroyed, so that logging from other threads at
+    // exit is safe, but what's queued is still written.
+    std::atexit([]() { flushLog(); });
+  }
+
+  void Push(LogEntry* entry) {
+    link(entry);
+    pushed_.fetch_add(1, std::memory_order_release);
+    if (sleeping_.load(std::memory_order_acquire)) {
+      wake_.notify_one();
+    }
+  }
+
+  void Flush() {
+    const uint64_t target = pushed_.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(mutex_);
+    wake_.notify_one();
+    written_cv_.wait(lock, [&]() { return written_ >= target; });
+  }
+
+ private:
+  void link(LogEntry* entry) {
+    LogEntry* prev = head_.exchange(entry, std::memory_order_acq_rel);
+    prev->next.store(entry, std::memory_order_release);
+  }
+
+  // Take the oldest entry off the queue, or nullptr if it's empty (or an entry
+  // is still being linked in).
+  LogEntry* pop() {
+    LogEntry* tail = tail_;
+    LogEntry* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (next == nullptr) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    // Re-queue the stub, so the last entry can be taken.
+    stub_.next.store(nullptr, std::memory_order_relaxed);
+    link(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+    return nullptr;
+  }
+
+  void run() {
+    std::string buffer;
+    while (true) {
+      uint64_t count = 0;
+      while (LogEntry* entry = pop()) {
+        format(*entry, &buffer);
+        delete entry;
+        count++;
+      }
+      if (count > 0) {
+        std::ostream* output = log_output.load(std::memory_order_acquire);
+        output->write(buffer.data(), buffer.size());
+        output->flush();
+        buffer.clear();
+      }
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      written_ += count;
+      written_cv_.notify_all();
+      if (count == 0) {
+        sleeping_.store(true, std::memory_order_release);
+        wake_.wait_for(lock, MAX_IDLE_WAIT);
+        sleeping_.store(false, std::memory_order_release);
+      }
+    }
+  }
+
+  static void format(const LogEntry& entry, std::string* buffer) {
+    const auto since_epoch = entry.time.time_since_epoch();
+    const time_t seconds =
+        std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count();
+    const int millis = static_cast<int>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(since_epoch)
+            .count() %
+        1000);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char prefix[64];
+    size_t length = strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S",
+                             &local);
+    std::snprintf(prefix + length, sizeof(prefix) - length, ".%03d %c ",
+                  millis, "DIWE"[entry.level]);
+    *buffer += prefix;
+    *buffer += entry.message;
+    *buffer += '\n';
+  }
+
+  LogEntry stub_;
+  std::atomic<LogEntry*> head_;
+  // Only used by the writer thread.
+  LogEntry* tail_;
+
+  std::atomic<uint64_t> pushed_{0};
+  std::atomic<bool> sleeping_{false};
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable written_cv_;
+  uint64_t written_ = 0;
+};
+
+LogWriter& logWriter() {
+  static LogWriter* writer = new LogWriter();
+  return *writer;
+}
+
+}  // namespace
+
+const char* logLevelName(LogLevel level) {
+  switch (level) {
+    case LOG_DEBUG:
+      return "debug";
+    case LOG_INFO:
+      return "info";
+    case LOG_WARNING:
+      return "warning";
+    case LOG_ERROR:
+      return "error";
+  }
+  return "unknown";
+}
+
+int parseLogLevel(std::string_view name, LogLevel* level) {
+  for (LogLevel l : {LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR}) {
+    if (name == logLevelName(l)) {
+      *level = l;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void setLogLevel(LogLevel level) {
+  log_level.store(level, std::memory_order_relaxed);
+}
+
+bool logEnabled(LogLevel level) {
+  return level >= log_level.load(std::memory_order_relaxed);
+}
+
+void log(LogLevel level, std::string message) {
+  if (!logEnabled(level)) {
+    return;
+  }
+  LogEntry* entry = new LogEntry();
+  entry->level = level;
+  entry->time = std::chrono::system_clock::now();
+  entry->message = std::move(message);
+  logWriter().Push(entry);
+}
+
+void flushLog() { logWriter().Flush(); }
+
+void setLogOutput(std::ostream* output) {
+  log_output.store(output, std::memory_order_release);
+}
+
+}  // namespace habits
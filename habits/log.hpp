@@ -0,0 +1,70 @@
+#pragma once
+
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+namespace habits {
+
+enum LogLevel : int { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR };
+
+// The name of the level, as used by the --log-level flag.
+const char* logLevelName(LogLevel level);
+
+// Parse a level name (e.g. "debug"). Returns 0 on success, or 1 if the name is
+// not a level.
+int parseLogLevel(std::string_view name, LogLevel* level);
+
+// Messages below the level are dropped, by default those below LOG_INFO.
+void setLogLevel(LogLevel level);
+
+// Whether messages at the level are logged, for skipping the building of
+// messages that would be dropped.
+bool logEnabled(LogLevel level);
+
+// Queue a message to be written by the background log writer thread. Never
+// blocks on the writing, or on other threads logging.
+void log(LogLevel level, std::string message);
+
+// Wait until all the messages queued so far have been written.
+void flushLog();
+
+// Write the log to a stream other than std::cerr, e.g. for tests. The stream
+// must outlive the logging.
+void setLogOutput(std::ostream* output);
+
+// Builds a message with <<, and logs it at the end of the statement. Nothing
+// is formatted if the level is not enabled:
+//
+//   LogMessage(LOG_DEBUG) << "Response: " << response;
+class LogMessage {
+ public:
+  explicit LogMessage(LogLevel level) : level_(level) {
+    if (logEnabled(level)) {
+      stream_.emplace();
+    }
+  }
+
+  ~LogMessage() {
+    if (stream_) {
+      log(level_, stream_->str());
+    }
+  }
+
+  template <typename T>
+  LogMessage& operator<<(const T& value) {
+    if (stream_) {
+      *stream_ << value;
+    }
+    return *this;
+  }
+
+ private:
+  const LogLevel level_;
+  // Only created if the level is enabled.
+  std::optional<std::ostringstream> stream_;
+};
+
+}  // namespace habits
@@ -0,0 +1,100 @@
+#include "log.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace habits {
+
+namespace {
+
+std::vector<std::string> lines(const std::string& output) {
+  std::vector<std::string> lines;
+  std::istringstream stream(output);
+  std::string line;
+  while (std::getline(stream, line)) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+class LogTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    setLogOutput(&output_);
+    setLogLevel(LOG_INFO);
+  }
+
+  void TearDown() override {
+    flushLog();
+    setLogOutput(&std::cerr);
+    setLogLevel(LOG_INFO);
+  }
+
+  std::ostringstream output_;
+};
+
+TEST_F(LogTest, LogLevels) {
+  LogLevel level;
+  ASSERT_EQ(parseLogLevel("debug", &level), 0);
+  EXPECT_EQ(level, LOG_DEBUG);
+  ASSERT_EQ(parseLogLevel("error", &level), 0);
+  EXPECT_EQ(level, LOG_ERROR);
+  EXPECT_EQ(parseLogLevel("verbose", &level), 1);
+  EXPECT_STREQ(logLevelName(LOG_WARNING), "warning");
+
+  EXPECT_FALSE(logEnabled(LOG_DEBUG));
+  EXPECT_TRUE(logEnabled(LOG_INFO));
+  setLogLevel(LOG_WARNING);
+  EXPECT_FALSE(logEnabled(LOG_INFO));
+  EXPECT_TRUE(logEnabled(LOG_ERROR));
+}
+
+TEST_F(LogTest, Log) {
+  log(LOG_DEBUG, "dropped");
+  log(LOG_INFO, "first");
+  LogMessage(LOG_ERROR) << "second " << 2;
+  LogMessage(LOG_DEBUG) << "also dropped";
+  flushLog();
+
+  std::vector<std::string> logged = lines(output_.str());
+  ASSERT_EQ(logged.size(), 2);
+  EXPECT_THAT(logged[0], testing::MatchesRegex(
+                             "[0-9-]+ [0-9:]+\\.[0-9][0-9][0-9] I first"));
+  EXPECT_THAT(logged[1], testing::EndsWith(" E second 2"));
+}
+
+TEST_F(LogTest, ConcurrentLoggers) {
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < 4; thread++) {
+    threads.emplace_back([thread]() {
+      for (int i = 0; i < 1000; i++) {
+        LogMessage(LOG_INFO) << thread << " " << i;
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  flushLog();
+
+  // Each thread's messages are written whole, and in order.
+  std::vector<int> next(4, 0);
+  std::vector<std::string> logged = lines(output_.str());
+  ASSERT_EQ(logged.size(), 4000);
+  for (const std::string& line : logged) {
+    std::istringstream stream(line.substr(line.find(" I ") + 3));
+    int thread;
+    int i;
+    stream >> thread >> i;
+    ASSERT_EQ(i, next[thread]++);
+  }
+}
+
+}  // namespace
+}  // namespace habits
@@ -0,0 +1,178 @@
+#include "metrics.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "search.hpp"
+#include "stats.hpp"
+
+namespace habits {
+
+namespace {
+
+std::atomic<uint64_t> positions_generated{0};
+
+void writeHeader(std::string_view name, std::string_view type,
+                 std::string_view help, std::string* out) {
+  *out += "# HELP ";
+  *out += name;
+  *out += ' ';
+  *out += help;
+  *out += "\n# TYPE ";
+  *out += name;
+  *out += ' ';
+  *out += type;
+  *out += '\n';
+}
+
+// Append a sample of the metric, with the labels (if any) in braces.
+void writeSample(std::string_view name, std::string_view labels,
+                 std::string_view value, std::string* out) {
+  *out += name;
+  if (!labels.empty()) {
+    *out += '{';
+    *out += labels;
+    *out += '}';
+  }
+  *out += ' ';
+  *out += value;
+  *out += '\n';
+}
+
+std::string routeLabel(Route route) {
+  return std::string("route=\"") + routeName(route) + "\"";
+}
+
+}  // namespace
+
+void LatencyHistogram::Observe(std::chrono::nanoseconds elapsed) {
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  int bucket = 0;
+  while (bucket < NUM_HISTOGRAM_BOUNDS &&
+         seconds > HISTOGRAM_BOUNDS_SECONDS[bucket]) {
+    bucket++;
+  }
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  sum_ns_.fetch_add(elapsed.count(), std::memory_order_relaxed);
+}
+
+void LatencyHistogram::WritePrometheus(std::string_view name,
+                                       std::string_view labels,
+                                       std::string* out) const {
+  std::string bucket_name = std::string(name) + "_bucket";
+  std::string prefix(labels);
+  if (!prefix.empty()) {
+    prefix += ',';
+  }
+  // Prometheus buckets count everything up to their bound.
+  uint64_t count = 0;
+  char number[32];
+  for (int bucket = 0; bucket <= NUM_HISTOGRAM_BOUNDS; bucket++) {
+    count += buckets_[bucket].load(std::memory_order_relaxed);
+    std::string le = "+Inf";
+    if (bucket < NUM_HISTOGRAM_BOUNDS) {
+      std::snprintf(number, sizeof(number), "%g",
+                    HISTOGRAM_BOUNDS_SECONDS[bucket]);
+      le = number;
+    }
+    writeSample(bucket_name, prefix + "le=\"" + le + "\"",
+                std::to_string(count), out);
+  }
+  std::snprintf(number, sizeof(number), "%.9f",
+                sum_ns_.load(std::memory_order_relaxed) / 1e9);
+  writeSample(std::string(name) + "_sum", labels, number, out);
+  writeSample(std::string(name) + "_count", labels, std::to_string(count),
+              out);
+}
+
+const char* routeName(Route route) {
+  switch (route) {
+    case ROUTE_NEWGAME:
+      return "newgame";
+    case ROUTE_MOVE:
+      return "move";
+    case ROUTE_SEARCH:
+      return "search";
+    case ROUTE_BATCH:
+      return "batch";
+    case ROUTE_STATIC:
+      return "static";
+    case NUM_ROUTES:
+      break;
+  }
+  return "unknown";
+}
+
+void ServerMetrics::RecordRequest(Route route, bool ok,
+                                  std::chrono::nanoseconds elapsed) {
+  RouteMetrics& metrics = routes_[route];
+  metrics.latency.Observe(elapsed);
+  metrics.requests.fetch_add(1, std::memory_order_relaxed);
+  if (!ok) {
+    metrics.errors.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void ServerMetrics::WritePrometheus(std::string* out) const {
+  writeHeader("habits_http_request_duration_seconds", "histogram",
+              "Time taken to respond to HTTP requests.", out);
+  for (int route = 0; route < NUM_ROUTES; route++) {
+    routes_[route].latency.WritePrometheus(
+        "habits_http_request_duration_seconds",
+        routeLabel(static_cast<Route>(route)), out);
+  }
+  writeHeader("habits_http_requests_total", "counter",
+              "HTTP requests responded to.", out);
+  for (int route = 0; route < NUM_ROUTES; route++) {
+    writeSample(
+        "habits_http_requests_total", routeLabel(static_cast<Route>(route)),
+        std::to_string(routes_[route].requests.load(std::memory_order_relaxed)),
+        out);
+  }
+  writeHeader("habits_http_request_errors_total", "counter",
+              "HTTP requests responded to with an error.", out);
+  for (int route = 0; route < NUM_ROUTES; route++) {
+    writeSample(
+        "habits_http_request_errors_total",
+        routeLabel(static_cast<Route>(route)),
+        std::to_string(routes_[route].errors.load(std::memory_order_relaxed)),
+        out);
+  }
+}
+
+void countPositionsGenerated(uint64_t positions) {
+  positions_generated.fetch_add(positions, std::memory_order_relaxed);
+}
+
+uint64_t positionsGenerated() {
+  return positions_generated.load(std::memory_order_relaxed);
+}
+
+void writeEngineMetrics(std::string* out) {
+  writeMetric("habits_positions_generated_total", "counter",
+              "Positions generated while finding legal moves.",
+              positionsGenerated(), out);
+
+  writeHeader("habits_best_moves_total", "counter",
+              "Best move decisions, by the rule that decided.", out);
+  std::vector<RuleStats> stats = ruleStats();
+  for (int rule = 0; rule < NUM_RULES; rule++) {
+    writeSample("habits_best_moves_total",
+                std::string("rule=\"") + ruleName(static_cast<Rule>(rule)) +
+                    "\"",
+                std::to_string(stats[rule].hits), out);
+  }
+}
+
+void writeMetric(std::string_view name, std::string_view type,
+                 std::string_view help, uint64_t value, std::string* out) {
+  writeHeader(name, type, help, out);
+  writeSample(name, "", std::to_string(value), out);
+}
+
+}  // namespace habits
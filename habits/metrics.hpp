@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace habits {
+
+// The upper bounds, in seconds, of the buckets of a LatencyHistogram. Slower
+// observations are only counted by the +Inf bucket.
+constexpr double HISTOGRAM_BOUNDS_SECONDS[] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+    0.1,    0.25,  0.5,    1.0,   2.5,  5.0,   10.0};
+constexpr int NUM_HISTOGRAM_BOUNDS =
+    sizeof(HISTOGRAM_BOUNDS_SECONDS) / sizeof(HISTOGRAM_BOUNDS_SECONDS[0]);
+
+// A histogram of latencies, which any thread can record into without locking.
+class LatencyHistogram {
+ public:
+  void Observe(std::chrono::nanoseconds elapsed);
+
+  // Append the _bucket, _sum and _count samples of the histogram `name` in
+  // the Prometheus text format, with `labels` (such as route="move") added to
+  // each sample.
+  void WritePrometheus(std::string_view name, std::string_view labels,
+                       std::string* out) const;
+
+ private:
+  // The count in each bucket (not cumulative), the last one being for
+  // observations slower than every bound.
+  std::atomic<uint64_t> buckets_[NUM_HISTOGRAM_BOUNDS + 1] = {};
+  std::atomic<uint64_t> sum_ns_{0};
+};
+
+// The HTTP server's routes that requests are measured for.
+enum Route {
+  ROUTE_NEWGAME,
+  ROUTE_MOVE,
+  ROUTE_SEARCH,
+  ROUTE_BATCH,
+  ROUTE_STATIC,
+  NUM_ROUTES,
+};
+
+const char* routeName(Route route);
+
+// The latency, and counts of requests and errors, of each route of the HTTP
+// server. Requests are recorded without locking.
+class ServerMetrics {
+ public:
+  // Record a request to the route, which took `elapsed` to handle, and which
+  // had an error response if `ok` is false.
+  void RecordRequest(Route route, bool ok, std::chrono::nanoseconds elapsed);
+
+  // Append the metrics in the Prometheus text format.
+  void WritePrometheus(std::string* out) const;
+
+ private:
+  struct RouteMetrics {
+    LatencyHistogram latency;
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> errors{0};
+  };
+
+  RouteMetrics routes_[NUM_ROUTES];
+};
+
+// Count positions generated while finding legal moves, from any thread
+// without locking.
+void countPositionsGenerated(uint64_t positions);
+
+// The number of positions generated by all threads.
+uint64_t positionsGenerated();
+
+// Append the counters of engine work in the Prometheus text format: the
+// positions generated, and the best move decisions made by each rule.
+void writeEngineMetrics(std::string* out);
+
+// Append a metric with a single sample in the Prometheus text format. `type`
+// is "counter" or "gauge".
+void writeMetric(std::string_view name, std::string_view type,
+                 std::string_view help, uint64_t value, std::string* out);
+
+}  // namespace habits
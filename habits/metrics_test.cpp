@@ -0,0 +1,77 @@
+#include "metrics.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+
+#include "moves.hpp"
+#include "position.hpp"
+#include "search.hpp"
+
+namespace habits {
+
+namespace {
+
+using testing::HasSubstr;
+
+TEST(MetricsTest, LatencyHistogram) {
+  LatencyHistogram histogram;
+  histogram.Observe(std::chrono::microseconds(100));
+  histogram.Observe(std::chrono::milliseconds(3));
+  histogram.Observe(std::chrono::seconds(20));
+
+  std::string out;
+  histogram.WritePrometheus("latency", "route=\"move\"", &out);
+  // The buckets are cumulative.
+  const std::string bucket = "latency_bucket{route=\"move\",le=";
+  EXPECT_THAT(out, HasSubstr(bucket + "\"0.0005\"} 1\n"));
+  EXPECT_THAT(out, HasSubstr(bucket + "\"0.0025\"} 1\n"));
+  EXPECT_THAT(out, HasSubstr(bucket + "\"0.005\"} 2\n"));
+  EXPECT_THAT(out, HasSubstr(bucket + "\"10\"} 2\n"));
+  EXPECT_THAT(out, HasSubstr(bucket + "\"+Inf\"} 3\n"));
+  EXPECT_THAT(out, HasSubstr("latency_sum{route=\"move\"} 20.003100000\n"));
+  EXPECT_THAT(out, HasSubstr("latency_count{route=\"move\"} 3\n"));
+}
+
+TEST(MetricsTest, ServerMetrics) {
+  ServerMetrics metrics;
+  metrics.RecordRequest(ROUTE_MOVE, true, std::chrono::milliseconds(1));
+  metrics.RecordRequest(ROUTE_MOVE, false, std::chrono::milliseconds(1));
+  metrics.RecordRequest(ROUTE_STATIC, true, std::chrono::milliseconds(1));
+
+  std::string out;
+  metrics.WritePrometheus(&out);
+  EXPECT_THAT(out, HasSubstr("# TYPE habits_http_request_duration_seconds "
+                             "histogram\n"));
+  EXPECT_THAT(out,
+              HasSubstr("habits_http_requests_total{route=\"move\"} 2\n"));
+  EXPECT_THAT(out, HasSubstr("habits_http_request_errors_total"
+                             "{route=\"move\"} 1\n"));
+  EXPECT_THAT(out,
+              HasSubstr("habits_http_requests_total{route=\"static\"} 1\n"));
+  EXPECT_THAT(out,
+              HasSubstr("habits_http_requests_total{route=\"search\"} 0\n"));
+}
+
+TEST(MetricsTest, EngineMetrics) {
+  uint64_t before = positionsGenerated();
+  // Only the 20 moves from the start position are tried.
+  LegalMoves legal_moves(Position::FromFen(
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"));
+  EXPECT_EQ(positionsGenerated() - before, 20);
+
+  Game game;
+  game.bestMove(Position::FromFen(
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"));
+  std::string out;
+  writeEngineMetrics(&out);
+  EXPECT_THAT(out, HasSubstr("# TYPE habits_positions_generated_total "
+                             "counter\n"));
+  EXPECT_THAT(out,
+              HasSubstr("habits_best_moves_total{rule=\"initial move\"} 1\n"));
+}
+
+}  // namespace
+}  // namespace habits
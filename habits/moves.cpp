@@ -11,6 +11,8 @@
 #include <string_view>
 #include <utility>
 
+#include "log.hpp"
+#include "metrics.hpp"
 #include "position.hpp"
 
 namespace habits {
@@ -20,6 +22,7 @@ namespace {
 // TIP: to view bitboards, see https://tearth.dev/bitboard-viewer/ (Layout 1)
 
 constexpr uint64_t A_FILE = 0x101010101010101ull;
+constexpr uint64_t H_FILE = A_FILE << 7;
 constexpr uint64_t RANK_1 = 0xffull;
 constexpr uint64_t AB_FILES = A_FILE | (A_FILE << 1);
 constexpr uint64_t GH_FILES = (A_FILE << 7) | (A_FILE << 6);
@@ -33,385 +36,450 @@ constexpr uint64_t KING_MOVES_B2 = 0x70507ull;
 
 std::vector<Piece> pawn_promotions = {QUEEN, ROOK, BISHOP, KNIGHT};
 
-// Determine the possible moves for the active color in the Position.
-// Possible moves have not been verified to not result in check, so they may not
-// be legal. The map's keys are the pieces and their current squares for the
-// active color, the values are a bitboard of all the possible moves for the
-// piece on that square. Pieces with no possible moves will not be present.
-std::map<PieceOnSquare, uint64_t> possibleMoves(
-    const Position& p) {
-  std::map<PieceOnSquare, uint64_t> legal;
+// Properties of each color that are known at compile time, so move generation
+// can be specialized for each color with no branching on the active color.
+template <Color C>
+struct ColorTraits {
+  static constexpr Color OPPONENT = C == WHITE ? BLACK : WHITE;
+  // The color's first ColoredPiece, the others follow in Piece order.
+  static constexpr int FIRST_PIECE = C == WHITE ? WPAWN : BPAWN;
+  static constexpr ColoredPiece PAWN_PIECE = C == WHITE ? WPAWN : BPAWN;
+  static constexpr ColoredPiece ROOK_PIECE = C == WHITE ? WROOK : BROOK;
+  static constexpr ColoredPiece KING_PIECE = C == WHITE ? WKING : BKING;
+  // The shift for a pawn to move one square forward.
+  static constexpr int PAWN_PUSH = C == WHITE ? 8 : -8;
+  // The rank a pawn can move forward from a second time after its first move.
+  static constexpr uint64_t DOUBLE_PUSH_RANK =
+      C == WHITE ? RANK_1 << 16 : RANK_1 << 40;
+  // The rank pawns promote on.
+  static constexpr uint64_t PROMOTION_RANK = C == WHITE ? RANK_1 << 56 : RANK_1;
+  // Castling rights, and the squares for castling. The king's path includes
+  // its starting square, which must also not be in check.
+  static constexpr ColoredCastle OO_CASTLE = C == WHITE ? WOO : BOO;
+  static constexpr ColoredCastle OOO_CASTLE = C == WHITE ? WOOO : BOOO;
+  static constexpr int BACK_RANK_SHIFT = C == WHITE ? 0 : 56;
+  static constexpr uint64_t OO_EMPTY = 0x60ull << BACK_RANK_SHIFT;
+  static constexpr uint64_t OO_KING_PATH = 0x70ull << BACK_RANK_SHIFT;
+  static constexpr uint64_t OO_TARGET = 0x40ull << BACK_RANK_SHIFT;
+  static constexpr uint64_t OOO_EMPTY = 0xeull << BACK_RANK_SHIFT;
+  static constexpr uint64_t OOO_KING_PATH = 0x1cull << BACK_RANK_SHIFT;
+  static constexpr uint64_t OOO_TARGET = 0x4ull << BACK_RANK_SHIFT;
+  static constexpr int OO_ROOK_SQUARE = 7 + BACK_RANK_SHIFT;
+  static constexpr int OOO_ROOK_SQUARE = BACK_RANK_SHIFT;
+};
+
+// Shift a bitboard left for positive shifts, right for negative ones.
+template <int SHIFT>
+constexpr uint64_t shift(uint64_t board) {
+  if constexpr (SHIFT >= 0) {
+    return board << SHIFT;
+  } else {
+    return board >> -SHIFT;
+  }
+}
 
+// Get the boards of all of the color's pieces, and of all the opponent's.
+template <Color C>
+std::pair<uint64_t, uint64_t> colorBoards(const Position& p) {
+  using Active = ColorTraits<C>;
+  using Opponent = ColorTraits<Active::OPPONENT>;
   uint64_t active_pieces = 0ull;
   uint64_t opponent_pieces = 0ull;
-  for (int piece = 0; piece < 12; piece++) {
-    if ((p.active_color == WHITE && piece < 6) ||
-        (p.active_color == BLACK && piece >= 6)) {
-      active_pieces |= p.bitboards[piece];
+  for (int piece = 0; piece < 6; piece++) {
+    active_pieces |= p.bitboards[Active::FIRST_PIECE + piece];
+    opponent_pieces |= p.bitboards[Opponent::FIRST_PIECE + piece];
+  }
+  return {active_pieces, opponent_pieces};
+}
+
+// The squares that pawns of color C attack.
+template <Color C>
+uint64_t pawnAttacks(uint64_t pawns) {
+  using Active = ColorTraits<C>;
+  return shift<Active::PAWN_PUSH - 1>(pawns & ~A_FILE) |
+         shift<Active::PAWN_PUSH + 1>(pawns & ~H_FILE);
+}
+
+// The squares a knight on the square attacks.
+uint64_t knightMoves(Square square) {
+  int rank = square.Rank();
+  int file = square.File();
+  // Set all the default moves for knights on C3.
+  uint64_t move_board = KNIGHT_MOVES_C3;
+  // Shift to the actual position.
+  if (rank > 3) {
+    move_board <<= (rank - 3) * 8;
+  } else if (rank < 3) {
+    move_board >>= (3 - rank) * 8;
+  }
+  if (file > 3) {
+    move_board <<= file - 3;
+  } else if (file < 3) {
+    move_board >>= 3 - file;
+  }
+  // Remove the ones that shifted to the other side/end of the board.
+  if (rank <= 2) {
+    move_board &= ~RANK_78;
+  }
+  if (rank >= 7) {
+    move_board &= ~RANK_12;
+  }
+  if (file <= 2) {
+    move_board &= ~GH_FILES;
+  }
+  if (file >= 7) {
+    move_board &= ~AB_FILES;
+  }
+  return move_board;
+}
+
+// The squares a king on the square attacks.
+uint64_t kingMoves(Square square) {
+  int rank = square.Rank();
+  int file = square.File();
+  // Set all the default moves for kings on B2.
+  uint64_t move_board = KING_MOVES_B2;
+  // Shift to the actual position.
+  if (rank > 2) {
+    move_board <<= (rank - 2) * 8;
+  } else if (rank == 1) {
+    move_board >>= 8;
+  }
+  if (file > 2) {
+    move_board <<= file - 2;
+  } else if (file == 1) {
+    move_board >>= 1;
+  }
+  // Remove the ones that shifted to the other side/end of the board.
+  if (rank == 1) {
+    move_board &= ~RANK_78;
+  }
+  if (rank == 8) {
+    move_board &= ~RANK_12;
+  }
+  if (file == 1) {
+    move_board &= ~GH_FILES;
+  }
+  if (file == 8) {
+    move_board &= ~AB_FILES;
+  }
+  return move_board;
+}
+
+// The squares a rook on the square can move to along the ranks and files.
+uint64_t rookMoves(Square square, uint64_t active_pieces,
+                   uint64_t opponent_pieces) {
+  int rank = square.Rank();
+  int file = square.File();
+  uint64_t move_board = 0ull;
+  if (rank < 8) {
+    uint64_t up_move = A_FILE << (square.index + 8);
+    uint64_t nogo_board =
+        up_move & (active_pieces | (opponent_pieces << 8));
+    if (nogo_board == 0ull) {
+      // No blockers found in this direction so all are valid.
+      move_board |= up_move;
     } else {
-      opponent_pieces |= p.bitboards[piece];
+      // Uses __builtin_ctzll which may not work on all compilers.
+      int first_nogo_square = __builtin_ctzll(nogo_board);
+      uint64_t up_move_mask = A_FILE << first_nogo_square;
+      move_board |= up_move & ~up_move_mask;
     }
   }
-  uint64_t all_pieces = active_pieces | opponent_pieces;
-  uint64_t open_squares = ~all_pieces;
-  uint64_t pawn_attack = opponent_pieces;
-  if (p.en_passant_target_square.IsSet()) {
-    pawn_attack |= (1ull << p.en_passant_target_square.index);
-  }
-
-  int starting_piece = p.active_color == WHITE ? 0 : 6;
-  for (int piece = starting_piece; piece < starting_piece + 6; piece++) {
-    uint64_t board = p.bitboards[piece];
-    Square square;
-    while (square.Next()) {
-      uint64_t mask = square.BitboardMask();
-      if ((board & mask) != 0ull) {
-        // There's a `piece` on `square`.
-        int rank = square.Rank();
-        int file = square.File();
-        uint64_t move_board = 0ull;
-
-        if (piece == WPAWN) {
-          // Load board with attack squares.
-          if (file != 1) {
-            move_board |= (mask << 7) & pawn_attack;
-          }
-          if (file != 8) {
-            move_board |= (mask << 9) & pawn_attack;
-          }
-          // Add move squares.
-          uint64_t move_one = (mask << 8) & open_squares;
-          if (move_one != 0ull) {
-            move_board |= move_one;
-            if (rank == 2) {
-              move_board |= (mask << 16) & open_squares;
-            }
-          }
 
-        } else if (piece == BPAWN) {
-          // Load board with attack squares.
-          if (file != 8) {
-            move_board |= (mask >> 7) & pawn_attack;
-          }
-          if (file != 1) {
-            move_board |= (mask >> 9) & pawn_attack;
-          }
-          // Add move squares.
-          uint64_t move_one = (mask >> 8) & open_squares;
-          if (move_one != 0ull) {
-            move_board |= move_one;
-            if (rank == 7) {
-              move_board |= (mask >> 16) & open_squares;
-            }
-          }
+  if (file < 8) {
+    uint64_t right_move =
+        (RANK_1 << (square.index + 1)) & (RANK_1 << ((rank - 1) * 8));
+    uint64_t nogo_board =
+        right_move & (active_pieces | (opponent_pieces << 1));
+    if (nogo_board == 0ull) {
+      // No blockers found in this direction so all are valid.
+      move_board |= right_move;
+    } else {
+      int first_nogo_square = __builtin_ctzll(nogo_board);
+      uint64_t right_move_mask = RANK_1 << first_nogo_square;
+      move_board |= right_move & ~right_move_mask;
+    }
+  }
 
-        } else if (piece == WKNIGHT || piece == BKNIGHT) {
-          // Set all the default moves for knights on C3.
-          move_board = KNIGHT_MOVES_C3;
-          // Shift to the actual position.
-          if (rank > 3) {
-            move_board <<= (rank - 3) * 8;
-          } else if (rank < 3) {
-            move_board >>= (3 - rank) * 8;
-          }
-          if (file > 3) {
-            move_board <<= file - 3;
-          } else if (file < 3) {
-            move_board >>= 3 - file;
-          }
-          // Remove the ones that shifted to the other side/end of the board.
-          if (rank <= 2) {
-            move_board &= ~RANK_78;
-          }
-          if (rank >= 7) {
-            move_board &= ~RANK_12;
-          }
-          if (file <= 2) {
-            move_board &= ~GH_FILES;
-          }
-          if (file >= 7) {
-            move_board &= ~AB_FILES;
-          }
-          // Remove friendly pieces.
-          move_board &= ~active_pieces;
-
-        } else if (piece == WKING || piece == BKING) {
-          // Set all the default moves for kings on B2.
-          move_board = KING_MOVES_B2;
-          // Shift to the actual position.
-          if (rank > 2) {
-            move_board <<= (rank - 2) * 8;
-          } else if (rank == 1) {
-            move_board >>= 8;
-          }
-          if (file > 2) {
-            move_board <<= file - 2;
-          } else if (file == 1) {
-            move_board >>= 1;
-          }
-          // Remove the ones that shifted to the other side/end of the board.
-          if (rank == 1) {
-            move_board &= ~RANK_78;
-          }
-          if (rank == 8) {
-            move_board &= ~RANK_12;
-          }
-          if (file == 1) {
-            move_board &= ~GH_FILES;
-          }
-          if (file == 8) {
-            move_board &= ~AB_FILES;
-          }
-          // Remove friendly pieces.
-          move_board &= ~active_pieces;
-          // Add in castling moves
-          if (piece == WKING) {
-            if (p.castling[WOO] && (0x60ull & all_pieces) == 0ull) {
-              Position tmpP = p.Duplicate();
-              tmpP.bitboards[WKING] |= 0x70ull;
-              if (!isActiveColorInCheck(tmpP)) {
-                move_board |= 0x40ull;
-              }
-            }
-            if (p.castling[WOOO] && (0xeull & all_pieces) == 0ull) {
-              Position tmpP = p.Duplicate();
-              tmpP.bitboards[WKING] |= 0x1cull;
-              if (!isActiveColorInCheck(tmpP)) {
-                move_board |= 0x4ull;
-              }
-            }
-          } else {
-            if (p.castling[BOO] &&
-                (0x6000000000000000ull & all_pieces) == 0ull) {
-              Position tmpP = p.Duplicate();
-              tmpP.bitboards[BKING] |= 0x7000000000000000ull;
-              if (!isActiveColorInCheck(tmpP)) {
-                move_board |= 0x4000000000000000ull;
-              }
-            }
-            if (p.castling[BOOO] &&
-                (0xe00000000000000ull & all_pieces) == 0ull) {
-              Position tmpP = p.Duplicate();
-              tmpP.bitboards[BKING] |= 0x1c00000000000000ull;
-              if (!isActiveColorInCheck(tmpP)) {
-                move_board |= 0x400000000000000ull;
-              }
-            }
-          }
-        }
+  if (rank > 1) {
+    uint64_t down_move = A_FILE >> (64 - square.index);
+    uint64_t nogo_board =
+        down_move & (active_pieces | (opponent_pieces >> 8));
+    if (nogo_board == 0ull) {
+      // No blockers found in this direction so all are valid.
+      move_board |= down_move;
+    } else {
+      int last_nogo_square = 63 - __builtin_clzll(nogo_board);
+      uint64_t down_move_mask = A_FILE >> (56 - last_nogo_square);
+      move_board |= down_move & ~down_move_mask;
+    }
+  }
 
-        if (piece == WROOK || piece == BROOK || piece == WQUEEN ||
-            piece == BQUEEN) {
-          if (rank < 8) {
-            uint64_t up_move = A_FILE << (square.index + 8);
-            uint64_t nogo_board =
-                up_move & (active_pieces | (opponent_pieces << 8));
-            if (nogo_board == 0ull) {
-              // No blockers found in this direction so all are valid.
-              move_board |= up_move;
-            } else {
-              // Uses __builtin_ctzll which may not work on all compilers.
-              int first_nogo_square = __builtin_ctzll(nogo_board);
-              uint64_t up_move_mask = A_FILE << first_nogo_square;
-              move_board |= up_move & ~up_move_mask;
-            }
-          }
+  if (file > 1) {
+    uint64_t left_move = ((RANK_1 << 56) >> (64 - square.index)) &
+                         (RANK_1 << ((rank - 1) * 8));
+    uint64_t nogo_board =
+        left_move & (active_pieces | (opponent_pieces >> 1));
+    if (nogo_board == 0ull) {
+      // No blockers found in this direction so all are valid.
+      move_board |= left_move;
+    } else {
+      int last_nogo_square = 63 - __builtin_clzll(nogo_board);
+      uint64_t left_move_mask =
+          (RANK_1 << 56) >> (63 - last_nogo_square);
+      move_board |= left_move & ~left_move_mask;
+    }
+  }
+  return move_board;
+}
 
-          if (file < 8) {
-            uint64_t right_move =
-                (RANK_1 << (square.index + 1)) & (RANK_1 << ((rank - 1) * 8));
-            uint64_t nogo_board =
-                right_move & (active_pieces | (opponent_pieces << 1));
-            if (nogo_board == 0ull) {
-              // No blockers found in this direction so all are valid.
-              move_board |= right_move;
-            } else {
-              int first_nogo_square = __builtin_ctzll(nogo_board);
-              uint64_t right_move_mask = RANK_1 << first_nogo_square;
-              move_board |= right_move & ~right_move_mask;
-            }
-          }
+// The squares a bishop on the square can move to along the diagonals.
+uint64_t bishopMoves(Square square, uint64_t active_pieces,
+                     uint64_t opponent_pieces) {
+  int rank = square.Rank();
+  int file = square.File();
+  uint64_t move_board = 0ull;
+  if (square.index < 55) {
+    // Up to the right from the piece
+    uint64_t up_right_move = DIAGONAL_UP << (square.index + 9);
+    // Remove diagonal that gets shifted to the other side.
+    int move_mask_square = 72 - 8 * (file - rank);
+    if (move_mask_square < 64) {
+      up_right_move &= ~(DIAGONAL_UP << move_mask_square);
+    }
+    uint64_t nogo_board =
+        up_right_move & (active_pieces | (opponent_pieces << 9));
+    if (nogo_board == 0ull) {
+      // No blockers found in this direction so all are valid.
+      move_board |= up_right_move;
+    } else {
+      int first_nogo_square = __builtin_ctzll(nogo_board);
+      uint64_t up_right_move_mask = DIAGONAL_UP << first_nogo_square;
+      move_board |= up_right_move & ~up_right_move_mask;
+    }
+  }
 
-          if (rank > 1) {
-            uint64_t down_move = A_FILE >> (64 - square.index);
-            uint64_t nogo_board =
-                down_move & (active_pieces | (opponent_pieces >> 8));
-            if (nogo_board == 0ull) {
-              // No blockers found in this direction so all are valid.
-              move_board |= down_move;
-            } else {
-              int last_nogo_square = 63 - __builtin_clzll(nogo_board);
-              uint64_t down_move_mask = A_FILE >> (56 - last_nogo_square);
-              move_board |= down_move & ~down_move_mask;
-            }
-          }
+  if (square.index > 8) {
+    // Down to the left from the piece
+    uint64_t down_left_move = DIAGONAL_UP >> (63 - square.index + 9);
+    // Remove diagonal that gets shifted to the other side.
+    int move_mask_square = 8 * (rank - file) - 9;
+    if (move_mask_square >= 0) {
+      down_left_move &= ~(DIAGONAL_UP >> (63 - move_mask_square));
+    }
+    uint64_t nogo_board =
+        down_left_move & (active_pieces | (opponent_pieces >> 9));
+    if (nogo_board == 0ull) {
+      // No blockers found in this direction so all are valid.
+      move_board |= down_left_move;
+    } else {
+      int last_nogo_square = 63 - __builtin_clzll(nogo_board);
+      uint64_t down_left_move_mask =
+          DIAGONAL_UP >> (63 - last_nogo_square);
+      move_board |= down_left_move & ~down_left_move_mask;
+    }
+  }
 
-          if (file > 1) {
-            uint64_t left_move = ((RANK_1 << 56) >> (64 - square.index)) &
-                                 (RANK_1 << ((rank - 1) * 8));
-            uint64_t nogo_board =
-                left_move & (active_pieces | (opponent_pieces >> 1));
-            if (nogo_board == 0ull) {
-              // No blockers found in this direction so all are valid.
-              move_board |= left_move;
-            } else {
-              int last_nogo_square = 63 - __builtin_clzll(nogo_board);
-              uint64_t left_move_mask =
-                  (RANK_1 << 56) >> (63 - last_nogo_square);
-              move_board |= left_move & ~left_move_mask;
-            }
-          }
-        }
+  if (square.index < 56) {
+    // Up to the left from the piece
+    uint64_t up_left_move = DIAGONAL_DOWN << square.index;
+    // Remove diagonal that gets shifted to the other side.
+    int move_mask_square = 8 * (file + rank) - 9;
+    if (move_mask_square < 64) {
+      up_left_move &= ~(DIAGONAL_DOWN << (move_mask_square - 7));
+    }
+    uint64_t nogo_board =
+        up_left_move & (active_pieces | (opponent_pieces << 7));
+    if (nogo_board == 0ull) {
+      // No blockers found in this direction so all are valid.
+      move_board |= up_left_move;
+    } else {
+      int first_nogo_square = __builtin_ctzll(nogo_board);
+      uint64_t up_left_move_mask = DIAGONAL_DOWN
+                                   << (first_nogo_square - 7);
+      move_board |= up_left_move & ~up_left_move_mask;
+    }
+  }
 
-        if (piece == WBISHOP || piece == BBISHOP || piece == WQUEEN ||
-            piece == BQUEEN) {
-          if (square.index < 55) {
-            // Up to the right from the piece
-            uint64_t up_right_move = DIAGONAL_UP << (square.index + 9);
-            // Remove diagonal that gets shifted to the other side.
-            int move_mask_square = 72 - 8 * (file - rank);
-            if (move_mask_square < 64) {
-              up_right_move &= ~(DIAGONAL_UP << move_mask_square);
-            }
-            uint64_t nogo_board =
-                up_right_move & (active_pieces | (opponent_pieces << 9));
-            if (nogo_board == 0ull) {
-              // No blockers found in this direction so all are valid.
-              move_board |= up_right_move;
-            } else {
-              int first_nogo_square = __builtin_ctzll(nogo_board);
-              uint64_t up_right_move_mask = DIAGONAL_UP << first_nogo_square;
-              move_board |= up_right_move & ~up_right_move_mask;
-            }
-          }
+  if (square.index > 7) {
+    // Down to the right from the piece
+    uint64_t down_right_move = DIAGONAL_DOWN >> (63 - square.index);
+    // Remove diagonal that gets shifted to the other side.
+    int move_mask_shift = 8 * (16 - rank - file);
+    if (move_mask_shift < 64) {
+      down_right_move &= ~(DIAGONAL_DOWN >> move_mask_shift);
+    }
+    uint64_t nogo_board =
+        down_right_move & (active_pieces | (opponent_pieces >> 7));
+    if (nogo_board == 0ull) {
+      // No blockers found in this direction so all are valid.
+      move_board |= down_right_move;
+    } else {
+      int last_nogo_square = 63 - __builtin_clzll(nogo_board);
+      uint64_t down_right_move_mask =
+          DIAGONAL_DOWN >> (63 - last_nogo_square - 7);
+      move_board |= down_right_move & ~down_right_move_mask;
+    }
+  }
+  return move_board;
+}
 
-          if (square.index > 8) {
-            // Down to the left from the piece
-            uint64_t down_left_move = DIAGONAL_UP >> (63 - square.index + 9);
-            // Remove diagonal that gets shifted to the other side.
-            int move_mask_square = 8 * (rank - file) - 9;
-            if (move_mask_square >= 0) {
-              down_left_move &= ~(DIAGONAL_UP >> (63 - move_mask_square));
-            }
-            uint64_t nogo_board =
-                down_left_move & (active_pieces | (opponent_pieces >> 9));
-            if (nogo_board == 0ull) {
-              // No blockers found in this direction so all are valid.
-              move_board |= down_left_move;
-            } else {
-              int last_nogo_square = 63 - __builtin_clzll(nogo_board);
-              uint64_t down_left_move_mask =
-                  DIAGONAL_UP >> (63 - last_nogo_square);
-              move_board |= down_left_move & ~down_left_move_mask;
-            }
-          }
+template <Color C>
+bool isInCheck(const Position& p);
 
-          if (square.index < 56) {
-            // Up to the left from the piece
-            uint64_t up_left_move = DIAGONAL_DOWN << square.index;
-            // Remove diagonal that gets shifted to the other side.
-            int move_mask_square = 8 * (file + rank) - 9;
-            if (move_mask_square < 64) {
-              up_left_move &= ~(DIAGONAL_DOWN << (move_mask_square - 7));
-            }
-            uint64_t nogo_board =
-                up_left_move & (active_pieces | (opponent_pieces << 7));
-            if (nogo_board == 0ull) {
-              // No blockers found in this direction so all are valid.
-              move_board |= up_left_move;
-            } else {
-              int first_nogo_square = __builtin_ctzll(nogo_board);
-              uint64_t up_left_move_mask = DIAGONAL_DOWN
-                                           << (first_nogo_square - 7);
-              move_board |= up_left_move & ~up_left_move_mask;
-            }
-          }
+// Add the possible moves for all the pieces of type P of color C to `legal`.
+template <Color C, Piece P>
+void addPossibleMoves(const Position& p, uint64_t active_pieces,
+                      uint64_t opponent_pieces,
+                      std::map<PieceOnSquare, uint64_t>* legal) {
+  using Active = ColorTraits<C>;
+  constexpr ColoredPiece piece =
+      static_cast<ColoredPiece>(Active::FIRST_PIECE + P);
+  const uint64_t board = p.bitboards[piece];
+  if (board == 0ull) {
+    return;
+  }
+  const uint64_t all_pieces = active_pieces | opponent_pieces;
+  const uint64_t open_squares = ~all_pieces;
+  uint64_t pawn_attack = opponent_pieces;
+  if constexpr (P == PAWN) {
+    if (p.en_passant_target_square.IsSet()) {
+      pawn_attack |= (1ull << p.en_passant_target_square.index);
+    }
+  }
 
-          if (square.index > 7) {
-            // Down to the right from the piece
-            uint64_t down_right_move = DIAGONAL_DOWN >> (63 - square.index);
-            // Remove diagonal that gets shifted to the other side.
-            int move_mask_shift = 8 * (16 - rank - file);
-            if (move_mask_shift < 64) {
-              down_right_move &= ~(DIAGONAL_DOWN >> move_mask_shift);
-            }
-            uint64_t nogo_board =
-                down_right_move & (active_pieces | (opponent_pieces >> 7));
-            if (nogo_board == 0ull) {
-              // No blockers found in this direction so all are valid.
-              move_board |= down_right_move;
-            } else {
-              int last_nogo_square = 63 - __builtin_clzll(nogo_board);
-              uint64_t down_right_move_mask =
-                  DIAGONAL_DOWN >> (63 - last_nogo_square - 7);
-              move_board |= down_right_move & ~down_right_move_mask;
-            }
-          }
-        }
+  for (Square square : Squares(board)) {
+    // There's a `piece` on `square`.
+    uint64_t mask = square.BitboardMask();
+    uint64_t move_board = 0ull;
+
+    if constexpr (P == PAWN) {
+      // Load board with attack squares.
+      move_board |= pawnAttacks<C>(mask) & pawn_attack;
+      // Add move squares.
+      uint64_t move_one = shift<Active::PAWN_PUSH>(mask) & open_squares;
+      move_board |= move_one;
+      move_board |=
+          shift<Active::PAWN_PUSH>(move_one & Active::DOUBLE_PUSH_RANK) &
+          open_squares;
+
+    } else if constexpr (P == KNIGHT) {
+      // Remove friendly pieces.
+      move_board = knightMoves(square) & ~active_pieces;
 
-        if (move_board != 0ull) {
-          legal[PieceOnSquare(static_cast<ColoredPiece>(piece), square)] =
-              move_board;
+    } else if constexpr (P == KING) {
+      // Remove friendly pieces.
+      move_board = kingMoves(square) & ~active_pieces;
+      // Add in castling moves
+      if (p.CanCastle(Active::OO_CASTLE) &&
+          (Active::OO_EMPTY & all_pieces) == 0ull) {
+        Position tmpP = p.Duplicate();
+        tmpP.bitboards[piece] |= Active::OO_KING_PATH;
+        if (!isInCheck<C>(tmpP)) {
+          move_board |= Active::OO_TARGET;
         }
       }
+      if (p.CanCastle(Active::OOO_CASTLE) &&
+          (Active::OOO_EMPTY & all_pieces) == 0ull) {
+        Position tmpP = p.Duplicate();
+        tmpP.bitboards[piece] |= Active::OOO_KING_PATH;
+        if (!isInCheck<C>(tmpP)) {
+          move_board |= Active::OOO_TARGET;
+        }
+      }
+    }
+
+    if constexpr (P == ROOK || P == QUEEN) {
+      move_board |= rookMoves(square, active_pieces, opponent_pieces);
+    }
+    if constexpr (P == BISHOP || P == QUEEN) {
+      move_board |= bishopMoves(square, active_pieces, opponent_pieces);
+    }
+
+    if (move_board != 0ull) {
+      (*legal)[PieceOnSquare(piece, square)] = move_board;
     }
   }
+}
+
+// Determine the possible moves for color C, which must be the active color in
+// the Position.
+// Possible moves have not been verified to not result in check, so they may not
+// be legal. The map's keys are the pieces and their current squares for the
+// active color, the values are a bitboard of all the possible moves for the
+// piece on that square. Pieces with no possible moves will not be present.
+template <Color C>
+std::map<PieceOnSquare, uint64_t> possibleMoves(const Position& p) {
+  std::map<PieceOnSquare, uint64_t> legal;
+  const auto [active_pieces, opponent_pieces] = colorBoards<C>(p);
+  addPossibleMoves<C, PAWN>(p, active_pieces, opponent_pieces, &legal);
+  addPossibleMoves<C, KNIGHT>(p, active_pieces, opponent_pieces, &legal);
+  addPossibleMoves<C, BISHOP>(p, active_pieces, opponent_pieces, &legal);
+  addPossibleMoves<C, ROOK>(p, active_pieces, opponent_pieces, &legal);
+  addPossibleMoves<C, QUEEN>(p, active_pieces, opponent_pieces, &legal);
+  addPossibleMoves<C, KING>(p, active_pieces, opponent_pieces, &legal);
   return legal;
 }
 
+// Determine the possible moves for the active color in the Position.
+std::map<PieceOnSquare, uint64_t> possibleMoves(const Position& p) {
+  if (p.active_color == WHITE) {
+    return possibleMoves<WHITE>(p);
+  }
+  return possibleMoves<BLACK>(p);
+}
+
 // Applies the move from `from_square` to `to_square` to the Position, promoting
-// to `promote_to` if necessary. The active color is not changed.
+// to `promote_to` if necessary. The active color C is not changed.
+template <Color C>
 int moveInternal(Position* p, Square from_square, Square to_square,
                  Piece promote_to) {
+  using Active = ColorTraits<C>;
+  using Opponent = ColorTraits<Active::OPPONENT>;
   uint64_t from_mask = from_square.BitboardMask();
   uint64_t to_mask = to_square.BitboardMask();
 
   // Find which piece moved.
-  int starting_piece = p->active_color == WHITE ? 0 : 6;
-  int piece = starting_piece;
-  for (; piece < starting_piece + 6; piece++) {
+  int piece = Active::FIRST_PIECE;
+  for (; piece < Active::FIRST_PIECE + 6; piece++) {
     if ((from_mask & p->bitboards[piece]) != 0ull) {
       break;
     }
   }
-  if (piece >= starting_piece + 6) {
-    std::cout << "Failed to find a piece for " << p->active_color
-              << " on square " << from_square << std::endl;
+  if (piece >= Active::FIRST_PIECE + 6) {
+    LogMessage(LOG_DEBUG) << "Failed to find a piece for "
+                          << static_cast<int>(p->active_color) << " on square "
+                          << from_square;
     return 1;
   }
   p->halfmove_clock++;
 
   // Find if an opponent peice is on the target square.
-  starting_piece = p->active_color == WHITE ? 6 : 0;
-  int opponent_piece = starting_piece;
-  for (; opponent_piece < starting_piece + 6; opponent_piece++) {
+  int opponent_piece = Opponent::FIRST_PIECE;
+  for (; opponent_piece < Opponent::FIRST_PIECE + 6; opponent_piece++) {
     if ((to_mask & p->bitboards[opponent_piece]) != 0ull) {
       break;
     }
   }
-  if (opponent_piece < starting_piece + 6) {
+  if (opponent_piece < Opponent::FIRST_PIECE + 6) {
     // Remove the opponent's piece from the target square.
     p->bitboards[opponent_piece] &= ~to_mask;
     p->halfmove_clock = 0;
     // Check for castling no longer being available.
-    if (opponent_piece == WROOK && to_square.index == 7) {
-      p->castling[WOO] = false;
-    }
-    if (opponent_piece == WROOK && to_square.index == 0) {
-      p->castling[WOOO] = false;
-    }
-    if (opponent_piece == BROOK && to_square.index == 56) {
-      p->castling[BOOO] = false;
-    }
-    if (opponent_piece == BROOK && to_square.index == 63) {
-      p->castling[BOO] = false;
+    if (opponent_piece == Opponent::ROOK_PIECE) {
+      if (to_square.index == Opponent::OO_ROOK_SQUARE) {
+        p->SetCastle(Opponent::OO_CASTLE, false);
+      } else if (to_square.index == Opponent::OOO_ROOK_SQUARE) {
+        p->SetCastle(Opponent::OOO_CASTLE, false);
+      }
     }
   }
 
   // Check for en passant capture.
-  if (piece % 6 == PAWN && p->en_passant_target_square == to_square) {
-    int en_passant_square = to_square.index - (p->active_color == WHITE ? 8 : -8);
-    p->bitboards[6 - piece] &= ~(1ull << en_passant_square);
+  if (piece == Active::PAWN_PIECE && p->en_passant_target_square == to_square) {
+    int en_passant_square = to_square.index - Active::PAWN_PUSH;
+    p->bitboards[Opponent::PAWN_PIECE] &= ~(1ull << en_passant_square);
     p->halfmove_clock = 0;
   }
   p->en_passant_target_square = Square();
@@ -419,7 +487,8 @@ int moveInternal(Position* p, Square from_square, Square to_square,
   // Remove the from square from the piece's board.
   p->bitboards[piece] &= ~from_mask;
 
-  if (piece % 6 == PAWN && (to_square.index >= 56 || to_square.index <= 7)) {
+  if (piece == Active::PAWN_PIECE &&
+      (to_mask & Active::PROMOTION_RANK) != 0ull) {
     int promotion_piece = piece + promote_to - PAWN;
     p->bitboards[promotion_piece] |= to_mask;
   } else {
@@ -428,89 +497,93 @@ int moveInternal(Position* p, Square from_square, Square to_square,
   }
 
   // Check for castling.
-  if (piece % 6 == KING && abs(from_square.index - to_square.index) == 2) {
-    int rook_piece = piece - 2;
+  if (piece == Active::KING_PIECE &&
+      abs(from_square.index - to_square.index) == 2) {
     int rook_square;
     if (to_square < from_square) {
       // O-O-O
-      rook_square = from_square.index - 4;
+      rook_square = Active::OOO_ROOK_SQUARE;
     } else {
       // O-O
-      rook_square = from_square.index + 3;
+      rook_square = Active::OO_ROOK_SQUARE;
     }
-    p->bitboards[rook_piece] &= ~(1ull << rook_square);
-    p->bitboards[rook_piece] |= 1ull << ((from_square.index + to_square.index) / 2);
+    p->bitboards[Active::ROOK_PIECE] &= ~(1ull << rook_square);
+    p->bitboards[Active::ROOK_PIECE] |=
+        1ull << ((from_square.index + to_square.index) / 2);
   }
 
   // Update castling availability, en passant and halfmove clock.
-  switch (piece) {
-    case WPAWN:
-      p->halfmove_clock = 0;
-      if (to_square.index - from_square.index == 16) {
-        p->en_passant_target_square = Square(from_square.index + 8);
-      }
-      break;
-    case BPAWN:
-      p->halfmove_clock = 0;
-      if (to_square.index - from_square.index == -16) {
-        p->en_passant_target_square = Square(from_square.index - 8);
-      }
-      break;
-    case WROOK:
-      if (from_square.index == 0) {
-        p->castling[WOOO] = false;
-      } else if (from_square.index == 7) {
-        p->castling[WOO] = false;
-      }
-      break;
-    case BROOK:
-      if (from_square.index == 56) {
-        p->castling[BOOO] = false;
-      } else if (from_square.index == 63) {
-        p->castling[BOO] = false;
-      }
-      break;
-    case WKING:
-      p->castling[WOOO] = false;
-      p->castling[WOO] = false;
-      break;
-    case BKING:
-      p->castling[BOOO] = false;
-      p->castling[BOO] = false;
-      break;
+  if (piece == Active::PAWN_PIECE) {
+    p->halfmove_clock = 0;
+    if (to_square.index - from_square.index == 2 * Active::PAWN_PUSH) {
+      p->en_passant_target_square =
+          Square(from_square.index + Active::PAWN_PUSH);
+    }
+  } else if (piece == Active::ROOK_PIECE) {
+    if (from_square.index == Active::OOO_ROOK_SQUARE) {
+      p->SetCastle(Active::OOO_CASTLE, false);
+    } else if (from_square.index == Active::OO_ROOK_SQUARE) {
+      p->SetCastle(Active::OO_CASTLE, false);
+    }
+  } else if (piece == Active::KING_PIECE) {
+    p->SetCastle(Active::OOO_CASTLE, false);
+    p->SetCastle(Active::OO_CASTLE, false);
   }
 
-  if (p->active_color == BLACK) {
+  if constexpr (C == BLACK) {
     p->fullmove_number++;
   }
 
   return 0;
 }
 
+// Applies the move for the active color in the Position.
+int moveInternal(Position* p, Square from_square, Square to_square,
+                 Piece promote_to) {
+  if (p->active_color == WHITE) {
+    return moveInternal<WHITE>(p, from_square, to_square, promote_to);
+  }
+  return moveInternal<BLACK>(p, from_square, to_square, promote_to);
+}
+
+// Determine if color C, which must be the active color in the Position, is in
+// check.
+template <Color C>
+bool isInCheck(const Position& p) {
+  using Active = ColorTraits<C>;
+  std::map<PieceOnSquare, uint64_t> opponent_moves =
+      possibleMoves<Active::OPPONENT>(p.ForOpponent());
+  uint64_t king_board = p.bitboards[Active::KING_PIECE];
+  for (const auto& [square, move_board] : opponent_moves) {
+    if ((king_board & move_board) != 0ull) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 LegalMoves::LegalMoves(const Position& p) : active_color_(p.active_color) {
   std::map<PieceOnSquare, uint64_t> possible_move_boards =
       possibleMoves(p);
+  uint64_t generated = 0;
   for (const auto& [piece_and_square, move_board] : possible_move_boards) {
     if (move_board != 0ull) {
       std::vector<PieceMove> targets;
-      Square move_square;
-      while (move_square.Next()) {
-        uint64_t move_mask = move_square.BitboardMask();
-        if ((move_board & move_mask) != 0ull) {
-          // Try the move (promotion type can't affect check).
-          Position tmpP = p.Duplicate();
-          moveInternal(&tmpP, piece_and_square.square, move_square, QUEEN);
-          // Don't add it if it results in being in check.
-          if (!isActiveColorInCheck(tmpP)) {
-            if (piece_and_square.CanPromote()) {
-              for (Piece promote_to : pawn_promotions) {
-                targets.push_back(PieceMove(move_square, promote_to));
-              }
-            } else {
-              targets.push_back(PieceMove(move_square));
+      for (Square move_square : Squares(move_board)) {
+        // Try the move (promotion type can't affect check).
+        Position tmpP = p.Duplicate();
+        moveInternal(&tmpP, piece_and_square.square, move_square, QUEEN);
+        generated++;
+        // Don't add it if it results in being in check.
+        if (!isActiveColorInCheck(tmpP)) {
+          if (piece_and_square.CanPromote()) {
+            for (Piece promote_to : pawn_promotions) {
+              targets.push_back(PieceMove(move_square, promote_to));
             }
+          } else {
+            targets.push_back(PieceMove(move_square));
           }
         }
       }
@@ -523,6 +596,28 @@ LegalMoves::LegalMoves(const Position& p) : active_color_(p.active_color) {
       }
     }
   }
+  countPositionsGenerated(generated);
+}
+
+bool hasLegalMove(const Position& p) {
+  uint64_t generated = 0;
+  bool found = false;
+  for (const auto& [piece_and_square, move_board] : possibleMoves(p)) {
+    for (Square move_square : Squares(move_board)) {
+      Position tmpP = p.Duplicate();
+      moveInternal(&tmpP, piece_and_square.square, move_square, QUEEN);
+      generated++;
+      if (!isActiveColorInCheck(tmpP)) {
+        found = true;
+        break;
+      }
+    }
+    if (found) {
+      break;
+    }
+  }
+  countPositionsGenerated(generated);
+  return found;
 }
 
 std::vector<PieceMoves> LegalMoves::Sorted() const {
@@ -545,6 +640,14 @@ std::vector<PieceMoves> LegalMoves::Sorted() const {
   return sorted_legal_moves;
 }
 
+int LegalMoves::Count() const {
+  int count = 0;
+  for (const auto& [piece_on_square, moves] : legal_moves_) {
+    count += moves.size();
+  }
+  return count;
+}
+
 bool LegalMoves::IsLegal(PieceOnSquare piece_on_square, Square to_square) const {
   auto legal_moves_from = legal_moves_.find(piece_on_square);
   if (legal_moves_from == legal_moves_.end()) {
@@ -588,17 +691,53 @@ nlohmann::json LegalMoves::ToJson() const {
   return legal;
 }
 
-bool isActiveColorInCheck(const Position& p) {
-  std::map<PieceOnSquare, uint64_t> opponent_moves =
-      possibleMoves(p.ForOpponent());
-  uint64_t king_board = p.bitboards[p.active_color == WHITE ? WKING : BKING];
-  for (const auto& [square, move_board] : opponent_moves) {
-    if ((king_board & move_board) != 0ull) {
-      return true;
-      break;
+void LegalMoves::WriteJson(JsonWriter* writer) const {
+  // nlohmann::json sorts the keys, which puts the squares in file order rather
+  // than the rank order of their indexes.
+  const std::vector<PieceMove>* moves_from[64] = {};
+  bool has_moves = false;
+  for (const auto& [piece_and_square, move_squares] : legal_moves_) {
+    if (!move_squares.empty()) {
+      moves_from[piece_and_square.square.index] = &move_squares;
+      has_moves = true;
     }
   }
-  return false;
+  if (!has_moves) {
+    writer->Null();
+    return;
+  }
+
+  writer->BeginObject();
+  for (int file = 0; file < 8; file++) {
+    for (int rank = 0; rank < 8; rank++) {
+      const std::vector<PieceMove>* move_squares = moves_from[rank * 8 + file];
+      if (move_squares == nullptr) {
+        continue;
+      }
+      const char from[] = {static_cast<char>('a' + file),
+                           static_cast<char>('1' + rank)};
+      writer->Key(std::string_view(from, sizeof(from)));
+      writer->BeginArray();
+      for (const PieceMove& move_square : *move_squares) {
+        char to[3] = {static_cast<char>('a' + move_square.square.index % 8),
+                      static_cast<char>('1' + move_square.square.index / 8)};
+        size_t length = 2;
+        if (move_square.promote_to != PAWN) {
+          to[length++] = toPromotion(move_square.promote_to);
+        }
+        writer->String(std::string_view(to, length));
+      }
+      writer->EndArray();
+    }
+  }
+  writer->EndObject();
+}
+
+bool isActiveColorInCheck(const Position& p) {
+  if (p.active_color == WHITE) {
+    return isInCheck<WHITE>(p);
+  }
+  return isInCheck<BLACK>(p);
 }
 
 int move(Position* p, std::string_view move) {
@@ -642,24 +781,40 @@ int ControlSquares::pieceValue(int piece) {
 }
 
 ControlSquares::ControlSquares(const Position& p) : p_(p) {
+  if (p.active_color == WHITE) {
+    computeControl<WHITE>(p);
+  } else {
+    computeControl<BLACK>(p);
+  }
+}
+
+template <Color C>
+void ControlSquares::computeControl(const Position& p) {
+  using Active = ColorTraits<C>;
+  using Opponent = ColorTraits<Active::OPPONENT>;
   const std::map<PieceOnSquare, uint64_t> active_moves =
-      possibleMoves(p);
+      possibleMoves<C>(p);
   const std::map<PieceOnSquare, uint64_t> opponent_moves =
-      possibleMoves(p.ForOpponent());
+      possibleMoves<Active::OPPONENT>(p.ForOpponent());
 
-  uint64_t active_pieces = 0ull;
-  uint64_t opponent_pieces = 0ull;
-  for (int piece = 0; piece < 12; piece++) {
-    if ((p.active_color == WHITE && piece < 6) ||
-        (p.active_color == BLACK && piece >= 6)) {
-      active_pieces |= p.bitboards[piece];
-    } else {
-      opponent_pieces |= p.bitboards[piece];
-    }
+  const auto [active_pieces, opponent_pieces] = colorBoards<C>(p);
+
+  // Only squares that a piece can attack need to be checked. Whether a piece
+  // attacks a square doesn't depend on what is on that square, so these are the
+  // possible moves, the squares with pieces on them (which the possible moves
+  // exclude for the piece's own color), and the pawn captures.
+  uint64_t attackable_squares =
+      active_pieces | opponent_pieces |
+      pawnAttacks<C>(p.bitboards[Active::PAWN_PIECE]) |
+      pawnAttacks<Active::OPPONENT>(p.bitboards[Opponent::PAWN_PIECE]);
+  for (const auto& [piece_and_square, move_board] : active_moves) {
+    attackable_squares |= move_board;
+  }
+  for (const auto& [piece_and_square, move_board] : opponent_moves) {
+    attackable_squares |= move_board;
   }
 
-  Square square;
-  while (square.Next()) {
+  for (Square square : Squares(attackable_squares)) {
     uint64_t mask = square.BitboardMask();
     std::map<PieceOnSquare, uint64_t> temp_active_moves =
         active_moves;
@@ -669,25 +824,24 @@ ControlSquares::ControlSquares(const Position& p) : p_(p) {
       // There's no piece on the square for the current player. Need to put one
       // there so the opponent can attack it.
       Position tempP = p.Duplicate();
-      tempP.bitboards[p.active_color == WHITE ? WPAWN : BPAWN] |= mask;
+      tempP.bitboards[Active::PAWN_PIECE] |= mask;
       // Also make sure any piece there for the opponent is removed.
-      int starting_piece = p.active_color == WHITE ? 6 : 0;
-      for (int piece = starting_piece; piece < starting_piece + 6; piece++) {
-        tempP.bitboards[piece] &= ~mask;
+      for (int piece = 0; piece < 6; piece++) {
+        tempP.bitboards[Opponent::FIRST_PIECE + piece] &= ~mask;
       }
-      temp_opponent_moves = possibleMoves(tempP.ForOpponent());
+      temp_opponent_moves =
+          possibleMoves<Active::OPPONENT>(tempP.ForOpponent());
     }
     if ((mask & opponent_pieces) == 0ull) {
       // There's no piece on the square for the opponent. Need to put one there
       // so the current player can attack it.
       Position tempP = p.Duplicate();
-      tempP.bitboards[p.active_color == WHITE ? BPAWN : WPAWN] |= mask;
+      tempP.bitboards[Opponent::PAWN_PIECE] |= mask;
       // Also make sure any piece there for the current player is removed.
-      int starting_piece = p.active_color == WHITE ? 0 : 6;
-      for (int piece = starting_piece; piece < starting_piece + 6; piece++) {
-        tempP.bitboards[piece] &= ~mask;
+      for (int piece = 0; piece < 6; piece++) {
+        tempP.bitboards[Active::FIRST_PIECE + piece] &= ~mask;
       }
-      temp_active_moves = possibleMoves(tempP);
+      temp_active_moves = possibleMoves<C>(tempP);
     }
     int defenders = 0;
     int min_defender_value = pieceValue(WKING);
@@ -849,4 +1003,31 @@ nlohmann::json ControlSquares::ToJson() const {
   return control_squares;
 }
 
+void ControlSquares::WriteJson(JsonWriter* writer) const {
+  if (control_squares_.empty()) {
+    writer->Null();
+    return;
+  }
+  // Put the squares in the sorted order of their algebraic names, as
+  // nlohmann::json does.
+  const ControlValues* controls[64] = {};
+  for (const auto& [square, control] : control_squares_) {
+    controls[square.index] = &control;
+  }
+  writer->BeginObject();
+  for (int file = 0; file < 8; file++) {
+    for (int rank = 0; rank < 8; rank++) {
+      const ControlValues* control = controls[rank * 8 + file];
+      if (control == nullptr) {
+        continue;
+      }
+      const char square[] = {static_cast<char>('a' + file),
+                             static_cast<char>('1' + rank)};
+      writer->Key(std::string_view(square, sizeof(square)));
+      writer->Int(control->safe_piece);
+    }
+  }
+  writer->EndObject();
+}
+
 }  // namespace habits
@@ -4,6 +4,7 @@
 #include <nlohmann/json.hpp>
 #include <string_view>
 
+#include "json_writer.hpp"
 #include "position.hpp"
 
 namespace habits {
@@ -96,9 +97,17 @@ class LegalMoves {
   // Sort so highest value pieces furthest away are considered first.
   std::vector<PieceMoves> Sorted() const;
 
+  // The total number of legal moves for all pieces.
+  int Count() const;
+
   // Check if there is a legal move for a piece on a square to a destination square.
   bool IsLegal(PieceOnSquare piece_on_square, Square to_square) const;
 
+  // All the pieces with legal moves, mapped to the moves they can make.
+  const std::map<PieceOnSquare, std::vector<PieceMove>>& Moves() const {
+    return legal_moves_;
+  }
+
   // Choose a piece and a move for it at random. The returned PieceMoves
   // will always contain only a single move.
   PieceMoves RandomMove() const;
@@ -109,6 +118,10 @@ class LegalMoves {
   // legally move to. Squares of pieces with no legal moves will not be present.
   nlohmann::json ToJson() const;
 
+  // Write the same JSON as ToJson().dump() with the writer, without building
+  // the JSON objects.
+  void WriteJson(JsonWriter* writer) const;
+
  private:
   // The current active color in the position.
   Color active_color_;
@@ -117,6 +130,10 @@ class LegalMoves {
   std::map<PieceOnSquare, std::vector<PieceMove>> legal_moves_;
 };
 
+// Whether the active color has any legal move, stopping at the first one found
+// rather than generating them all like LegalMoves.
+bool hasLegalMove(const Position& p);
+
 // Applies the move in UCI form (2-character algebraic notation for the source
 // square, 2-character algebraic notation for the target square, optional
 // character for the piece to promote to) to the Position. The active color is
@@ -175,11 +192,19 @@ class ControlSquares {
   // the square, negative if the opponent controls it.
   nlohmann::json ToJson() const;
 
+  // Write the same JSON as ToJson().dump() with the writer, without building
+  // the JSON objects.
+  void WriteJson(JsonWriter* writer) const;
+
   // Calculated value of the piece, for control squares.
   // Kings are valued the most, Pawns the least.
   static int pieceValue(int piece);
 
  private:
+  // Calculate the control of the squares for the active color C.
+  template <Color C>
+  void computeControl(const Position& p);
+
   // Get the value of any opponent's piece on the square. Returns 0 if there
   // is no opponent piece on the square.
   int getOpponentPieceValue(Square square) const;
@@ -248,6 +248,20 @@ TEST(MovesTest, IsActiveColorInCheck) {
             true);
 }
 
+TEST(MovesTest, HasLegalMove) {
+  EXPECT_TRUE(hasLegalMove(Position::FromFen(
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1")));
+  // Checkmate.
+  EXPECT_FALSE(hasLegalMove(Position::FromFen(
+      "rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3")));
+  // Stalemate.
+  EXPECT_FALSE(
+      hasLegalMove(Position::FromFen("7k/5Q2/6K1/8/8/8/8/8 b - - 0 1")));
+  // In check, with only the king able to move out of it.
+  EXPECT_TRUE(hasLegalMove(
+      Position::FromFen("4k3/4q3/8/8/8/Q7/8/4K3 w - - 20 40")));
+}
+
 TEST(MovesTest, ControlSquaresBasic) {
   ControlSquares control_squares(
       Position::FromFen("7r/8/8/8/8/8/8/2R5 w - - 0 1"));
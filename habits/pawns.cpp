@@ -0,0 +1,130 @@
+#include "pawns.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+constexpr uint64_t A_FILE = 0x101010101010101ull;
+
+// Precomputed pawn masks for every square, indexed by color (0 for white, 1 for
+// black) where the color matters.
+struct PawnMasks {
+  uint64_t front_span[2][64];
+  uint64_t passed[2][64];
+  uint64_t adjacent_files[64];
+
+  constexpr PawnMasks() : front_span(), passed(), adjacent_files() {
+    for (int index = 0; index < 64; index++) {
+      int file = index % 8;
+      front_span[0][index] = index < 56 ? A_FILE << (index + 8) : 0ull;
+      front_span[1][index] = index >= 8 ? A_FILE >> (64 - index) : 0ull;
+      if (file > 0) {
+        adjacent_files[index] |= A_FILE << (file - 1);
+      }
+      if (file < 7) {
+        adjacent_files[index] |= A_FILE << (file + 1);
+      }
+    }
+    for (int color = 0; color < 2; color++) {
+      for (int index = 0; index < 64; index++) {
+        int file = index % 8;
+        passed[color][index] = front_span[color][index];
+        if (file > 0) {
+          passed[color][index] |= front_span[color][index - 1];
+        }
+        if (file < 7) {
+          passed[color][index] |= front_span[color][index + 1];
+        }
+      }
+    }
+  }
+};
+
+constexpr PawnMasks PAWN_MASKS;
+
+// Mix the two pawn boards into an index in the table.
+int pawnHashIndex(uint64_t white_pawns, uint64_t black_pawns, int size) {
+  uint64_t key = white_pawns * 0x9e3779b97f4a7c15ull;
+  key ^= (black_pawns * 0xc2b2ae3d27d4eb4full) >> 7;
+  key ^= key >> 29;
+  return static_cast<int>(key & (size - 1));
+}
+
+}  // namespace
+
+uint64_t frontSpan(Color color, Square square) {
+  return PAWN_MASKS.front_span[color == WHITE ? 0 : 1][square.index];
+}
+
+uint64_t passedPawnMask(Color color, Square square) {
+  return PAWN_MASKS.passed[color == WHITE ? 0 : 1][square.index];
+}
+
+uint64_t adjacentFilesMask(Square square) {
+  return PAWN_MASKS.adjacent_files[square.index];
+}
+
+PawnStructure PawnStructure::Analyze(uint64_t white_pawns,
+                                     uint64_t black_pawns) {
+  PawnStructure s;
+  s.white_pawns = white_pawns;
+  s.black_pawns = black_pawns;
+
+  for (int color = 0; color < 2; color++) {
+    uint64_t own = color == 0 ? white_pawns : black_pawns;
+    uint64_t opponent = color == 0 ? black_pawns : white_pawns;
+    for (Square square : Squares(own)) {
+      int index = square.index;
+      uint64_t mask = square.BitboardMask();
+      const uint64_t front_span = PAWN_MASKS.front_span[color][index];
+      if ((PAWN_MASKS.passed[color][index] & opponent) == 0ull) {
+        s.passed[color] |= mask;
+      }
+      if ((PAWN_MASKS.adjacent_files[index] & own) == 0ull) {
+        s.isolated[color] |= mask;
+      }
+      if ((front_span & own) != 0ull) {
+        s.doubled[color] |= mask;
+      }
+      s.attack_spans[color] |= PAWN_MASKS.passed[color][index] & ~front_span;
+    }
+  }
+
+  for (int file = 0; file < 8; file++) {
+    uint64_t file_mask = A_FILE << file;
+    if ((white_pawns & file_mask) == 0ull) {
+      s.half_open_files[0] |= 1 << file;
+    }
+    if ((black_pawns & file_mask) == 0ull) {
+      s.half_open_files[1] |= 1 << file;
+    }
+  }
+  s.open_files = s.half_open_files[0] & s.half_open_files[1];
+  return s;
+}
+
+PawnHashTable::PawnHashTable() {
+  // The empty key is valid, so fill the table with its analysis.
+  std::fill(entries_, entries_ + SIZE, PawnStructure::Analyze(0ull, 0ull));
+}
+
+const PawnStructure& PawnHashTable::Probe(const Position& p) {
+  uint64_t white_pawns = p.bitboards[WPAWN];
+  uint64_t black_pawns = p.bitboards[BPAWN];
+  PawnStructure& entry =
+      entries_[pawnHashIndex(white_pawns, black_pawns, SIZE)];
+  if (entry.white_pawns == white_pawns && entry.black_pawns == black_pawns) {
+    hits_++;
+    return entry;
+  }
+  misses_++;
+  entry = PawnStructure::Analyze(white_pawns, black_pawns);
+  return entry;
+}
+
+}  // namespace habits
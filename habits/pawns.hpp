@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+
+#include "position.hpp"
+
+namespace habits {
+
+// Bitboard of the squares in front of a pawn of the color on the square, on the
+// same file, up to the end of the board.
+uint64_t frontSpan(Color color, Square square);
+
+// Bitboard of the squares in front of a pawn of the color on the square, on the
+// same and adjacent files. The pawn is passed if there are no opponent pawns on
+// any of these squares.
+uint64_t passedPawnMask(Color color, Square square);
+
+// Bitboard of the files on either side of the square's file.
+uint64_t adjacentFilesMask(Square square);
+
+// Analysis of the pawns in a position. Bitboards are indexed by color, see
+// Passed(), Isolated(), etc. to access them by Color.
+struct PawnStructure {
+  // The pawn boards that were analysed, used as the key in the PawnHashTable.
+  uint64_t white_pawns = 0ull;
+  uint64_t black_pawns = 0ull;
+  // Pawns with no opponent pawns in front of them on the same or adjacent
+  // files.
+  uint64_t passed[2] = {0ull};
+  // Pawns with no pawns of the same color on the adjacent files.
+  uint64_t isolated[2] = {0ull};
+  // Pawns with another pawn of the same color in front of them on the file.
+  uint64_t doubled[2] = {0ull};
+  // All the squares the pawns could attack as they advance.
+  uint64_t attack_spans[2] = {0ull};
+  // Files (bit 0 is the a-file) with no pawns on them.
+  uint8_t open_files = 0;
+  // Files (bit 0 is the a-file) with no pawns of the color on them.
+  uint8_t half_open_files[2] = {0};
+
+  // Analyse the pawn boards of a position.
+  static PawnStructure Analyze(uint64_t white_pawns, uint64_t black_pawns);
+
+  uint64_t Passed(Color color) const { return passed[color == WHITE ? 0 : 1]; }
+  uint64_t Isolated(Color color) const {
+    return isolated[color == WHITE ? 0 : 1];
+  }
+  uint64_t Doubled(Color color) const {
+    return doubled[color == WHITE ? 0 : 1];
+  }
+  uint64_t AttackSpan(Color color) const {
+    return attack_spans[color == WHITE ? 0 : 1];
+  }
+  uint8_t HalfOpenFiles(Color color) const {
+    return half_open_files[color == WHITE ? 0 : 1];
+  }
+};
+
+// A small cache of PawnStructure analysis, keyed by the pawn boards only. Pawn
+// structures change rarely from move to move, so most lookups during a game
+// are hits. Not thread safe, each Game has its own table.
+class PawnHashTable {
+ public:
+  PawnHashTable();
+
+  // Get the analysis of the pawns in the position, analysing and caching them
+  // if they are not already in the table.
+  const PawnStructure& Probe(const Position& p);
+
+  int Hits() const { return hits_; }
+  int Misses() const { return misses_; }
+
+ private:
+  // Must be a power of 2.
+  static constexpr int SIZE = 256;
+
+  PawnStructure entries_[SIZE];
+  int hits_ = 0;
+  int misses_ = 0;
+};
+
+}  // namespace habits
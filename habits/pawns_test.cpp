@@ -0,0 +1,74 @@
+#include "pawns.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+constexpr uint64_t A_FILE = 0x101010101010101ull;
+
+TEST(PawnsTest, FrontSpan) {
+  EXPECT_EQ(frontSpan(WHITE, Square("a2")), A_FILE & ~0x101ull);
+  EXPECT_EQ(frontSpan(BLACK, Square("a2")), 1ull);
+  EXPECT_EQ(frontSpan(WHITE, Square("e8")), 0ull);
+  EXPECT_EQ(frontSpan(BLACK, Square("e1")), 0ull);
+  EXPECT_EQ(frontSpan(BLACK, Square("h8")), (A_FILE << 7) & ~(1ull << 63));
+}
+
+TEST(PawnsTest, PassedPawnMask) {
+  EXPECT_EQ(passedPawnMask(WHITE, Square("a6")),
+            Square("a7").BitboardMask() | Square("a8").BitboardMask() |
+                Square("b7").BitboardMask() | Square("b8").BitboardMask());
+  EXPECT_EQ(passedPawnMask(BLACK, Square("e3")),
+            Square("d2").BitboardMask() | Square("e2").BitboardMask() |
+                Square("f2").BitboardMask() | Square("d1").BitboardMask() |
+                Square("e1").BitboardMask() | Square("f1").BitboardMask());
+}
+
+TEST(PawnsTest, AdjacentFilesMask) {
+  EXPECT_EQ(adjacentFilesMask(Square("a4")), A_FILE << 1);
+  EXPECT_EQ(adjacentFilesMask(Square("e1")), (A_FILE << 3) | (A_FILE << 5));
+  EXPECT_EQ(adjacentFilesMask(Square("h8")), A_FILE << 6);
+}
+
+TEST(PawnsTest, Analyze) {
+  Position p = Position::FromFen("4k3/6p1/8/1P6/8/6P1/P5P1/4K3 w - - 0 1");
+  PawnStructure s = PawnStructure::Analyze(p.bitboards[WPAWN],
+                                           p.bitboards[BPAWN]);
+
+  EXPECT_EQ(s.Passed(WHITE),
+            Square("a2").BitboardMask() | Square("b5").BitboardMask());
+  EXPECT_EQ(s.Passed(BLACK), 0ull);
+  EXPECT_EQ(s.Isolated(WHITE),
+            Square("g3").BitboardMask() | Square("g2").BitboardMask());
+  EXPECT_EQ(s.Isolated(BLACK), Square("g7").BitboardMask());
+  EXPECT_EQ(s.Doubled(WHITE), Square("g2").BitboardMask());
+  EXPECT_EQ(s.Doubled(BLACK), 0ull);
+  EXPECT_NE(s.AttackSpan(WHITE) & Square("c8").BitboardMask(), 0ull);
+  EXPECT_EQ(s.AttackSpan(WHITE) & Square("d4").BitboardMask(), 0ull);
+  EXPECT_NE(s.AttackSpan(BLACK) & Square("h1").BitboardMask(), 0ull);
+  EXPECT_EQ(s.open_files, 0b10111100);
+  EXPECT_EQ(s.HalfOpenFiles(WHITE), 0b10111100);
+  EXPECT_EQ(s.HalfOpenFiles(BLACK), 0b10111111);
+}
+
+TEST(PawnsTest, HashTable) {
+  PawnHashTable table;
+  Position p = Position::FromFen(
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  EXPECT_EQ(table.Probe(p).Passed(WHITE), 0ull);
+  EXPECT_EQ(table.Misses(), 1);
+  p.bitboards[WKNIGHT] = 0ull;
+  EXPECT_EQ(table.Probe(p).open_files, 0);
+  EXPECT_EQ(table.Hits(), 1);
+
+  Position empty = Position::FromFen("4k3/8/8/8/8/8/8/4K3 w - - 0 1");
+  EXPECT_EQ(table.Probe(empty).open_files, 0xff);
+}
+
+}  // namespace
+}  // namespace habits
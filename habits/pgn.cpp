@@ -0,0 +1,466 @@
+#include "pgn.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "moves.hpp"
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+const Position START_POSITION = Position::FromFen(
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+
+// Files are split into more chunks than threads, so that threads that get
+// chunks of short games can pick up more of them.
+constexpr int CHUNKS_PER_THREAD = 16;
+
+bool isResult(std::string_view token) {
+  return token == "1-0" || token == "0-1" || token == "1/2-1/2" ||
+         token == "*";
+}
+
+bool isDelimiter(char c) {
+  return std::isspace(static_cast<unsigned char>(c)) || c == '{' ||
+         c == '}' || c == '(' || c == ')' || c == ';' || c == '[' || c == ']';
+}
+
+// Replays the games as their tags and moves are read from the PGN.
+class GameReplayer {
+ public:
+  GameReplayer(const PgnPositionCallback& callback, PgnReplayStats* stats)
+      : callback_(callback), stats_(stats) {}
+
+  void Tag(std::string_view name, std::string_view value) {
+    if (started_ && !in_tags_) {
+      // The previous game had no result.
+      End();
+    }
+    if (!started_) {
+      begin();
+    }
+    if (name == "FEN" && Position::ParseFen(value, &position_) != FEN_OK) {
+      failed_ = true;
+    }
+  }
+
+  void Move(std::string_view san) {
+    if (!started_) {
+      begin();
+    }
+    in_tags_ = false;
+    if (failed_) {
+      return;
+    }
+    LegalMoves legal_moves(position_);
+    if (sanToUci(position_, legal_moves, san, &move_) != 0) {
+      failed_ = true;
+      return;
+    }
+    callback_(position_, ply_, move_);
+    stats_->positions++;
+    move(&position_, move_);
+    ply_++;
+  }
+
+  void End() {
+    if (!started_) {
+      return;
+    }
+    if (failed_) {
+      stats_->errors++;
+    } else {
+      move_.clear();
+      callback_(position_, ply_, move_);
+      stats_->positions++;
+    }
+    stats_->games++;
+    started_ = false;
+  }
+
+ private:
+  void begin() {
+    position_ = START_POSITION;
+    ply_ = 0;
+    started_ = true;
+    in_tags_ = true;
+    failed_ = false;
+  }
+
+  const PgnPositionCallback& callback_;
+  PgnReplayStats* stats_;
+
+  Position position_;
+  int ply_ = 0;
+  std::string move_;
+  bool started_ = false;
+  bool in_tags_ = false;
+  bool failed_ = false;
+};
+
+// Skip past the end of the comment starting at `i`.
+size_t skipComment(std::string_view pgn, size_t i) {
+  size_t end = pgn.find('}', i);
+  return end == std::string_view::npos ? pgn.size() : end + 1;
+}
+
+// Skip past the end of the line containing `i`.
+size_t skipLine(std::string_view pgn, size_t i) {
+  size_t end = pgn.find('\n', i);
+  return end == std::string_view::npos ? pgn.size() : end + 1;
+}
+
+// Skip past the end of the variation starting at `i`, including any variations
+// and comments within it.
+size_t skipVariation(std::string_view pgn, size_t i) {
+  int depth = 0;
+  while (i < pgn.size()) {
+    char c = pgn[i];
+    if (c == '{') {
+      i = skipComment(pgn, i);
+      continue;
+    }
+    if (c == ';') {
+      i = skipLine(pgn, i);
+      continue;
+    }
+    i++;
+    if (c == '(') {
+      depth++;
+    } else if (c == ')' && --depth == 0) {
+      break;
+    }
+  }
+  return i;
+}
+
+// Parse the tag pair starting at `i`, e.g. [Event "Casual game"], and skip past
+// the end of its line.
+size_t parseTag(std::string_view pgn, size_t i, GameReplayer* game) {
+  size_t line_end = skipLine(pgn, i);
+  std::string_view line = pgn.substr(i + 1, line_end - i - 1);
+  size_t name_end = line.find_first_of(" \t]");
+  size_t value_start = line.find('"');
+  size_t value_end = line.rfind('"');
+  if (name_end != std::string_view::npos && value_start != value_end &&
+      value_end != std::string_view::npos) {
+    game->Tag(line.substr(0, name_end),
+              line.substr(value_start + 1, value_end - value_start - 1));
+  }
+  return line_end;
+}
+
+// Find the start of the first game's tags at or after `from`, which is a '['
+// at the start of a line that follows a blank line. Returns the size of the
+// PGN if there is none.
+size_t nextGameStart(std::string_view pgn, size_t from) {
+  while (true) {
+    size_t i = pgn.find("\n[", from);
+    if (i == std::string_view::npos) {
+      return pgn.size();
+    }
+    size_t line_end = i;
+    if (line_end > 0 && pgn[line_end - 1] == '\r') {
+      line_end--;
+    }
+    if (line_end > 0 && pgn[line_end - 1] == '\n') {
+      return i + 1;
+    }
+    from = i + 1;
+  }
+}
+
+// A file's contents, memory mapped if possible, otherwise read into memory.
+class FileContents {
+ public:
+  ~FileContents() {
+    if (mapped_ != nullptr) {
+      munmap(mapped_, size_);
+    }
+  }
+
+  // Returns 0 on success, or 1 if the file can't be read.
+  int Open(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      struct stat st;
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* mapped =
+            mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+          madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+          mapped_ = mapped;
+          size_ = st.st_size;
+          close(fd);
+          return 0;
+        }
+      }
+      close(fd);
+    }
+
+    std::ifstream input(path, std::ios::binary);
+    if (!input.good()) {
+      return 1;
+    }
+    std::ostringstream contents;
+    contents << input.rdbuf();
+    contents_ = contents.str();
+    return 0;
+  }
+
+  std::string_view Contents() const {
+    if (mapped_ != nullptr) {
+      return std::string_view(static_cast<const char*>(mapped_), size_);
+    }
+    return contents_;
+  }
+
+ private:
+  void* mapped_ = nullptr;
+  size_t size_ = 0;
+  std::string contents_;
+};
+
+}  // namespace
+
+int sanToUci(const Position& p, const LegalMoves& legal_moves,
+             std::string_view san, std::string* uci) {
+  // Strip check, checkmate and annotation suffixes.
+  while (!san.empty() && (san.back() == '+' || san.back() == '#' ||
+                          san.back() == '!' || san.back() == '?')) {
+    san.remove_suffix(1);
+  }
+
+  int back_rank = p.active_color == WHITE ? 1 : 8;
+  if (san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0") {
+    Square from(back_rank, 5);
+    Square to(back_rank, san.size() == 3 ? 7 : 3);
+    ColoredPiece king = p.active_color == WHITE ? WKING : BKING;
+    if (!legal_moves.IsLegal(PieceOnSquare(king, from), to)) {
+      return 1;
+    }
+    *uci = from.Algebraic() + to.Algebraic();
+    return 0;
+  }
+
+  size_t start = 0;
+  Piece piece = PAWN;
+  if (!san.empty()) {
+    switch (san[0]) {
+      case 'N':
+        piece = KNIGHT;
+        break;
+      case 'B':
+        piece = BISHOP;
+        break;
+      case 'R':
+        piece = ROOK;
+        break;
+      case 'Q':
+        piece = QUEEN;
+        break;
+      case 'K':
+        piece = KING;
+        break;
+    }
+    start = piece == PAWN ? 0 : 1;
+  }
+
+  Piece promote_to = PAWN;
+  if (piece == PAWN && !san.empty() &&
+      std::string_view("NBRQ").find(san.back()) != std::string_view::npos) {
+    promote_to = parsePromotion(san.back());
+    san.remove_suffix(1);
+    if (!san.empty() && san.back() == '=') {
+      san.remove_suffix(1);
+    }
+  }
+
+  if (san.size() < start + 2) {
+    return 1;
+  }
+  char to_file = san[san.size() - 2];
+  char to_rank = san[san.size() - 1];
+  if (to_file < 'a' || to_file > 'h' || to_rank < '1' || to_rank > '8') {
+    return 1;
+  }
+  Square to(to_rank - '0', to_file - 'a' + 1);
+
+  // Optional disambiguation of the piece's file and/or rank, and capture.
+  int from_file = 0;
+  int from_rank = 0;
+  for (size_t i = start; i < san.size() - 2; i++) {
+    char c = san[i];
+    if (c >= 'a' && c <= 'h') {
+      from_file = c - 'a' + 1;
+    } else if (c >= '1' && c <= '8') {
+      from_rank = c - '0';
+    } else if (c != 'x') {
+      return 1;
+    }
+  }
+
+  ColoredPiece colored_piece =
+      static_cast<ColoredPiece>(piece + (p.active_color == WHITE ? 0 : 6));
+  int matches = 0;
+  for (const auto& [piece_and_square, move_squares] : legal_moves.Moves()) {
+    const Square& from = piece_and_square.square;
+    if (piece_and_square.piece != colored_piece ||
+        (from_file != 0 && from.File() != from_file) ||
+        (from_rank != 0 && from.Rank() != from_rank)) {
+      continue;
+    }
+    for (const PieceMove& move_square : move_squares) {
+      if (move_square.square == to && move_square.promote_to == promote_to) {
+        *uci = from.Algebraic() + move_square.Algebraic();
+        matches++;
+      }
+    }
+  }
+  return matches == 1 ? 0 : 1;
+}
+
+void PgnReplayStats::Add(const PgnReplayStats& other) {
+  games += other.games;
+  positions += other.positions;
+  errors += other.errors;
+  seconds += other.seconds;
+}
+
+PgnReplayStats replayPgn(std::string_view pgn,
+                         const PgnPositionCallback& callback) {
+  const auto start = std::chrono::steady_clock::now();
+  PgnReplayStats stats;
+  GameReplayer game(callback, &stats);
+
+  size_t i = 0;
+  const size_t n = pgn.size();
+  while (i < n) {
+    char c = pgn[i];
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      i++;
+      continue;
+    }
+    if (c == '[') {
+      i = parseTag(pgn, i, &game);
+      continue;
+    }
+    if (c == '{') {
+      i = skipComment(pgn, i);
+      continue;
+    }
+    if (c == ';' || (c == '%' && (i == 0 || pgn[i - 1] == '\n'))) {
+      i = skipLine(pgn, i);
+      continue;
+    }
+    if (c == '(') {
+      i = skipVariation(pgn, i);
+      continue;
+    }
+
+    size_t token_start = i;
+    if (isDelimiter(c)) {
+      // A stray ')', '}' or ']'.
+      i++;
+      continue;
+    }
+    while (i < n && !isDelimiter(pgn[i])) {
+      i++;
+    }
+    std::string_view token = pgn.substr(token_start, i - token_start);
+
+    if (isResult(token)) {
+      game.End();
+      continue;
+    }
+    if (token[0] == '$') {
+      // Numeric annotation glyph.
+      continue;
+    }
+    if (token[0] >= '1' && token[0] <= '9') {
+      // Move number indication, which may run into the move, e.g. "12.Nf3".
+      size_t move_start = token.find_first_not_of("0123456789");
+      if (move_start == std::string_view::npos) {
+        continue;
+      }
+      move_start = token.find_first_not_of('.', move_start);
+      if (move_start == std::string_view::npos) {
+        continue;
+      }
+      token.remove_prefix(move_start);
+    }
+    game.Move(token);
+  }
+  game.End();
+
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return stats;
+}
+
+int replayPgnFile(const std::string& path, int threads,
+                  const PgnPositionCallback& callback, PgnReplayStats* stats) {
+  const auto start = std::chrono::steady_clock::now();
+  FileContents file;
+  if (file.Open(path) != 0) {
+    return 1;
+  }
+  std::string_view pgn = file.Contents();
+
+  threads = std::max(threads, 1);
+  const size_t num_chunks = static_cast<size_t>(threads) * CHUNKS_PER_THREAD;
+  std::vector<size_t> chunk_starts = {0};
+  for (size_t chunk = 1; chunk < num_chunks; chunk++) {
+    size_t chunk_start = nextGameStart(pgn, pgn.size() / num_chunks * chunk);
+    if (chunk_start > chunk_starts.back() && chunk_start < pgn.size()) {
+      chunk_starts.push_back(chunk_start);
+    }
+  }
+  chunk_starts.push_back(pgn.size());
+
+  std::atomic<size_t> next_chunk{0};
+  std::vector<PgnReplayStats> thread_stats(threads);
+  std::vector<std::thread> workers;
+  for (int thread = 0; thread < threads; thread++) {
+    workers.emplace_back([&, thread]() {
+      size_t chunk;
+      while ((chunk = next_chunk.fetch_add(1)) + 1 < chunk_starts.size()) {
+        thread_stats[thread].Add(replayPgn(
+            pgn.substr(chunk_starts[chunk],
+                       chunk_starts[chunk + 1] - chunk_starts[chunk]),
+            callback));
+      }
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+
+  *stats = PgnReplayStats();
+  for (const PgnReplayStats& s : thread_stats) {
+    stats->Add(s);
+  }
+  stats->seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  return 0;
+}
+
+}  // namespace habits
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "moves.hpp"
+#include "position.hpp"
+
+namespace habits {
+
+// Convert a move in Standard Algebraic Notation (e.g. "Nbd7", "exd8=Q+",
+// "O-O") to UCI notation, by matching it against the legal moves of the
+// position. Returns 0 on success, or 1 if the move is malformed, illegal or
+// ambiguous.
+int sanToUci(const Position& p, const LegalMoves& legal_moves,
+             std::string_view san, std::string* uci);
+
+// Called for each position of a replayed game: the position, the number of
+// halfmoves played in the game to reach it (0 at the start of each game), and
+// the move in UCI notation that was played from it (empty at the end of the
+// game).
+using PgnPositionCallback = std::function<void(
+    const Position& p, int ply, const std::string& move)>;
+
+// Counts from replaying PGN games.
+struct PgnReplayStats {
+  uint64_t games = 0;
+  uint64_t positions = 0;
+  // Games that were abandoned on a move that couldn't be replayed. The
+  // positions before the bad move are still counted and passed on.
+  uint64_t errors = 0;
+  double seconds = 0.0;
+
+  double GamesPerSecond() const {
+    return seconds > 0.0 ? games / seconds : 0.0;
+  }
+
+  void Add(const PgnReplayStats& other);
+};
+
+// Replay all the games in PGN text, starting from the position in each game's
+// FEN tag if it has one. Comments, variations and annotations are skipped.
+PgnReplayStats replayPgn(std::string_view pgn,
+                         const PgnPositionCallback& callback);
+
+// Replay all the games in a PGN file, which is memory mapped (or read in if it
+// can't be) and split into chunks of whole games that are replayed on
+// `threads` threads. The callback is called concurrently from the threads,
+// and each game's positions are passed to it in order from a single thread.
+// Returns 0 on success, or 1 if the file can't be read.
+int replayPgnFile(const std::string& path, int threads,
+                  const PgnPositionCallback& callback, PgnReplayStats* stats);
+
+}  // namespace habits
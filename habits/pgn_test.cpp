@@ -0,0 +1,187 @@
+#include "pgn.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "moves.hpp"
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+std::string toUci(const std::string& fen, const std::string& san) {
+  Position p = Position::FromFen(fen);
+  std::string uci;
+  if (sanToUci(p, LegalMoves(p), san, &uci) != 0) {
+    return "error";
+  }
+  return uci;
+}
+
+TEST(PgnTest, SanToUci) {
+  const std::string start =
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+  EXPECT_EQ(toUci(start, "e4"), "e2e4");
+  EXPECT_EQ(toUci(start, "Nf3"), "g1f3");
+  EXPECT_EQ(toUci(start, "Nf3+"), "g1f3");
+  EXPECT_EQ(toUci(start, "Nf3!?"), "g1f3");
+  EXPECT_EQ(toUci(start, "e5"), "error");
+  EXPECT_EQ(toUci(start, "Ne2"), "error");
+  EXPECT_EQ(toUci(start, "Qd4"), "error");
+  EXPECT_EQ(toUci(start, "O-O"), "error");
+  EXPECT_EQ(toUci(start, "Z"), "error");
+  EXPECT_EQ(toUci(start, ""), "error");
+
+  const std::string castling = "r3k2r/8/8/8/8/8/8/R3K2R b KQkq - 0 1";
+  EXPECT_EQ(toUci(castling, "O-O"), "e8g8");
+  EXPECT_EQ(toUci(castling, "O-O-O"), "e8c8");
+  EXPECT_EQ(toUci(castling, "0-0-0"), "e8c8");
+  EXPECT_EQ(toUci(castling, "Rxa1"), "a8a1");
+}
+
+TEST(PgnTest, SanToUciDisambiguation) {
+  const std::string fen = "4k3/8/8/8/1N3N2/8/4K3/R6R w - - 0 1";
+  EXPECT_EQ(toUci(fen, "Nd3"), "error");
+  EXPECT_EQ(toUci(fen, "Nbd3"), "b4d3");
+  EXPECT_EQ(toUci(fen, "Nfd3"), "f4d3");
+  EXPECT_EQ(toUci(fen, "Rd1"), "error");
+  EXPECT_EQ(toUci(fen, "Rad1"), "a1d1");
+  EXPECT_EQ(toUci(fen, "Ra1d1"), "a1d1");
+  EXPECT_EQ(toUci(fen, "Rh2"), "h1h2");
+}
+
+TEST(PgnTest, SanToUciPawns) {
+  EXPECT_EQ(toUci("4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 1", "exd6"), "e5d6");
+  EXPECT_EQ(toUci("3r1k2/4P3/8/8/8/8/8/4K3 w - - 0 1", "e8=Q+"), "e7e8q");
+  EXPECT_EQ(toUci("3r1k2/4P3/8/8/8/8/8/4K3 w - - 0 1", "exd8N"), "e7d8n");
+  EXPECT_EQ(toUci("3r1k2/4P3/8/8/8/8/8/4K3 w - - 0 1", "exd8"), "error");
+}
+
+struct Replayed {
+  std::string fen;
+  int ply;
+  std::string move;
+};
+
+std::vector<Replayed> replay(const std::string& pgn, PgnReplayStats* stats) {
+  std::vector<Replayed> replayed;
+  *stats = replayPgn(pgn, [&](const Position& p, int ply,
+                              const std::string& move) {
+    replayed.push_back({p.ToFen(), ply, move});
+  });
+  return replayed;
+}
+
+TEST(PgnTest, ReplayPgn) {
+  const std::string pgn = R"([Event "Casual game"]
+[White "A"]
+[Black "B"]
+[Result "1-0"]
+
+1. e4 {A comment (with parens)} e5 2. Nf3 (2. f4 exf4 (2... d5) 3. Nf3) Nc6
+$1 3.Bb5 ; Ruy Lopez
+a6 1-0
+
+[Event "From a position"]
+[SetUp "1"]
+[FEN "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1"]
+
+1. e4 Kd7 *
+)";
+  PgnReplayStats stats;
+  std::vector<Replayed> replayed = replay(pgn, &stats);
+  EXPECT_EQ(stats.games, 2);
+  EXPECT_EQ(stats.positions, 10);
+  EXPECT_EQ(stats.errors, 0);
+
+  std::vector<std::string> moves;
+  for (const Replayed& r : replayed) {
+    moves.push_back(r.move);
+  }
+  EXPECT_THAT(moves,
+              testing::ElementsAre("e2e4", "e7e5", "g1f3", "b8c6", "f1b5",
+                                   "a7a6", "", "e2e4", "e8d7", ""));
+  EXPECT_EQ(replayed[0].ply, 0);
+  EXPECT_EQ(replayed[6].ply, 6);
+  EXPECT_EQ(replayed[6].fen,
+            "r1bqkbnr/1ppp1ppp/p1n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R w KQkq - "
+            "0 4");
+  EXPECT_EQ(replayed[7].ply, 0);
+  EXPECT_EQ(replayed[7].fen, "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1");
+}
+
+TEST(PgnTest, ReplayPgnErrors) {
+  const std::string pgn = R"([Event "Illegal move"]
+
+1. e4 e5 2. Ke3 Nc6 1-0
+
+[Event "Bad FEN"]
+[FEN "not a fen"]
+
+1. e4 *
+
+[Event "No result"]
+
+1. d4 d5
+
+[Event "Next"]
+
+1. c4 *
+)";
+  PgnReplayStats stats;
+  std::vector<Replayed> replayed = replay(pgn, &stats);
+  EXPECT_EQ(stats.games, 4);
+  EXPECT_EQ(stats.errors, 2);
+  // The positions before the illegal move, and all the positions of the last
+  // two games.
+  EXPECT_EQ(stats.positions, 7);
+  EXPECT_EQ(replayed[1].move, "e7e5");
+  EXPECT_EQ(replayed[2].move, "d2d4");
+}
+
+TEST(PgnTest, ReplayPgnFile) {
+  std::string path = testing::TempDir() + "pgn_test.pgn";
+  {
+    std::ofstream f(path);
+    for (int game = 0; game < 200; game++) {
+      f << "[Event \"Game " << game << "\"]\n\n"
+        << "1. e4 e5 2. Nf3 Nc6 3. Bc4 Bc5 1/2-1/2\n\n";
+    }
+  }
+
+  std::mutex mutex;
+  int final_positions = 0;
+  PgnReplayStats stats;
+  ASSERT_EQ(replayPgnFile(path, 4,
+                          [&](const Position&, int ply,
+                              const std::string& move) {
+                            if (move.empty()) {
+                              std::lock_guard<std::mutex> lock(mutex);
+                              EXPECT_EQ(ply, 6);
+                              final_positions++;
+                            }
+                          },
+                          &stats),
+            0);
+  EXPECT_EQ(stats.games, 200);
+  EXPECT_EQ(stats.positions, 200 * 7);
+  EXPECT_EQ(stats.errors, 0);
+  EXPECT_EQ(final_positions, 200);
+  EXPECT_GT(stats.GamesPerSecond(), 0.0);
+  std::remove(path.c_str());
+
+  EXPECT_EQ(replayPgnFile(path, 4, [](const Position&, int,
+                                      const std::string&) {},
+                          &stats),
+            1);
+}
+
+}  // namespace
+}  // namespace habits
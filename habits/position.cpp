@@ -2,6 +2,8 @@
 
 #include <bitset>
 #include <cctype>
+#include <charconv>
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <string>
@@ -13,6 +15,80 @@ namespace {
 
 constexpr std::string_view FEN_PIECES = "PNBRQKpnbrqk";
 
+// Lookup from a FEN character to its ColoredPiece, -1 for other characters.
+struct FenPieceTable {
+  int8_t pieces[256];
+
+  constexpr FenPieceTable() : pieces() {
+    for (int c = 0; c < 256; c++) {
+      pieces[c] = -1;
+    }
+    for (size_t piece = 0; piece < FEN_PIECES.size(); piece++) {
+      pieces[static_cast<unsigned char>(FEN_PIECES[piece])] = piece;
+    }
+  }
+
+  int Find(char c) const { return pieces[static_cast<unsigned char>(c)]; }
+};
+
+constexpr FenPieceTable FEN_PIECE_TABLE;
+
+// Random keys for Zobrist hashing of positions, generated with splitmix64 so
+// hashes are stable across builds.
+struct ZobristKeys {
+  uint64_t pieces[12][64];
+  uint64_t black_to_move;
+  uint64_t castling[16];
+  uint64_t en_passant_files[8];
+
+  constexpr ZobristKeys()
+      : pieces(), black_to_move(), castling(), en_passant_files() {
+    uint64_t state = 0x6861626974730000ull;
+    for (int piece = 0; piece < 12; piece++) {
+      for (int index = 0; index < 64; index++) {
+        pieces[piece][index] = next(&state);
+      }
+    }
+    black_to_move = next(&state);
+    for (int castles = 0; castles < 16; castles++) {
+      castling[castles] = next(&state);
+    }
+    for (int file = 0; file < 8; file++) {
+      en_passant_files[file] = next(&state);
+    }
+  }
+
+  static constexpr uint64_t next(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+};
+
+constexpr ZobristKeys ZOBRIST_KEYS;
+
+// Parse a halfmove clock or fullmove number of up to 5 digits from the FEN at
+// `*i`, advancing it to the next space (or the end). Returns -1 if the number
+// is missing or invalid.
+int parseClock(std::string_view fen, size_t* i) {
+  int value = 0;
+  int digits = 0;
+  while (*i < fen.size() && fen[*i] != ' ') {
+    char c = fen[*i];
+    if (c < '0' || c > '9' || digits == 5) {
+      return -1;
+    }
+    value = value * 10 + c - '0';
+    digits++;
+    (*i)++;
+  }
+  if (digits == 0 || value > 65535) {
+    return -1;
+  }
+  return value;
+}
+
 }  // namespace
 
 std::string Square::Algebraic() const {
@@ -46,167 +122,283 @@ bool Position::IsDraw() const {
   return true;
 }
 
-Position Position::FromFen(std::string_view fen) {
-  Position p;
-  auto it = fen.begin();
-  int rank = 8;
-  int file = 1;
-  char c;
-  while (it != fen.end()) {
-    if (file > 8) {
-      file = 1;
-      rank--;
+uint64_t Position::Hash() const {
+  uint64_t hash = ZOBRIST_KEYS.castling[castling & 0xf];
+  for (int piece = WPAWN; piece <= BKING; piece++) {
+    for (Square square : Squares(bitboards[piece])) {
+      hash ^= ZOBRIST_KEYS.pieces[piece][square.index];
     }
+  }
+  if (active_color == BLACK) {
+    hash ^= ZOBRIST_KEYS.black_to_move;
+  }
+  if (en_passant_target_square.IsSet()) {
+    hash ^= ZOBRIST_KEYS.en_passant_files[en_passant_target_square.File() - 1];
+  }
+  return hash;
+}
 
-    c = *it;
-    it++;
+const char* fenErrorName(FenError error) {
+  switch (error) {
+    case FEN_OK:
+      return "ok";
+    case FEN_BAD_BOARD:
+      return "invalid piece placement";
+    case FEN_BAD_ACTIVE_COLOR:
+      return "invalid active color";
+    case FEN_BAD_CASTLING:
+      return "invalid castling availability";
+    case FEN_BAD_EN_PASSANT:
+      return "invalid en passant target square";
+    case FEN_BAD_HALFMOVE_CLOCK:
+      return "invalid halfmove clock";
+    case FEN_BAD_FULLMOVE_NUMBER:
+      return "invalid fullmove number";
+    case FEN_TRAILING_CHARACTERS:
+      return "unexpected characters after the fullmove number";
+  }
+  return "unknown error";
+}
 
-    if (c == ' ') {
-      break;
-    }
+FenError Position::ParseFen(std::string_view fen, Position* p) {
+  *p = Position();
+  const size_t n = fen.size();
+  size_t i = 0;
 
-    if (c >= '1' && c <= '8') {
-      file += c - '0';
-      continue;
+  // Piece placement, from rank 8 down to rank 1.
+  for (int rank = 8; rank >= 1; rank--) {
+    int file = 1;
+    bool previous_digit = false;
+    while (i < n && fen[i] != '/' && fen[i] != ' ') {
+      char c = fen[i++];
+      if (c >= '1' && c <= '8') {
+        if (previous_digit) {
+          return FEN_BAD_BOARD;
+        }
+        file += c - '0';
+        previous_digit = true;
+      } else {
+        int piece = FEN_PIECE_TABLE.Find(c);
+        if (piece < 0 || file > 8) {
+          return FEN_BAD_BOARD;
+        }
+        if (piece % 6 == PAWN && (rank == 1 || rank == 8)) {
+          return FEN_BAD_BOARD;
+        }
+        p->bitboards[piece] |= 1ull << ((rank - 1) * 8 + file - 1);
+        file++;
+        previous_digit = false;
+      }
+      if (file > 9) {
+        return FEN_BAD_BOARD;
+      }
     }
-    if (c == '/') {
-      continue;
+    if (file != 9) {
+      return FEN_BAD_BOARD;
+    }
+    if (rank > 1) {
+      if (i >= n || fen[i] != '/') {
+        return FEN_BAD_BOARD;
+      }
+      i++;
     }
-
-    int piece = FEN_PIECES.find(c);
-    int i = (rank - 1) * 8 + file - 1;
-    p.bitboards[piece] = p.bitboards[piece] | (1ull << i);
-    file++;
   }
-
-  c = *it;
-  it++;
-  if (c == 'w') {
-    p.active_color = WHITE;
-  } else {
-    p.active_color = BLACK;
+  if (i >= n) {
+    return FEN_BAD_ACTIVE_COLOR;
   }
-  it++;
+  if (fen[i] != ' ') {
+    return FEN_BAD_BOARD;
+  }
+  i++;
 
-  while (it != fen.end()) {
-    c = *it;
-    it++;
+  // Active color.
+  if (i >= n || (fen[i] != 'w' && fen[i] != 'b')) {
+    return FEN_BAD_ACTIVE_COLOR;
+  }
+  p->active_color = fen[i] == 'w' ? WHITE : BLACK;
+  i++;
+  if (i < n && fen[i] != ' ') {
+    return FEN_BAD_ACTIVE_COLOR;
+  }
+  if (i >= n) {
+    return FEN_BAD_CASTLING;
+  }
+  i++;
 
-    if (c == ' ') {
-      break;
+  // Castling availability.
+  if (i < n && fen[i] == '-') {
+    i++;
+  } else {
+    size_t start = i;
+    while (i < n && fen[i] != ' ') {
+      ColoredCastle castle;
+      switch (fen[i]) {
+        case 'K':
+          castle = WOO;
+          break;
+        case 'Q':
+          castle = WOOO;
+          break;
+        case 'k':
+          castle = BOO;
+          break;
+        case 'q':
+          castle = BOOO;
+          break;
+        default:
+          return FEN_BAD_CASTLING;
+      }
+      if (p->CanCastle(castle)) {
+        return FEN_BAD_CASTLING;
+      }
+      p->SetCastle(castle, true);
+      i++;
     }
-
-    switch (c) {
-      case 'K':
-        p.castling[WOO] = true;
-        break;
-      case 'Q':
-        p.castling[WOOO] = true;
-        break;
-      case 'k':
-        p.castling[BOO] = true;
-        break;
-      case 'q':
-        p.castling[BOOO] = true;
-        break;
+    if (i == start) {
+      return FEN_BAD_CASTLING;
     }
   }
-
-  c = *it;
-  it++;
-  if (c != '-') {
-    int file = c - 'a' + 1;
-    c = *it;
-    it++;
-    int rank = c - '1' + 1;
-    p.en_passant_target_square = Square(rank, file);
+  if (i < n && fen[i] != ' ') {
+    return FEN_BAD_CASTLING;
+  }
+  if (i >= n) {
+    return FEN_BAD_EN_PASSANT;
   }
+  i++;
 
-  it++;
-  while (it != fen.end()) {
-    c = *it;
-    it++;
-    if (c == ' ') {
-      break;
+  // En passant target square. Only its rank is validated (the 6th with White
+  // to move, the 3rd with Black), not that a pawn just moved two squares past
+  // it.
+  if (i < n && fen[i] == '-') {
+    i++;
+  } else {
+    char en_passant_rank = p->active_color == WHITE ? '6' : '3';
+    if (i + 1 >= n || fen[i] < 'a' || fen[i] > 'h' ||
+        fen[i + 1] != en_passant_rank) {
+      return FEN_BAD_EN_PASSANT;
     }
-    p.halfmove_clock = p.halfmove_clock * 10 + c - '0';
+    p->en_passant_target_square = Square(fen[i + 1] - '0', fen[i] - 'a' + 1);
+    i += 2;
+  }
+  if (i >= n) {
+    // No halfmove clock or fullmove number.
+    p->halfmove_clock = 0;
+    p->fullmove_number = 1;
+    return FEN_OK;
+  }
+  if (fen[i] != ' ') {
+    return FEN_BAD_EN_PASSANT;
   }
+  i++;
 
-  while (it != fen.end()) {
-    c = *it;
-    it++;
-    if (c == ' ') {
-      break;
-    }
-    p.fullmove_number = p.fullmove_number * 10 + c - '0';
+  int halfmove_clock = parseClock(fen, &i);
+  if (halfmove_clock < 0) {
+    return FEN_BAD_HALFMOVE_CLOCK;
+  }
+  p->halfmove_clock = halfmove_clock;
+  if (i >= n) {
+    return FEN_BAD_FULLMOVE_NUMBER;
+  }
+  i++;
+
+  int fullmove_number = parseClock(fen, &i);
+  if (fullmove_number < 1) {
+    return FEN_BAD_FULLMOVE_NUMBER;
+  }
+  p->fullmove_number = fullmove_number;
+  if (i != n) {
+    return FEN_TRAILING_CHARACTERS;
   }
+  return FEN_OK;
+}
 
+Position Position::FromFen(std::string_view fen) {
+  Position p;
+  if (ParseFen(fen, &p) != FEN_OK) {
+    return Position();
+  }
   return p;
 }
 
-std::string Position::ToFen() const {
-  std::string fen = "";
+size_t Position::WriteFen(char* buffer, size_t size) const {
+  if (size < FEN_BUFFER_SIZE) {
+    return 0;
+  }
+
+  // Put the pieces on the squares first, so the ranks can be written in a
+  // single pass. Lower pieces take precedence if boards overlap.
+  char board[64] = {0};
+  for (int piece = 11; piece >= 0; piece--) {
+    for (Square square : Squares(bitboards[piece])) {
+      board[square.index] = FEN_PIECES[piece];
+    }
+  }
+
+  char* out = buffer;
   for (int rank = 8; rank >= 1; rank--) {
-    int empty_files = 0;
-    for (int file = 1; file <= 8; file++) {
-      int i = (rank - 1) * 8 + file - 1;
-      bool found = false;
-      for (int piece = 0; piece < 12; piece++) {
-        if (bitboards[piece] & (1ull << i)) {
-          found = true;
-          if (empty_files > 0) {
-            fen += std::to_string(empty_files);
-          }
-          fen += FEN_PIECES[piece];
-          empty_files = 0;
-          break;
-        }
-      }
-      if (!found) {
+    char empty_files = 0;
+    for (int i = (rank - 1) * 8; i < rank * 8; i++) {
+      if (board[i] == 0) {
         empty_files++;
+        continue;
+      }
+      if (empty_files > 0) {
+        *out++ = '0' + empty_files;
+        empty_files = 0;
       }
+      *out++ = board[i];
     }
     if (empty_files > 0) {
-      fen += std::to_string(empty_files);
+      *out++ = '0' + empty_files;
     }
     if (rank > 1) {
-      fen += '/';
+      *out++ = '/';
     }
   }
 
-  fen += ' ';
-  fen += active_color == WHITE ? 'w' : 'b';
+  *out++ = ' ';
+  *out++ = active_color == WHITE ? 'w' : 'b';
 
-  std::string castling_string = "";
-  if (castling[0]) {
-    castling_string += 'K';
+  *out++ = ' ';
+  char* castling_start = out;
+  if (CanCastle(WOO)) {
+    *out++ = 'K';
   }
-  if (castling[1]) {
-    castling_string += 'Q';
+  if (CanCastle(WOOO)) {
+    *out++ = 'Q';
   }
-  if (castling[2]) {
-    castling_string += 'k';
+  if (CanCastle(BOO)) {
+    *out++ = 'k';
   }
-  if (castling[3]) {
-    castling_string += 'q';
+  if (CanCastle(BOOO)) {
+    *out++ = 'q';
   }
-  if (castling_string.empty()) {
-    fen += " -";
-  } else {
-    fen += " " + castling_string;
+  if (out == castling_start) {
+    *out++ = '-';
   }
 
+  *out++ = ' ';
   if (en_passant_target_square.IsSet()) {
-    fen += ' ';
-    fen += en_passant_target_square.Algebraic();
+    *out++ = 'a' + en_passant_target_square.index % 8;
+    *out++ = '1' + en_passant_target_square.index / 8;
   } else {
-    fen += " -";
+    *out++ = '-';
   }
 
-  fen += " " + std::to_string(halfmove_clock);
-  fen += " " + std::to_string(fullmove_number);
+  char* end = buffer + size - 1;
+  *out++ = ' ';
+  out = std::to_chars(out, end, halfmove_clock).ptr;
+  *out++ = ' ';
+  out = std::to_chars(out, end, fullmove_number).ptr;
+  *out = '\0';
 
-  return fen;
+  return out - buffer;
+}
+
+std::string Position::ToFen() const {
+  char buffer[FEN_BUFFER_SIZE];
+  size_t length = WriteFen(buffer, sizeof(buffer));
+  return std::string(buffer, length);
 }
 
 Position Position::ForOpponent() const {
@@ -216,20 +408,4 @@ Position Position::ForOpponent() const {
   return p;
 }
 
-Position Position::Duplicate() const {
-  Position p;
-  p.active_color = active_color;
-  for (int piece = 0; piece < 12; piece++) {
-    p.bitboards[piece] = bitboards[piece];
-  }
-  p.castling[0] = castling[0];
-  p.castling[1] = castling[1];
-  p.castling[2] = castling[2];
-  p.castling[3] = castling[3];
-  p.en_passant_target_square = en_passant_target_square;
-  p.halfmove_clock = halfmove_clock;
-  p.fullmove_number = fullmove_number;
-  return p;
-}
-
 }  // namespace habits
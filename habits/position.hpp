@@ -1,8 +1,10 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <string_view>
+#include <type_traits>
 
 namespace habits {
 
@@ -15,7 +17,7 @@ enum Piece : int {
   KING = 5,
 };
 
-enum Color : int {
+enum Color : int8_t {
   WHITE = 1,
   BLACK = -1,
 };
@@ -52,7 +54,7 @@ struct Square {
   // The index of the square, starting at 0 for the bottome right (white's
   // Queen-side Rook's square) to 63 in the top left (black's King-side Rook's
   // square).
-  int index;
+  int8_t index;
 
   // Create a Square initialized to a square on a board;
   Square(int index) : index(index) {}
@@ -90,16 +92,6 @@ struct Square {
   // Get the algebraic notation (e.g. "e4") for a square.
   std::string Algebraic() const;
 
-  // Advance to the next square on the board, returns true if there is a next
-  // square. Calling this on the unitialized Square advances to the 0 square.
-  bool Next() {
-    if (index >= 63) {
-      return false;
-    }
-    index++;
-    return true;
-  }
-
   bool operator<(const Square& other) const {
     return index < other.index;
   }
@@ -113,43 +105,138 @@ struct Square {
   }
 };
 
+// The squares that are set in a bitboard, for iterating over in a range-based
+// for loop from the lowest index to the highest:
+//
+//   for (Square square : Squares(board)) { ... }
+//
+// Each step pops the lowest set bit, so the cost depends on the number of
+// squares set rather than the 64 squares of the board.
+class Squares {
+ public:
+  class Iterator {
+   public:
+    explicit Iterator(uint64_t board) : board_(board) {}
+
+    Square operator*() const { return Square(__builtin_ctzll(board_)); }
+
+    Iterator& operator++() {
+      board_ &= board_ - 1;
+      return *this;
+    }
+
+    bool operator!=(const Iterator& other) const {
+      return board_ != other.board_;
+    }
+
+   private:
+    uint64_t board_;
+  };
+
+  explicit Squares(uint64_t board) : board_(board) {}
+
+  Iterator begin() const { return Iterator(board_); }
+  Iterator end() const { return Iterator(0ull); }
+
+ private:
+  uint64_t board_;
+};
+
 // Parse a promotion character from UCI move notation.
 Piece parsePromotion(char promotion);
 // Convert a piece to a promotion character in UCI move notation.
 char toPromotion(Piece piece);
 
-struct Position {
+// The result of parsing a FEN string.
+enum FenError : int {
+  FEN_OK = 0,
+  FEN_BAD_BOARD,
+  FEN_BAD_ACTIVE_COLOR,
+  FEN_BAD_CASTLING,
+  FEN_BAD_EN_PASSANT,
+  FEN_BAD_HALFMOVE_CLOCK,
+  FEN_BAD_FULLMOVE_NUMBER,
+  FEN_TRAILING_CHARACTERS,
+};
+
+// A short human readable description of the FEN error.
+const char* fenErrorName(FenError error);
+
+// The size of a buffer that can hold any FEN string written by
+// Position::WriteFen, including the terminating null character.
+constexpr size_t FEN_BUFFER_SIZE = 128;
+
+// Positions are copied for every move that is tried, so they are kept small
+// enough to fit in two cache lines, and can be copied with a memcpy.
+struct alignas(64) Position {
   // Boards representing the current positions of all pieces of each
   // ColoredPiece.
   uint64_t bitboards[12] = {0ull};
   // The current active color in this position.
   Color active_color = WHITE;
-  // Castling availability for each ColoredCastle.
-  bool castling[4] = {false};
+  // Castling availability, a bit for each ColoredCastle. See CanCastle().
+  uint8_t castling = 0;
   // The square that a pawn passed over in the previous move, that can be the
   // target of en passant. Initially unset.
   Square en_passant_target_square;
   // The number of halfmoves since the last capture or pawn advance.
-  int halfmove_clock = 0;
+  uint16_t halfmove_clock = 0;
   // The number of full moves, starting at 1, incrementing after Black's move.
-  int fullmove_number = 0;
+  uint16_t fullmove_number = 0;
+
+  // Whether castling is still available.
+  bool CanCastle(ColoredCastle castle) const {
+    return (castling & (1 << castle)) != 0;
+  }
+
+  // Set whether castling is still available.
+  void SetCastle(ColoredCastle castle, bool available) {
+    if (available) {
+      castling |= 1 << castle;
+    } else {
+      castling &= ~(1 << castle);
+    }
+  }
 
-  // Create a Position by parsing a FEN string:
+  // Parse and validate a FEN string into `p`:
   // https://en.wikipedia.org/wiki/Forsyth%E2%80%93Edwards_Notation
+  // The halfmove clock and fullmove number may be left out (as in EPD), they
+  // then default to 0 and 1. Returns FEN_OK, or the first error found in which
+  // case `p` is left partially filled in.
+  static FenError ParseFen(std::string_view fen, Position* p);
+
+  // Create a Position by parsing a FEN string, which must be valid. An invalid
+  // FEN string results in an empty board, use ParseFen to detect errors.
   static Position FromFen(std::string_view fen);
 
+  // Write the current Position as a null terminated FEN string into `buffer`,
+  // which must be at least FEN_BUFFER_SIZE long. Returns the length of the FEN
+  // string, or 0 if the buffer is too small.
+  size_t WriteFen(char* buffer, size_t size) const;
+
   // Convert the current Position into a FEN string.
   std::string ToFen() const;
 
   // Determine if the current position is drawn. Only 50-move rule and lack of
-  // mating material are considered, not stalemate.
+  // mating material are considered, not stalemate or repetition (see
+  // PositionHistory).
   bool IsDraw() const;
 
+  // A Zobrist hash of the pieces, active color, castling availability and en
+  // passant target square, which are the parts of the position that must match
+  // for it to count as a repetition. The clocks are not included.
+  uint64_t Hash() const;
+
   // Create a copy of this position, but with the opponent to move.
   Position ForOpponent() const;
 
   // Create a copy of this position.
-  Position Duplicate() const;
+  Position Duplicate() const { return *this; }
 };
 
+static_assert(sizeof(Position) == 128, "Position should fill 2 cache lines");
+static_assert(alignof(Position) == 64, "Position should be cache line aligned");
+static_assert(std::is_trivially_copyable_v<Position>,
+              "Position should be copyable with memcpy");
+
 }  // namespace habits
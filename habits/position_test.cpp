@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 
 #include <nlohmann/json.hpp>
+#include <vector>
 
 namespace habits {
 
@@ -27,6 +28,18 @@ TEST(PositionTest, ParseAlgebraicNotation) {
   EXPECT_EQ(Square("h8").index, 63);
 }
 
+TEST(PositionTest, IterateSquares) {
+  std::vector<int> indexes;
+  for (Square square : Squares((1ull << 3) | (1ull << 17) | (1ull << 63))) {
+    indexes.push_back(square.index);
+  }
+  EXPECT_THAT(indexes, testing::ElementsAre(3, 17, 63));
+
+  for (Square square : Squares(0ull)) {
+    ADD_FAILURE() << "Unexpected square " << square;
+  }
+}
+
 TEST(PositionTest, ParsePromotion) {
   EXPECT_EQ(parsePromotion('q'), QUEEN);
   EXPECT_EQ(parsePromotion('n'), KNIGHT);
@@ -43,10 +56,10 @@ TEST(PositionTest, FromFenStartPos) {
   EXPECT_EQ(p.bitboards[WKING], 1ull << 4);
   EXPECT_EQ(p.bitboards[BKING], 1ull << 60);
   EXPECT_EQ(p.active_color, WHITE);
-  EXPECT_EQ(p.castling[0], true);
-  EXPECT_EQ(p.castling[1], true);
-  EXPECT_EQ(p.castling[2], true);
-  EXPECT_EQ(p.castling[3], true);
+  EXPECT_EQ(p.CanCastle(WOO), true);
+  EXPECT_EQ(p.CanCastle(WOOO), true);
+  EXPECT_EQ(p.CanCastle(BOO), true);
+  EXPECT_EQ(p.CanCastle(BOOO), true);
   EXPECT_EQ(p.halfmove_clock, 0);
   EXPECT_EQ(p.fullmove_number, 1);
 }
@@ -59,14 +72,78 @@ TEST(PositionTest, FromFenWithSpaces) {
   EXPECT_EQ(p.bitboards[WKING], 0ull);
   EXPECT_EQ(p.bitboards[BKING], 0ull);
   EXPECT_EQ(p.active_color, BLACK);
-  EXPECT_EQ(p.castling[0], false);
-  EXPECT_EQ(p.castling[1], false);
-  EXPECT_EQ(p.castling[2], false);
-  EXPECT_EQ(p.castling[3], false);
+  EXPECT_EQ(p.CanCastle(WOO), false);
+  EXPECT_EQ(p.CanCastle(WOOO), false);
+  EXPECT_EQ(p.CanCastle(BOO), false);
+  EXPECT_EQ(p.CanCastle(BOOO), false);
   EXPECT_EQ(p.halfmove_clock, 56);
   EXPECT_EQ(p.fullmove_number, 199);
 }
 
+TEST(PositionTest, ParseFenWithoutClocks) {
+  Position p;
+  ASSERT_EQ(Position::ParseFen("8/8/8/8/4Pp2/8/8/8 b - e3", &p), FEN_OK);
+  EXPECT_EQ(p.en_passant_target_square, Square("e3"));
+  EXPECT_EQ(p.halfmove_clock, 0);
+  EXPECT_EQ(p.fullmove_number, 1);
+}
+
+TEST(PositionTest, ParseFenErrors) {
+  Position p;
+  EXPECT_EQ(Position::ParseFen("", &p), FEN_BAD_BOARD);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8 w - - 0 1", &p), FEN_BAD_BOARD);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8/8 w - - 0 1", &p),
+            FEN_BAD_BOARD);
+  EXPECT_EQ(Position::ParseFen("9/8/8/8/8/8/8/8 w - - 0 1", &p), FEN_BAD_BOARD);
+  EXPECT_EQ(Position::ParseFen("44/8/8/8/8/8/8/8 w - - 0 1", &p),
+            FEN_BAD_BOARD);
+  EXPECT_EQ(Position::ParseFen("7/8/8/8/8/8/8/8 w - - 0 1", &p), FEN_BAD_BOARD);
+  EXPECT_EQ(Position::ParseFen("ppppppppp/8/8/8/8/8/8/8 w - - 0 1", &p),
+            FEN_BAD_BOARD);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/7x w - - 0 1", &p),
+            FEN_BAD_BOARD);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/7P w - - 0 1", &p),
+            FEN_BAD_BOARD);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8", &p), FEN_BAD_ACTIVE_COLOR);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 x - - 0 1", &p),
+            FEN_BAD_ACTIVE_COLOR);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w", &p), FEN_BAD_CASTLING);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w KK - 0 1", &p),
+            FEN_BAD_CASTLING);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w KX - 0 1", &p),
+            FEN_BAD_CASTLING);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w -", &p), FEN_BAD_EN_PASSANT);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w - e3 0 1", &p),
+            FEN_BAD_EN_PASSANT);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w - i6 0 1", &p),
+            FEN_BAD_EN_PASSANT);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w - - x 1", &p),
+            FEN_BAD_HALFMOVE_CLOCK);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w - - 999999 1", &p),
+            FEN_BAD_HALFMOVE_CLOCK);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w - - 0", &p),
+            FEN_BAD_FULLMOVE_NUMBER);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w - - 0 0", &p),
+            FEN_BAD_FULLMOVE_NUMBER);
+  EXPECT_EQ(Position::ParseFen("8/8/8/8/8/8/8/8 w - - 0 1 ", &p),
+            FEN_TRAILING_CHARACTERS);
+
+  EXPECT_EQ(Position::FromFen("8/8/8/8/8/8/8/8 w KK - 0 1").ToFen(),
+            "8/8/8/8/8/8/8/8 w - - 0 0");
+}
+
+TEST(PositionTest, WriteFen) {
+  Position p = Position::FromFen(
+      "r3k2r/pbppqppp/np3n2/2b1p3/2B1P3/NP3N2/PBPPQPPP/R3K2R b Kq e3 12 345");
+  char buffer[FEN_BUFFER_SIZE];
+  size_t length = p.WriteFen(buffer, sizeof(buffer));
+  EXPECT_EQ(std::string(buffer, length),
+            "r3k2r/pbppqppp/np3n2/2b1p3/2B1P3/NP3N2/PBPPQPPP/R3K2R b Kq e3 12 "
+            "345");
+  EXPECT_EQ(buffer[length], '\0');
+  EXPECT_EQ(p.WriteFen(buffer, FEN_BUFFER_SIZE - 1), 0);
+}
+
 TEST(PositionTest, ToFen) {
   Position p = Position::FromFen("8/3p2p1/8/8/8/8/P2P3P/8 b - - 56 199");
 
@@ -79,6 +156,26 @@ TEST(PositionTest, ToFen) {
   EXPECT_EQ(p.ToFen(), "8/3p2p1/8/8/8/8/P2P3P/8 b - - 56 199");
 }
 
+TEST(PositionTest, Hash) {
+  Position p = Position::FromFen(
+      "r3k2r/8/8/3pP3/8/8/8/R3K2R w KQkq d6 0 1");
+  EXPECT_EQ(p.Hash(), p.Duplicate().Hash());
+  // The clocks are not part of the hash.
+  EXPECT_EQ(p.Hash(),
+            Position::FromFen("r3k2r/8/8/3pP3/8/8/8/R3K2R w KQkq d6 12 40")
+                .Hash());
+  EXPECT_NE(p.Hash(), p.ForOpponent().Hash());
+  EXPECT_NE(p.Hash(),
+            Position::FromFen("r3k2r/8/8/3pP3/8/8/8/R3K2R w KQkq - 0 1")
+                .Hash());
+  EXPECT_NE(p.Hash(),
+            Position::FromFen("r3k2r/8/8/3pP3/8/8/8/R3K2R w Qkq d6 0 1")
+                .Hash());
+  EXPECT_NE(p.Hash(),
+            Position::FromFen("r3k2r/8/8/3pP3/8/8/8/R3K1R1 w Qkq d6 0 1")
+                .Hash());
+}
+
 TEST(PositionTest, IsDraw) {
   EXPECT_EQ(Position::FromFen("8/7k/7P/8/8/8/8/4K3 b - - 56 199").IsDraw(),
             false);
@@ -0,0 +1,182 @@
+#include "response.hpp"
+
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "cache.hpp"
+#include "codec.hpp"
+#include "history.hpp"
+#include "json_writer.hpp"
+#include "moves.hpp"
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+// The initial size of the buffer responses are written into, big enough for
+// the responses in most positions.
+constexpr size_t RESPONSE_BUFFER_SIZE = 4096;
+
+}  // namespace
+
+int parseResponseFields(std::string_view names, int* fields) {
+  *fields = 0;
+  while (true) {
+    size_t comma = names.find(',');
+    std::string_view name = names.substr(0, comma);
+    if (name == "legal") {
+      *fields |= FIELD_LEGAL;
+    } else if (name == "control") {
+      *fields |= FIELD_CONTROL;
+    } else if (name == "check") {
+      *fields |= FIELD_CHECK;
+    } else if (name == "status") {
+      *fields |= FIELD_STATUS;
+    } else if (!name.empty()) {
+      return 1;
+    }
+    if (comma == std::string_view::npos) {
+      return 0;
+    }
+    names.remove_prefix(comma + 1);
+  }
+}
+
+nlohmann::json positionResponseJson(const Position& p,
+                                    const PackedPosition* packed,
+                                    const std::string& last_move,
+                                    bool repeated, int fields) {
+  nlohmann::json response;
+  response["fen"] = p.ToFen();
+  if (packed != nullptr) {
+    response["pos"] = packed->ToBase64();
+  }
+  response["last_move"] = last_move;
+  response["turn"] = p.active_color == WHITE ? "w" : "b";
+  if (fields & FIELD_LEGAL) {
+    response["legal"] = LegalMoves(p).ToJson();
+  }
+  if (fields & FIELD_CONTROL) {
+    // Always send the control squares from white's perspective.
+    response["control"] =
+        ControlSquares(p.active_color == WHITE ? p : p.ForOpponent())
+            .ToJson();
+  }
+  bool is_check =
+      (fields & (FIELD_CHECK | FIELD_STATUS)) && isActiveColorInCheck(p);
+  if (fields & FIELD_CHECK) {
+    response["in_check"] = is_check;
+  }
+  if (fields & FIELD_STATUS) {
+    bool no_moves = !hasLegalMove(p);
+    response["in_checkmate"] = is_check && no_moves;
+    response["in_draw"] = (!is_check && no_moves) || p.IsDraw() || repeated;
+  }
+  return response;
+}
+
+void writePositionResponse(const Position& p, const PackedPosition* packed,
+                           std::string_view last_move, bool repeated,
+                           std::string* out, int fields) {
+  // Only the fields asked for are computed, and when the legal moves aren't
+  // needed the status comes from the cheaper test for any legal move.
+  std::optional<LegalMoves> legal_moves;
+  if (fields & FIELD_LEGAL) {
+    legal_moves.emplace(p);
+  }
+  bool is_check =
+      (fields & (FIELD_CHECK | FIELD_STATUS)) && isActiveColorInCheck(p);
+  bool no_moves = false;
+  if (fields & FIELD_STATUS) {
+    no_moves = legal_moves ? legal_moves->Count() == 0 : !hasLegalMove(p);
+  }
+
+  // The keys must be in sorted order, to match nlohmann::json.
+  JsonWriter writer(out);
+  writer.BeginObject();
+  if (fields & FIELD_CONTROL) {
+    writer.Key("control");
+    // Always send the control squares from white's perspective.
+    if (p.active_color == WHITE) {
+      ControlSquares(p).WriteJson(&writer);
+    } else {
+      ControlSquares(p.ForOpponent()).WriteJson(&writer);
+    }
+  }
+  writer.Key("fen");
+  char fen[FEN_BUFFER_SIZE];
+  writer.String(std::string_view(fen, p.WriteFen(fen, sizeof(fen))));
+  if (fields & FIELD_CHECK) {
+    writer.Key("in_check");
+    writer.Bool(is_check);
+  }
+  if (fields & FIELD_STATUS) {
+    writer.Key("in_checkmate");
+    writer.Bool(is_check && no_moves);
+    writer.Key("in_draw");
+    writer.Bool((!is_check && no_moves) || p.IsDraw() || repeated);
+  }
+  writer.Key("last_move");
+  writer.String(last_move);
+  if (legal_moves) {
+    writer.Key("legal");
+    legal_moves->WriteJson(&writer);
+  }
+  if (packed != nullptr) {
+    writer.Key("pos");
+    char base64[PACKED_POSITION_BASE64_SIZE];
+    packed->WriteBase64(base64);
+    writer.String(std::string_view(base64, sizeof(base64)));
+  }
+  writer.Key("turn");
+  writer.String(p.active_color == WHITE ? "w" : "b");
+  writer.EndObject();
+}
+
+std::string gameResponse(ResponseCache* cache, const std::string& game_id,
+                         const Position& p, const std::string& last_move,
+                         const PositionHistory& history, int fields) {
+  bool repeated = history.Repetitions() >= 2;
+  PackedPosition packed;
+  bool is_packed = packPosition(p, &packed) == 0;
+  std::string key;
+  std::shared_ptr<const std::string> cached;
+  if (is_packed) {
+    key.reserve(PACKED_POSITION_SIZE + 2 + last_move.size());
+    key.append(reinterpret_cast<const char*>(packed.bytes),
+               PACKED_POSITION_SIZE);
+    key += repeated ? '1' : '0';
+    key += static_cast<char>(fields);
+    key += last_move;
+    cached = cache->Find(key);
+  }
+
+  if (cached == nullptr) {
+    // Write into a buffer that is reused by every response on this thread, so
+    // only the cached copy needs an allocation.
+    thread_local std::string buffer;
+    buffer.clear();
+    buffer.reserve(RESPONSE_BUFFER_SIZE);
+    writePositionResponse(p, is_packed ? &packed : nullptr, last_move,
+                          repeated, &buffer, fields);
+    cached = std::make_shared<const std::string>(buffer);
+    if (is_packed) {
+      cache->Insert(key, cached);
+    }
+  }
+
+  // Add the game id as the first member of the cached JSON object.
+  std::string response;
+  response.reserve(game_id.size() + cached->size() + 16);
+  response += "{\"game\":";
+  JsonWriter(&response).String(game_id);
+  response += ',';
+  response.append(*cached, 1);
+  return response;
+}
+
+}  // namespace habits
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+
+#include "cache.hpp"
+#include "codec.hpp"
+#include "history.hpp"
+#include "position.hpp"
+
+namespace habits {
+
+// The parts of a position response that are only computed when asked for, as
+// bits of a mask.
+enum ResponseField {
+  // "legal": the legal moves.
+  FIELD_LEGAL = 1 << 0,
+  // "control": the control squares.
+  FIELD_CONTROL = 1 << 1,
+  // "in_check".
+  FIELD_CHECK = 1 << 2,
+  // "in_checkmate" and "in_draw".
+  FIELD_STATUS = 1 << 3,
+};
+
+constexpr int ALL_RESPONSE_FIELDS =
+    FIELD_LEGAL | FIELD_CONTROL | FIELD_CHECK | FIELD_STATUS;
+
+// Parse a comma separated list of the names of response fields ("legal",
+// "control", "check" and "status") into a mask of ResponseFields. Returns 0 on
+// success, or 1 if a name is unknown.
+int parseResponseFields(std::string_view names, int* fields);
+
+// The JSON object the HTTP server sends for a position in a game, without the
+// game id: the FEN and packed encoding of the position, the last move, the
+// color to move, and the ResponseFields in `fields`: the legal moves, the
+// control squares (from white's perspective), whether the active color is in
+// check, and whether it's in checkmate or the game is drawn. `packed` is the
+// packed position, or nullptr if it couldn't be packed. `repeated` is whether
+// the position has occurred three times.
+nlohmann::json positionResponseJson(const Position& p,
+                                    const PackedPosition* packed,
+                                    const std::string& last_move,
+                                    bool repeated,
+                                    int fields = ALL_RESPONSE_FIELDS);
+
+// Append positionResponseJson(...).dump() to `out`, writing the JSON directly
+// instead of building it as nlohmann::json objects first. The output is the
+// same byte for byte, except that a last move that isn't valid UTF-8 is copied
+// as is rather than throwing.
+void writePositionResponse(const Position& p, const PackedPosition* packed,
+                           std::string_view last_move, bool repeated,
+                           std::string* out, int fields = ALL_RESPONSE_FIELDS);
+
+// The JSON response for a position in a game, which is the position response
+// with the game id added as its first member. Everything but the game id only
+// depends on the position, the last move, whether the position has repeated
+// and the fields, so that part of the response is cached.
+std::string gameResponse(ResponseCache* cache, const std::string& game_id,
+                         const Position& p, const std::string& last_move,
+                         const PositionHistory& history,
+                         int fields = ALL_RESPONSE_FIELDS);
+
+}  // namespace habits
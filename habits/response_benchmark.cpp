@@ -0,0 +1,235 @@
+// Measures the time and heap allocations to build the JSON response for a
+// position, with nlohmann::json and with the JsonWriter. Building the whole
+// response is mostly finding the legal moves and control squares, so the
+// serialization of those is also measured on its own. Run from the build
+// directory with:
+//   ./habits/response_benchmark
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "codec.hpp"
+#include "json_writer.hpp"
+#include "moves.hpp"
+#include "position.hpp"
+#include "response.hpp"
+
+namespace {
+
+// The number of calls to operator new, counted by the replacements below. All
+// the forms of new and delete are replaced, so every allocation is counted and
+// freed by the matching function.
+uint64_t allocations = 0;
+
+void* countedAllocate(size_t size, size_t alignment) {
+  allocations++;
+  if (size == 0) {
+    size = 1;
+  }
+  if (alignment <= alignof(std::max_align_t)) {
+    return std::malloc(size);
+  }
+  // aligned_alloc needs the size to be a multiple of the alignment.
+  return std::aligned_alloc(alignment,
+                            (size + alignment - 1) / alignment * alignment);
+}
+
+void* countedNew(size_t size, size_t alignment) {
+  void* pointer = countedAllocate(size, alignment);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  return countedNew(size, alignof(std::max_align_t));
+}
+void* operator new[](size_t size) {
+  return countedNew(size, alignof(std::max_align_t));
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+  return countedNew(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return countedNew(size, static_cast<size_t>(alignment));
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return countedAllocate(size, alignof(std::max_align_t));
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return countedAllocate(size, alignof(std::max_align_t));
+}
+void* operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  return countedAllocate(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  return countedAllocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+void operator delete(void* pointer, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+void operator delete[](void* pointer, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+
+namespace habits {
+
+namespace {
+
+const std::vector<std::string> FENS = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1",
+    "r3k2r/pbppqppp/np3n2/2b1p3/2B1P3/NP3N2/PBPPQPPP/R3K2R w KQkq - 6 8",
+    "2rqr1k1/1ppbbppR/2n1pn2/3pN3/p2P1P2/2PBP1Q1/PP1N2PP/R1B3K1 b - - 1 15",
+    "8/3p2p1/8/8/8/8/P2P3P/8 b - - 56 199",
+    "3k1n2/6P1/8/8/8/8/p7/1R4K1 w - - 0 30",
+};
+
+constexpr int RESPONSE_ITERATIONS = 100;
+constexpr int SERIALIZE_ITERATIONS = 20000;
+
+struct BenchmarkPosition {
+  Position position;
+  PackedPosition packed;
+  LegalMoves legal_moves;
+  ControlSquares control_squares;
+
+  explicit BenchmarkPosition(const Position& p)
+      : position(p), legal_moves(p), control_squares(p) {
+    packPosition(p, &packed);
+  }
+};
+
+// Run `f` `iterations` times for every position, and print the average time
+// and number of allocations per call.
+template <typename F>
+void benchmark(const char* name, int iterations,
+               const std::vector<BenchmarkPosition>& positions, F f) {
+  uint64_t checksum = 0;
+  uint64_t start_allocations = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    for (const BenchmarkPosition& position : positions) {
+      checksum += f(position);
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double calls = static_cast<double>(iterations) * positions.size();
+  double ns = std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+  std::cout << name << ": " << ns << " ns/op, "
+            << (allocations - start_allocations) / calls
+            << " allocations/op (checksum " << checksum << ")" << std::endl;
+}
+
+}  // namespace
+
+}  // namespace habits
+
+int main() {
+  using habits::BenchmarkPosition;
+  using habits::JsonWriter;
+
+  std::vector<BenchmarkPosition> positions;
+  for (const std::string& fen : habits::FENS) {
+    positions.emplace_back(habits::Position::FromFen(fen));
+  }
+  const std::string last_move = "e2e4";
+  std::string buffer;
+  buffer.reserve(4096);
+
+  habits::benchmark(
+      "Response with nlohmann::json", habits::RESPONSE_ITERATIONS, positions,
+      [&](const BenchmarkPosition& position) {
+        return habits::positionResponseJson(position.position,
+                                            &position.packed, last_move, false)
+            .dump()
+            .size();
+      });
+  habits::benchmark(
+      "Response with JsonWriter", habits::RESPONSE_ITERATIONS, positions,
+      [&](const BenchmarkPosition& position) {
+        buffer.clear();
+        habits::writePositionResponse(position.position, &position.packed,
+                                      last_move, false, &buffer);
+        return buffer.size();
+      });
+
+  habits::benchmark(
+      "Response without control squares", habits::RESPONSE_ITERATIONS,
+      positions, [&](const BenchmarkPosition& position) {
+        buffer.clear();
+        habits::writePositionResponse(
+            position.position, &position.packed, last_move, false, &buffer,
+            habits::FIELD_LEGAL | habits::FIELD_CHECK | habits::FIELD_STATUS);
+        return buffer.size();
+      });
+  habits::benchmark(
+      "Response with only the status", habits::RESPONSE_ITERATIONS, positions,
+      [&](const BenchmarkPosition& position) {
+        buffer.clear();
+        habits::writePositionResponse(position.position, &position.packed,
+                                      last_move, false, &buffer,
+                                      habits::FIELD_STATUS);
+        return buffer.size();
+      });
+
+  habits::benchmark(
+      "Serialize with nlohmann::json", habits::SERIALIZE_ITERATIONS, positions,
+      [&](const BenchmarkPosition& position) {
+        nlohmann::json json;
+        json["control"] = position.control_squares.ToJson();
+        json["legal"] = position.legal_moves.ToJson();
+        return json.dump().size();
+      });
+  habits::benchmark(
+      "Serialize with JsonWriter", habits::SERIALIZE_ITERATIONS, positions,
+      [&](const BenchmarkPosition& position) {
+        buffer.clear();
+        JsonWriter writer(&buffer);
+        writer.BeginObject();
+        writer.Key("control");
+        position.control_squares.WriteJson(&writer);
+        writer.Key("legal");
+        position.legal_moves.WriteJson(&writer);
+        writer.EndObject();
+        return buffer.size();
+      });
+  return 0;
+}
@@ -0,0 +1,112 @@
+#include "response.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "codec.hpp"
+#include "moves.hpp"
+#include "position.hpp"
+
+namespace habits {
+
+namespace {
+
+// Check that the written response is the same as the nlohmann::json one.
+void expectSameResponse(const Position& p, const std::string& last_move,
+                        bool repeated, int fields = ALL_RESPONSE_FIELDS) {
+  PackedPosition packed;
+  const PackedPosition* packed_or_null =
+      packPosition(p, &packed) == 0 ? &packed : nullptr;
+  std::string written;
+  writePositionResponse(p, packed_or_null, last_move, repeated, &written,
+                        fields);
+  EXPECT_EQ(written, positionResponseJson(p, packed_or_null, last_move,
+                                          repeated, fields)
+                         .dump())
+      << p.ToFen() << " fields " << fields;
+}
+
+TEST(ResponseTest, SameAsJsonForSpecialPositions) {
+  const std::vector<std::string> fens = {
+      // Promotions for both colors.
+      "3k1n2/6P1/8/8/8/8/p7/1R4K1 w - - 0 30",
+      "3k1n2/6P1/8/8/8/8/p7/1R4K1 b - - 0 30",
+      // Checkmate.
+      "rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3",
+      // Stalemate.
+      "7k/5Q2/6K1/8/8/8/8/8 b - - 0 1",
+      // Draw by the fifty move rule.
+      "8/8/4k3/8/8/4K3/4R3/8 w - - 100 80",
+      // Only kings, so neither side controls any squares next to the other.
+      "8/8/8/3k4/8/8/8/4K3 w - - 0 1",
+  };
+  for (const std::string& fen : fens) {
+    Position p = Position::FromFen(fen);
+    expectSameResponse(p, "", false);
+    expectSameResponse(p, "e7e8q", true);
+    for (int fields = 0; fields < ALL_RESPONSE_FIELDS; fields++) {
+      expectSameResponse(p, "", false, fields);
+    }
+  }
+}
+
+TEST(ResponseTest, SameAsJsonForRandomGames) {
+  std::mt19937 random(42);
+  for (int game = 0; game < 20; game++) {
+    Position p = Position::FromFen(
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    std::string last_move;
+    for (int ply = 0; ply < 200; ply++) {
+      expectSameResponse(p, last_move, ply % 7 == 0);
+      LegalMoves legal_moves(p);
+      std::vector<std::string> moves;
+      for (const auto& [piece_on_square, targets] : legal_moves.Moves()) {
+        for (const PieceMove& target : targets) {
+          moves.push_back(piece_on_square.square.Algebraic() +
+                          target.Algebraic());
+        }
+      }
+      if (moves.empty()) {
+        break;
+      }
+      last_move = moves[random() % moves.size()];
+      ASSERT_EQ(move(&p, last_move), 0);
+    }
+  }
+}
+
+TEST(ResponseTest, ParseResponseFields) {
+  int fields;
+  ASSERT_EQ(parseResponseFields("legal,status", &fields), 0);
+  EXPECT_EQ(fields, FIELD_LEGAL | FIELD_STATUS);
+  ASSERT_EQ(parseResponseFields("control,check,legal,status", &fields), 0);
+  EXPECT_EQ(fields, ALL_RESPONSE_FIELDS);
+  ASSERT_EQ(parseResponseFields("", &fields), 0);
+  EXPECT_EQ(fields, 0);
+  EXPECT_EQ(parseResponseFields("legal,moves", &fields), 1);
+}
+
+TEST(ResponseTest, OnlySelectedFields) {
+  // Checkmate.
+  Position p = Position::FromFen(
+      "rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3");
+  std::string written;
+  writePositionResponse(p, nullptr, "d8h4", false, &written, FIELD_STATUS);
+  EXPECT_EQ(written,
+            "{\"fen\":\"rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w "
+            "KQkq - 1 3\",\"in_checkmate\":true,\"in_draw\":false,"
+            "\"last_move\":\"d8h4\",\"turn\":\"w\"}");
+}
+
+TEST(ResponseTest, EscapesLastMove) {
+  Position p = Position::FromFen(
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  expectSameResponse(p, "\"\\\n", false);
+}
+
+}  // namespace
+}  // namespace habits
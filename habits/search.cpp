@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <bitset>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <fstream>
@@ -11,8 +12,12 @@
 #include <string>
 #include <utility>
 
+#include "history.hpp"
+#include "log.hpp"
 #include "moves.hpp"
+#include "pawns.hpp"
 #include "position.hpp"
+#include "stats.hpp"
 
 namespace habits {
 
@@ -64,9 +69,6 @@ std::string searchPresetMoves(
     for (const Square& to_square : tos) {
       if (legal_moves.IsLegal(piece_and_square, to_square)) {
         if (control_squares.IsSafeToMove(piece_and_square.piece, to_square)) {
-          std::cout << "Found preset move of " << piece_and_square.piece
-                    << " from " << piece_and_square.square << " to " << to_square
-                    << std::endl;
           return piece_and_square.square.Algebraic() + to_square.Algebraic();
         }
       }
@@ -75,13 +77,106 @@ std::string searchPresetMoves(
   return "";
 }
 
+// Find the safe push of the active color's most advanced passed pawn.
+std::string searchPassedPawnPushes(
+    const Position& p,
+    const std::vector<PieceMoves>& legal_moves,
+    const ControlSquares& control_squares,
+    uint64_t passed_pawns) {
+  ColoredPiece pawn = p.active_color == WHITE ? WPAWN : BPAWN;
+  std::string bestmove;
+  int best_distance = 8;
+  for (const auto& [piece_and_square, move_squares] : legal_moves) {
+    if (piece_and_square.piece != pawn ||
+        (passed_pawns & piece_and_square.square.BitboardMask()) == 0ull) {
+      continue;
+    }
+    int rank = piece_and_square.square.Rank();
+    int distance = p.active_color == WHITE ? 8 - rank : rank - 1;
+    if (distance >= best_distance) {
+      continue;
+    }
+    for (const PieceMove& move_square : move_squares) {
+      if (move_square.square.File() == piece_and_square.square.File() &&
+          control_squares.IsSafeToMove(pawn, move_square.square)) {
+        bestmove = piece_and_square.square.Algebraic() +
+                   move_square.Algebraic();
+        best_distance = distance;
+        break;
+      }
+    }
+  }
+  return bestmove;
+}
+
+// Whether making the move in the position draws by threefold repetition.
+bool drawsByRepetition(const Position& p, const std::string& move,
+                       const PositionHistory& history) {
+  Position next = p.Duplicate();
+  habits::move(&next, move);
+  return history.Occurrences(next) >= 2;
+}
+
 }  // namespace
 
-std::string Game::bestMove(const Position& p) {
+const char* ruleName(Rule rule) {
+  switch (rule) {
+    case NO_LEGAL_MOVES:
+      return "no legal moves";
+    case SAVE_ATTACKED_PIECE_BY_TAKING:
+      return "save attacked piece by taking";
+    case SAVE_ATTACKED_PIECE_TO_SAFEST_SQUARE:
+      return "save attacked piece to safest square";
+    case SACK_ATTACKED_PIECE:
+      return "sack attacked piece";
+    case TAKE_FREE_PIECE:
+      return "take free piece";
+    case TRADE_PIECES:
+      return "trade pieces";
+    case ATTACK_MINOR_PIECE:
+      return "attack bishop or knight";
+    case INITIAL_MOVE:
+      return "initial move";
+    case DEVELOPING_MOVE:
+      return "developing move";
+    case PUSH_PASSED_PAWN:
+      return "push passed pawn";
+    case RANDOM_MOVE:
+      return "random move";
+  }
+  return "unknown";
+}
+
+std::ostream& operator<<(std::ostream& stream, const Decision& decision) {
+  return stream << decision.move << " (" << ruleName(decision.rule) << ", "
+                << decision.candidates << " candidates, "
+                << decision.elapsed_ns << "ns)";
+}
+
+Decision Game::bestMove(const Position& p, const PositionHistory* history) {
+  const auto start = std::chrono::steady_clock::now();
   std::string bestmove;
 
   // Know how all the pieces move.
   LegalMoves legal_moves(p);
+  const int candidates = legal_moves.Count();
+
+  auto decide = [&](std::string move, Rule rule) {
+    int64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    Decision decision{std::move(move), rule, candidates, elapsed_ns};
+    recordDecision(decision);
+    if (logEnabled(LOG_DEBUG)) {
+      LogMessage(LOG_DEBUG) << "Decided on " << decision
+                            << " in position: " << p.ToFen();
+    }
+    return decision;
+  };
+
+  if (candidates == 0) {
+    return decide("", NO_LEGAL_MOVES);
+  }
 
   ControlSquares control_squares = ControlSquares(p);
 
@@ -92,31 +187,23 @@ std::string Game::bestMove(const Position& p) {
     if (control_squares.IsPieceAttacked(piece_and_square)) {
       PieceMove best_take = control_squares.BestTake(piece_and_square.piece, move_squares);
       if (best_take.IsSet()) {
-        std::cout << "Moving attacked piece " << piece_and_square.piece
-                  << " from " << piece_and_square.square
-                  << " to take piece on square " << best_take
-                  << std::endl;
-        return piece_and_square.square.Algebraic() +
-               best_take.Algebraic();
+        return decide(
+            piece_and_square.square.Algebraic() + best_take.Algebraic(),
+            SAVE_ATTACKED_PIECE_BY_TAKING);
       }
 
       PieceMove max_control_square = control_squares.SafestMove(piece_and_square.piece, move_squares);
       if (max_control_square.IsSet()) {
-        std::cout << "Moving attacked piece " << piece_and_square.piece
-                  << " from " << piece_and_square.square << " to safest square "
-                  << max_control_square << std::endl;
-        return piece_and_square.square.Algebraic() +
-               max_control_square.Algebraic();
+        return decide(piece_and_square.square.Algebraic() +
+                          max_control_square.Algebraic(),
+                      SAVE_ATTACKED_PIECE_TO_SAFEST_SQUARE);
       }
 
       PieceMove best_sack = control_squares.BestSack(piece_and_square.piece, move_squares);
       if (best_sack.IsSet()) {
-        std::cout << "Sacking attacked piece " << piece_and_square.piece
-                  << " from " << piece_and_square.square
-                  << " to take on square " << best_sack
-                  << std::endl;
-        return piece_and_square.square.Algebraic() +
-               best_sack.Algebraic();
+        return decide(
+            piece_and_square.square.Algebraic() + best_sack.Algebraic(),
+            SACK_ATTACKED_PIECE);
       }
     }
   }
@@ -128,10 +215,9 @@ std::string Game::bestMove(const Position& p) {
   for (const auto& [piece_and_square, move_squares] : sorted_legal_moves) {
     PieceMove first_hanging = control_squares.FirstHanging(piece_and_square.piece, move_squares);
     if (first_hanging.IsSet()) {
-      std::cout << "Taking free piece with " << piece_and_square.piece
-                << " from " << piece_and_square.square << " to "
-                << first_hanging << std::endl;
-      return piece_and_square.square.Algebraic() + first_hanging.Algebraic();
+      return decide(
+          piece_and_square.square.Algebraic() + first_hanging.Algebraic(),
+          TAKE_FREE_PIECE);
     }
   }
 
@@ -147,28 +233,28 @@ std::string Game::bestMove(const Position& p) {
   if (!trades.empty()) {
     // Trade the highest value piece first.
     PieceMoves piece_trades = trades[trades.size() - 1];
-    std::cout << "Trading pieces with " << piece_trades.piece_on_square.piece << " from "
-              << piece_trades.piece_on_square.square << " to " << piece_trades.moves[0] << std::endl;
-    return piece_trades.piece_on_square.square.Algebraic() + piece_trades.moves[0].Algebraic();
+    return decide(piece_trades.piece_on_square.square.Algebraic() +
+                      piece_trades.moves[0].Algebraic(),
+                  TRADE_PIECES);
   }
 
   // 4. Always attack a Bishop or Knight on g4/g5 b4/b5 with the a or h pawn
   // immediately.
   if (((p.bitboards[BBISHOP] | p.bitboards[BKNIGHT]) & Square("b4").BitboardMask()) != 0ull
       && legal_moves.IsLegal(PieceOnSquare(WPAWN, Square("a2")), Square("a3"))) {
-    return "a2a3";
+    return decide("a2a3", ATTACK_MINOR_PIECE);
   }
   if (((p.bitboards[BBISHOP] | p.bitboards[BKNIGHT]) & Square("g4").BitboardMask()) != 0ull
       && legal_moves.IsLegal(PieceOnSquare(WPAWN, Square("h2")), Square("h3"))) {
-    return "h2h3";
+    return decide("h2h3", ATTACK_MINOR_PIECE);
   }
   if (((p.bitboards[WBISHOP] | p.bitboards[WKNIGHT]) & Square("b5").BitboardMask()) != 0ull
       && legal_moves.IsLegal(PieceOnSquare(BPAWN, Square("a7")), Square("a6"))) {
-    return "a7a6";
+    return decide("a7a6", ATTACK_MINOR_PIECE);
   }
   if (((p.bitboards[WBISHOP] | p.bitboards[WKNIGHT]) & Square("g5").BitboardMask()) != 0ull
       && legal_moves.IsLegal(PieceOnSquare(BPAWN, Square("h7")), Square("h6"))) {
-    return "h7h6";
+    return decide("h7h6", ATTACK_MINOR_PIECE);
   }
 
   if (stage_ == INITIAL) {
@@ -178,7 +264,7 @@ std::string Game::bestMove(const Position& p) {
     if (bestmove.empty()) {
       stage_ = DEVELOPING;
     } else {
-      return bestmove;
+      return decide(bestmove, INITIAL_MOVE);
     }
   }
 
@@ -192,7 +278,7 @@ std::string Game::bestMove(const Position& p) {
     if (bestmove.empty()) {
       stage_ = MIDGAME;
     } else {
-      return bestmove;
+      return decide(bestmove, DEVELOPING_MOVE);
     }
   }
 
@@ -210,17 +296,34 @@ std::string Game::bestMove(const Position& p) {
   // Spend a lot of time at the beginning to follow all the rules.
 
   // Push pass pawns.
+  const PawnStructure& pawns = pawn_table_.Probe(p);
+  bestmove = searchPassedPawnPushes(p, sorted_legal_moves, control_squares,
+                                    pawns.Passed(p.active_color));
+  if (!bestmove.empty()) {
+    return decide(bestmove, PUSH_PASSED_PAWN);
+  }
 
   // Give a check.
 
   // Random pawn moves not on the king side.
 
-  // Nothing else? make a random move.
+  // Nothing else? make a random move, but don't repeat the position a third
+  // time if there is any other move.
   PieceMoves random_move = legal_moves.RandomMove();
-  std::cout << "Randomly moving " << random_move.piece_on_square.piece
-            << " from " << random_move.piece_on_square.square
-            << " to " << random_move.moves[0] << std::endl;
-  return random_move.piece_on_square.square.Algebraic() + random_move.moves[0].Algebraic();
+  bestmove = random_move.piece_on_square.square.Algebraic() +
+             random_move.moves[0].Algebraic();
+  if (history != nullptr && drawsByRepetition(p, bestmove, *history)) {
+    for (const auto& [piece_and_square, move_squares] : sorted_legal_moves) {
+      for (const PieceMove& move_square : move_squares) {
+        std::string move =
+            piece_and_square.square.Algebraic() + move_square.Algebraic();
+        if (!drawsByRepetition(p, move, *history)) {
+          return decide(move, RANDOM_MOVE);
+        }
+      }
+    }
+  }
+  return decide(bestmove, RANDOM_MOVE);
 }
 
 }  // namespace habits
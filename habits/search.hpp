@@ -1,23 +1,66 @@
 #pragma once
 
+#include <cstdint>
+#include <ostream>
 #include <string>
 
+#include "history.hpp"
+#include "pawns.hpp"
 #include "position.hpp"
 
 namespace habits {
 
 enum Stage : int { INITIAL, DEVELOPING, MIDGAME, ENDGAME };
 
+// The habit that decided on the best move.
+enum Rule : int {
+  NO_LEGAL_MOVES,
+  SAVE_ATTACKED_PIECE_BY_TAKING,
+  SAVE_ATTACKED_PIECE_TO_SAFEST_SQUARE,
+  SACK_ATTACKED_PIECE,
+  TAKE_FREE_PIECE,
+  TRADE_PIECES,
+  ATTACK_MINOR_PIECE,
+  INITIAL_MOVE,
+  DEVELOPING_MOVE,
+  PUSH_PASSED_PAWN,
+  RANDOM_MOVE,
+};
+
+constexpr int NUM_RULES = RANDOM_MOVE + 1;
+
+// A short human readable description of the rule.
+const char* ruleName(Rule rule);
+
+// The result of searching for the best move in a position.
+struct Decision {
+  // The move in UCI notation, empty if there are no legal moves.
+  std::string move;
+  // The habit that chose the move.
+  Rule rule;
+  // The number of legal moves that were available.
+  int candidates;
+  // How long the search took.
+  int64_t elapsed_ns;
+
+  friend std::ostream& operator<<(std::ostream& stream,
+                                  const Decision& decision);
+};
+
 class Game {
  public:
   explicit Game(Stage stage = INITIAL) : stage_(stage) {}
 
   void opponentMove(std::string move) { lastMove_ = move; }
-  std::string bestMove(const Position& p);
+  // Find the best move in the position. With the history of the game, moves
+  // that draw by repetition are avoided where the habits allow it.
+  Decision bestMove(const Position& p,
+                    const PositionHistory* history = nullptr);
 
  private:
   Stage stage_;
   std::string lastMove_;
+  PawnHashTable pawn_table_;
 };
 
 }  // namespace habits
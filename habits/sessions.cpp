@@ -0,0 +1,120 @@
+#include "sessions.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace habits {
+
+namespace {
+
+// The length of a session id, as hex digits of a 64-bit number.
+constexpr size_t ID_LENGTH = 16;
+
+uint64_t randomId() {
+  thread_local std::mt19937_64 generator{std::random_device{}()};
+  return generator();
+}
+
+std::string formatId(uint64_t id) {
+  char buffer[ID_LENGTH + 1];
+  std::snprintf(buffer, sizeof(buffer), "%016llx",
+                static_cast<unsigned long long>(id));
+  return buffer;
+}
+
+// Returns false if the id is not the expected number of hex digits.
+bool parseId(std::string_view id, uint64_t* value) {
+  if (id.size() != ID_LENGTH) {
+    return false;
+  }
+  *value = 0;
+  for (char c : id) {
+    int digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else {
+      return false;
+    }
+    *value = *value << 4 | digit;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::shared_ptr<GameSession> GameSessions::Create(std::string* id) {
+  auto session = std::make_shared<GameSession>();
+  const auto now = clock_();
+  while (true) {
+    uint64_t value = randomId();
+    Shard& s = shard(value);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (now - s.last_evicted >= EVICT_INTERVAL) {
+      evictIdle(&s, now);
+    }
+    if (s.sessions.emplace(value, Entry{session, now}).second) {
+      *id = formatId(value);
+      return session;
+    }
+  }
+}
+
+std::shared_ptr<GameSession> GameSessions::Find(std::string_view id) {
+  uint64_t value;
+  if (!parseId(id, &value)) {
+    return nullptr;
+  }
+  Shard& s = shard(value);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it = s.sessions.find(value);
+  if (it == s.sessions.end()) {
+    return nullptr;
+  }
+  it->second.last_used = clock_();
+  return it->second.session;
+}
+
+size_t GameSessions::EvictIdle() {
+  const auto now = clock_();
+  size_t evicted = 0;
+  for (Shard& s : shards_) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    evicted += evictIdle(&s, now);
+  }
+  return evicted;
+}
+
+size_t GameSessions::Size() const {
+  size_t size = 0;
+  for (const Shard& s : shards_) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    size += s.sessions.size();
+  }
+  return size;
+}
+
+size_t GameSessions::evictIdle(Shard* shard,
+                               std::chrono::steady_clock::time_point now) {
+  shard->last_evicted = now;
+  size_t evicted = 0;
+  for (auto it = shard->sessions.begin(); it != shard->sessions.end();) {
+    if (now - it->second.last_used > idle_timeout_) {
+      // Sessions still in use by a request are kept alive by its shared_ptr.
+      it = shard->sessions.erase(it);
+      evicted++;
+    } else {
+      ++it;
+    }
+  }
+  return evicted;
+}
+
+}  // namespace habits
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "history.hpp"
+#include "search.hpp"
+
+namespace habits {
+
+// The state of a game being played against the habits by one client.
+struct GameSession {
+  // Must be held while using the game or history, requests for the same
+  // session can arrive concurrently.
+  std::mutex mutex;
+  Game game;
+  PositionHistory history;
+};
+
+// The game sessions of all clients, keyed by a random id. The sessions are
+// split over shards with a lock each, so requests for different games rarely
+// wait on each other. Sessions that are idle for longer than the timeout are
+// evicted as new ones are created.
+class GameSessions {
+ public:
+  // Returns the current time, so tests can control it.
+  using Clock = std::function<std::chrono::steady_clock::time_point()>;
+
+  explicit GameSessions(
+      std::chrono::steady_clock::duration idle_timeout = std::chrono::hours(1),
+      Clock clock = std::chrono::steady_clock::now)
+      : idle_timeout_(idle_timeout), clock_(std::move(clock)) {}
+
+  // Start a new session, setting `id` to the id for finding it again.
+  std::shared_ptr<GameSession> Create(std::string* id);
+
+  // Find a session by its id, and mark it as used. Returns nullptr if there is
+  // no such session, or it was evicted.
+  std::shared_ptr<GameSession> Find(std::string_view id);
+
+  // Evict all sessions that have been idle for longer than the timeout.
+  // Returns the number of sessions evicted.
+  size_t EvictIdle();
+
+  // The number of sessions.
+  size_t Size() const;
+
+ private:
+  static constexpr int SHARDS = 16;
+  // How often each shard is checked for idle sessions when creating sessions.
+  static constexpr std::chrono::seconds EVICT_INTERVAL{60};
+
+  struct Entry {
+    std::shared_ptr<GameSession> session;
+    std::chrono::steady_clock::time_point last_used;
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, Entry> sessions;
+    std::chrono::steady_clock::time_point last_evicted;
+  };
+
+  // Evict the idle sessions of a shard, which must be locked.
+  size_t evictIdle(Shard* shard, std::chrono::steady_clock::time_point now);
+
+  Shard& shard(uint64_t id) { return shards_[id % SHARDS]; }
+
+  const std::chrono::steady_clock::duration idle_timeout_;
+  const Clock clock_;
+  Shard shards_[SHARDS];
+};
+
+}  // namespace habits
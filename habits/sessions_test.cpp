@@ -0,0 +1,91 @@
+#include "sessions.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cctype>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace habits {
+
+namespace {
+
+TEST(SessionsTest, CreateAndFind) {
+  GameSessions sessions;
+  std::string id1;
+  std::string id2;
+  std::shared_ptr<GameSession> session1 = sessions.Create(&id1);
+  std::shared_ptr<GameSession> session2 = sessions.Create(&id2);
+  EXPECT_EQ(id1.size(), 16);
+  EXPECT_NE(id1, id2);
+  EXPECT_EQ(sessions.Size(), 2);
+
+  EXPECT_EQ(sessions.Find(id1), session1);
+  EXPECT_EQ(sessions.Find(id2), session2);
+  EXPECT_EQ(sessions.Find(""), nullptr);
+  EXPECT_EQ(sessions.Find("not a session id"), nullptr);
+  std::string upper_id1 = id1;
+  for (char& c : upper_id1) {
+    c = std::toupper(c);
+  }
+  if (upper_id1 != id1) {
+    EXPECT_EQ(sessions.Find(upper_id1), nullptr);
+  }
+}
+
+TEST(SessionsTest, EvictIdle) {
+  auto now = std::chrono::steady_clock::now();
+  GameSessions sessions(std::chrono::seconds(50), [&now]() { return now; });
+  std::string idle_id;
+  std::string used_id;
+  std::shared_ptr<GameSession> idle = sessions.Create(&idle_id);
+  sessions.Create(&used_id);
+  EXPECT_EQ(sessions.EvictIdle(), 0);
+
+  now += std::chrono::seconds(40);
+  ASSERT_NE(sessions.Find(used_id), nullptr);
+  EXPECT_EQ(sessions.EvictIdle(), 0);
+  now += std::chrono::seconds(40);
+  EXPECT_EQ(sessions.EvictIdle(), 1);
+  EXPECT_EQ(sessions.Find(idle_id), nullptr);
+  EXPECT_NE(sessions.Find(used_id), nullptr);
+  EXPECT_EQ(sessions.Size(), 1);
+
+  // An evicted session stays usable by whoever still holds it.
+  std::lock_guard<std::mutex> lock(idle->mutex);
+  EXPECT_EQ(idle->history.Repetitions(), 0);
+}
+
+TEST(SessionsTest, Concurrent) {
+  GameSessions sessions;
+  std::vector<std::vector<std::string>> ids(4);
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < 4; thread++) {
+    threads.emplace_back([&, thread]() {
+      for (int i = 0; i < 500; i++) {
+        std::string id;
+        sessions.Create(&id);
+        ids[thread].push_back(id);
+        EXPECT_NE(sessions.Find(ids[thread][i / 2]), nullptr);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  std::set<std::string> unique_ids;
+  for (const std::vector<std::string>& thread_ids : ids) {
+    unique_ids.insert(thread_ids.begin(), thread_ids.end());
+  }
+  EXPECT_EQ(unique_ids.size(), 2000);
+  EXPECT_EQ(sessions.Size(), 2000);
+}
+
+}  // namespace
+}  // namespace habits
@@ -0,0 +1,164 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "search.hpp"
+
+namespace habits {
+
+namespace {
+
+// A thread's counters for a single rule. Only the owning thread writes them, so
+// relaxed loads and stores are enough, readers may just see slightly stale
+// values.
+struct AtomicRuleStats {
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> total_ns{0};
+  std::atomic<uint64_t> max_ns{0};
+  std::atomic<uint64_t> latency_buckets[LATENCY_BUCKETS] = {};
+
+  void MergeInto(RuleStats* stats) const {
+    stats->hits += hits.load(std::memory_order_relaxed);
+    stats->total_ns += total_ns.load(std::memory_order_relaxed);
+    stats->max_ns =
+        std::max(stats->max_ns, max_ns.load(std::memory_order_relaxed));
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+      stats->latency_buckets[bucket] +=
+          latency_buckets[bucket].load(std::memory_order_relaxed);
+    }
+  }
+};
+
+void increment(std::atomic<uint64_t>* counter, uint64_t value) {
+  counter->store(counter->load(std::memory_order_relaxed) + value,
+                 std::memory_order_relaxed);
+}
+
+class ThreadRuleStats;
+
+// All the live threads' counters, plus the merged counters of exited threads.
+struct Registry {
+  std::mutex mutex;
+  std::vector<const ThreadRuleStats*> threads;
+  std::vector<RuleStats> retired = std::vector<RuleStats>(NUM_RULES);
+};
+
+Registry& registry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+class ThreadRuleStats {
+ public:
+  ThreadRuleStats() {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    registry().threads.push_back(this);
+  }
+
+  ~ThreadRuleStats() {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    MergeInto(&registry().retired);
+    auto& threads = registry().threads;
+    threads.erase(std::remove(threads.begin(), threads.end(), this),
+                  threads.end());
+  }
+
+  void Record(Rule rule, uint64_t elapsed_ns) {
+    AtomicRuleStats& stats = rules_[rule];
+    increment(&stats.hits, 1);
+    increment(&stats.total_ns, elapsed_ns);
+    if (elapsed_ns > stats.max_ns.load(std::memory_order_relaxed)) {
+      stats.max_ns.store(elapsed_ns, std::memory_order_relaxed);
+    }
+    int bucket = elapsed_ns == 0 ? 0 : 64 - __builtin_clzll(elapsed_ns);
+    increment(&stats.latency_buckets[std::min(bucket, LATENCY_BUCKETS - 1)],
+              1);
+  }
+
+  void MergeInto(std::vector<RuleStats>* stats) const {
+    for (int rule = 0; rule < NUM_RULES; rule++) {
+      rules_[rule].MergeInto(&(*stats)[rule]);
+    }
+  }
+
+ private:
+  AtomicRuleStats rules_[NUM_RULES];
+};
+
+std::atomic<bool> dump_requested{false};
+
+}  // namespace
+
+uint64_t RuleStats::PercentileNs(double percentile) const {
+  uint64_t target = static_cast<uint64_t>(hits * percentile / 100.0 + 0.5);
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    seen += latency_buckets[bucket];
+    if (seen >= target && seen > 0) {
+      if (bucket == LATENCY_BUCKETS - 1) {
+        return max_ns;
+      }
+      return std::min<uint64_t>(1ull << bucket, max_ns);
+    }
+  }
+  return 0;
+}
+
+void recordDecision(const Decision& decision) {
+  thread_local ThreadRuleStats thread_stats;
+  thread_stats.Record(decision.rule, decision.elapsed_ns);
+}
+
+std::vector<RuleStats> ruleStats() {
+  std::lock_guard<std::mutex> lock(registry().mutex);
+  std::vector<RuleStats> stats = registry().retired;
+  for (const ThreadRuleStats* thread : registry().threads) {
+    thread->MergeInto(&stats);
+  }
+  return stats;
+}
+
+std::string ruleStatsReport() {
+  std::vector<RuleStats> stats = ruleStats();
+  uint64_t total_hits = 0;
+  for (const RuleStats& rule_stats : stats) {
+    total_hits += rule_stats.hits;
+  }
+
+  std::string report;
+  char line[160];
+  std::snprintf(line, sizeof(line), "%-38s %10s %7s %10s %10s %10s %10s\n",
+                "rule", "hits", "%", "mean_ns", "p50_ns", "p99_ns", "max_ns");
+  report += line;
+  for (int rule = 0; rule < NUM_RULES; rule++) {
+    const RuleStats& rule_stats = stats[rule];
+    std::snprintf(
+        line, sizeof(line), "%-38s %10llu %7.2f %10llu %10llu %10llu %10llu\n",
+        ruleName(static_cast<Rule>(rule)),
+        static_cast<unsigned long long>(rule_stats.hits),
+        total_hits == 0 ? 0.0 : 100.0 * rule_stats.hits / total_hits,
+        static_cast<unsigned long long>(
+            rule_stats.hits == 0 ? 0 : rule_stats.total_ns / rule_stats.hits),
+        static_cast<unsigned long long>(rule_stats.PercentileNs(50)),
+        static_cast<unsigned long long>(rule_stats.PercentileNs(99)),
+        static_cast<unsigned long long>(rule_stats.max_ns));
+    report += line;
+  }
+  return report;
+}
+
+void requestRuleStatsDump() {
+  dump_requested.store(true, std::memory_order_relaxed);
+}
+
+bool takeRuleStatsDumpRequest() {
+  return dump_requested.exchange(false, std::memory_order_relaxed);
+}
+
+}  // namespace habits
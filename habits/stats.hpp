@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "search.hpp"
+
+namespace habits {
+
+// Number of timing histogram buckets. Bucket i counts decisions that took less
+// than 2^i nanoseconds (and at least 2^(i-1)), the last bucket counts all
+// slower decisions.
+constexpr int LATENCY_BUCKETS = 40;
+
+// How often a rule has decided on the best move, and how long it took.
+struct RuleStats {
+  uint64_t hits = 0;
+  uint64_t total_ns = 0;
+  uint64_t max_ns = 0;
+  uint64_t latency_buckets[LATENCY_BUCKETS] = {0};
+
+  // Estimate a percentile (0-100) of the latency from the histogram, as the
+  // upper bound of the bucket containing it.
+  uint64_t PercentileNs(double percentile) const;
+};
+
+// Count a decision in the rule statistics. Counters are kept per thread, so
+// this never blocks on other threads.
+void recordDecision(const Decision& decision);
+
+// Merge the rule statistics of all threads (including threads that have
+// exited). The result is indexed by Rule.
+std::vector<RuleStats> ruleStats();
+
+// A human readable table of the merged rule statistics.
+std::string ruleStatsReport();
+
+// Ask for the rule statistics to be dumped, e.g. from a signal handler (this
+// is async-signal-safe).
+void requestRuleStatsDump();
+
+// Check (and clear) whether a dump of the rule statistics was requested.
+bool takeRuleStatsDumpRequest();
+
+}  // namespace habits
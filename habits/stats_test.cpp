@@ -0,0 +1,59 @@
+#include "stats.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+
+#include "search.hpp"
+
+namespace habits {
+
+namespace {
+
+TEST(StatsTest, MergesThreads) {
+  std::vector<RuleStats> before = ruleStats();
+
+  recordDecision(Decision{"e2e4", INITIAL_MOVE, 20, 1000});
+  std::thread thread([]() {
+    recordDecision(Decision{"e2e4", INITIAL_MOVE, 20, 3000});
+    recordDecision(Decision{"a2a3", RANDOM_MOVE, 20, 100});
+  });
+  thread.join();
+
+  std::vector<RuleStats> after = ruleStats();
+  ASSERT_EQ(after.size(), NUM_RULES);
+  EXPECT_EQ(after[INITIAL_MOVE].hits - before[INITIAL_MOVE].hits, 2);
+  EXPECT_EQ(after[INITIAL_MOVE].total_ns - before[INITIAL_MOVE].total_ns,
+            4000);
+  EXPECT_GE(after[INITIAL_MOVE].max_ns, 3000);
+  EXPECT_EQ(after[RANDOM_MOVE].hits - before[RANDOM_MOVE].hits, 1);
+}
+
+TEST(StatsTest, PercentileNs) {
+  RuleStats stats;
+  stats.hits = 4;
+  stats.max_ns = 5000;
+  stats.latency_buckets[7] = 3;   // < 128ns
+  stats.latency_buckets[13] = 1;  // < 8192ns
+  EXPECT_EQ(stats.PercentileNs(50), 128);
+  EXPECT_EQ(stats.PercentileNs(99), 5000);
+}
+
+TEST(StatsTest, Report) {
+  recordDecision(Decision{"e2e4", PUSH_PASSED_PAWN, 20, 1000});
+  std::string report = ruleStatsReport();
+  EXPECT_THAT(report, testing::HasSubstr("push passed pawn"));
+  EXPECT_THAT(report, testing::HasSubstr("random move"));
+}
+
+TEST(StatsTest, DumpRequest) {
+  EXPECT_FALSE(takeRuleStatsDumpRequest());
+  requestRuleStatsDump();
+  EXPECT_TRUE(takeRuleStatsDumpRequest());
+  EXPECT_FALSE(takeRuleStatsDumpRequest());
+}
+
+}  // namespace
+}  // namespace habits
@@ -0,0 +1,304 @@
+#include "websocket.hpp"
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace habits {
+
+namespace {
+
+// Appended to the client's key before hashing, as given by the protocol.
+constexpr std::string_view WEBSOCKET_GUID =
+    "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+constexpr size_t SHA1_SIZE = 20;
+
+uint32_t rotateLeft(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+// The SHA-1 hash of the data. Only used for the handshake, which the protocol
+// defines with SHA-1, not for anything that needs to be secure.
+void sha1(std::string_view data, uint8_t hash[SHA1_SIZE]) {
+  uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+                   0xc3d2e1f0};
+
+  // Pad with a 1 bit, then 0s up to the 64 bit length at the end of a block.
+  std::string message(data);
+  message += static_cast<char>(0x80);
+  while (message.size() % 64 != 56) {
+    message += '\0';
+  }
+  uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    message += static_cast<char>(bits >> shift);
+  }
+
+  for (size_t block = 0; block < message.size(); block += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const auto* bytes =
+          reinterpret_cast<const uint8_t*>(message.data() + block + i * 4);
+      w[i] = (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5a827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotateLeft(b, 30);
+      b = a;
+      a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  for (int i = 0; i < 5; i++) {
+    hash[i * 4] = h[i] >> 24;
+    hash[i * 4 + 1] = h[i] >> 16;
+    hash[i * 4 + 2] = h[i] >> 8;
+    hash[i * 4 + 3] = h[i];
+  }
+}
+
+// Standard base64 with padding, unlike the base64url of PackedPositions.
+std::string base64(const uint8_t* bytes, size_t size) {
+  static constexpr char ALPHABET[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string encoded;
+  for (size_t i = 0; i < size; i += 3) {
+    uint32_t group = bytes[i] << 16;
+    if (i + 1 < size) {
+      group |= bytes[i + 1] << 8;
+    }
+    if (i + 2 < size) {
+      group |= bytes[i + 2];
+    }
+    encoded += ALPHABET[(group >> 18) & 0x3f];
+    encoded += ALPHABET[(group >> 12) & 0x3f];
+    encoded += i + 1 < size ? ALPHABET[(group >> 6) & 0x3f] : '=';
+    encoded += i + 2 < size ? ALPHABET[group & 0x3f] : '=';
+  }
+  return encoded;
+}
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (std::tolower(static_cast<unsigned char>(a[i])) !=
+        std::tolower(static_cast<unsigned char>(b[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether the comma separated header value contains the token.
+bool hasToken(std::string_view value, std::string_view token) {
+  while (!value.empty()) {
+    size_t comma = value.find(',');
+    std::string_view item = value.substr(0, comma);
+    while (!item.empty() && item.front() == ' ') {
+      item.remove_prefix(1);
+    }
+    while (!item.empty() && item.back() == ' ') {
+      item.remove_suffix(1);
+    }
+    if (equalsIgnoreCase(item, token)) {
+      return true;
+    }
+    if (comma == std::string_view::npos) {
+      break;
+    }
+    value.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+}  // namespace
+
+const char* frameErrorName(FrameError error) {
+  switch (error) {
+    case FRAME_OK:
+      return "OK";
+    case FRAME_INCOMPLETE:
+      return "Incomplete frame";
+    case FRAME_UNMASKED:
+      return "Client frame is not masked";
+    case FRAME_TOO_LARGE:
+      return "Frame is too large";
+    case FRAME_UNSUPPORTED:
+      return "Unsupported frame";
+  }
+  return "Unknown error";
+}
+
+FrameError parseWebSocketFrame(std::string_view data, size_t max_payload,
+                               WebSocketFrame* frame, size_t* frame_size) {
+  if (data.size() < 2) {
+    return FRAME_INCOMPLETE;
+  }
+  const auto* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  bool fin = bytes[0] & 0x80;
+  int opcode = bytes[0] & 0x0f;
+  // No extensions are negotiated, so the reserved bits must be 0.
+  if ((bytes[0] & 0x70) != 0) {
+    return FRAME_UNSUPPORTED;
+  }
+  bool is_control = opcode & 0x8;
+  if (opcode != WS_CONTINUATION && opcode != WS_TEXT && opcode != WS_BINARY &&
+      opcode != WS_CLOSE && opcode != WS_PING && opcode != WS_PONG) {
+    return FRAME_UNSUPPORTED;
+  }
+  if (!(bytes[1] & 0x80)) {
+    return FRAME_UNMASKED;
+  }
+
+  uint64_t length = bytes[1] & 0x7f;
+  size_t header_size = 2;
+  if (length == 126) {
+    header_size += 2;
+  } else if (length == 127) {
+    header_size += 8;
+  }
+  if (data.size() < header_size) {
+    return FRAME_INCOMPLETE;
+  }
+  if (length >= 126) {
+    length = 0;
+    for (size_t i = 2; i < header_size; i++) {
+      length = (length << 8) | bytes[i];
+    }
+  }
+  // Control frames can't be fragmented, and have short payloads.
+  if (is_control && (!fin || length > 125)) {
+    return FRAME_UNSUPPORTED;
+  }
+  if (length > max_payload) {
+    return FRAME_TOO_LARGE;
+  }
+
+  const uint8_t* mask = bytes + header_size;
+  header_size += 4;
+  if (data.size() < header_size + length) {
+    return FRAME_INCOMPLETE;
+  }
+
+  frame->fin = fin;
+  frame->opcode = static_cast<WebSocketOpcode>(opcode);
+  frame->payload.assign(data.data() + header_size, length);
+  for (size_t i = 0; i < length; i++) {
+    frame->payload[i] ^= mask[i % 4];
+  }
+  *frame_size = header_size + length;
+  return FRAME_OK;
+}
+
+void appendWebSocketFrame(WebSocketOpcode opcode, std::string_view payload,
+                          std::string* out) {
+  *out += static_cast<char>(0x80 | opcode);
+  uint64_t length = payload.size();
+  if (length < 126) {
+    *out += static_cast<char>(length);
+  } else if (length <= 0xffff) {
+    *out += static_cast<char>(126);
+    *out += static_cast<char>(length >> 8);
+    *out += static_cast<char>(length);
+  } else {
+    *out += static_cast<char>(127);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      *out += static_cast<char>(length >> shift);
+    }
+  }
+  *out += payload;
+}
+
+std::string webSocketAccept(std::string_view key) {
+  std::string data(key);
+  data += WEBSOCKET_GUID;
+  uint8_t hash[SHA1_SIZE];
+  sha1(data, hash);
+  return base64(hash, SHA1_SIZE);
+}
+
+int parseWebSocketUpgrade(std::string_view request, std::string* path,
+                          std::string* key) {
+  size_t line_end = request.find("\r\n");
+  if (line_end == std::string_view::npos) {
+    return 1;
+  }
+  // The request line: GET <path> HTTP/1.1
+  std::string_view request_line = request.substr(0, line_end);
+  if (request_line.substr(0, 4) != "GET ") {
+    return 1;
+  }
+  size_t path_end = request_line.find(' ', 4);
+  if (path_end == std::string_view::npos ||
+      request_line.substr(path_end + 1, 5) != "HTTP/") {
+    return 1;
+  }
+  *path = std::string(request_line.substr(4, path_end - 4));
+
+  bool upgrade = false;
+  key->clear();
+  request.remove_prefix(line_end + 2);
+  while ((line_end = request.find("\r\n")) != std::string_view::npos &&
+         line_end > 0) {
+    std::string_view line = request.substr(0, line_end);
+    request.remove_prefix(line_end + 2);
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      return 1;
+    }
+    std::string_view name = line.substr(0, colon);
+    std::string_view value = line.substr(colon + 1);
+    while (!value.empty() && value.front() == ' ') {
+      value.remove_prefix(1);
+    }
+    while (!value.empty() && value.back() == ' ') {
+      value.remove_suffix(1);
+    }
+    if (equalsIgnoreCase(name, "Upgrade")) {
+      upgrade = hasToken(value, "websocket");
+    } else if (equalsIgnoreCase(name, "Sec-WebSocket-Key")) {
+      *key = std::string(value);
+    }
+  }
+  return upgrade && !key->empty() ? 0 : 1;
+}
+
+std::string webSocketUpgradeResponse(std::string_view key) {
+  return "HTTP/1.1 101 Switching Protocols\r\n"
+         "Upgrade: websocket\r\n"
+         "Connection: Upgrade\r\n"
+         "Sec-WebSocket-Accept: " +
+         webSocketAccept(key) + "\r\n\r\n";
+}
+
+}  // namespace habits
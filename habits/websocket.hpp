@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace habits {
+
+// The frame types of the WebSocket protocol (RFC 6455).
+enum WebSocketOpcode {
+  WS_CONTINUATION = 0x0,
+  WS_TEXT = 0x1,
+  WS_BINARY = 0x2,
+  WS_CLOSE = 0x8,
+  WS_PING = 0x9,
+  WS_PONG = 0xa,
+};
+
+// A single frame received from a WebSocket client, with the payload unmasked.
+struct WebSocketFrame {
+  // Whether this is the last frame of a message.
+  bool fin = true;
+  WebSocketOpcode opcode = WS_TEXT;
+  std::string payload;
+};
+
+enum FrameError {
+  FRAME_OK,
+  // More data is needed for a whole frame.
+  FRAME_INCOMPLETE,
+  // Frames sent by clients must be masked.
+  FRAME_UNMASKED,
+  FRAME_TOO_LARGE,
+  // An unknown opcode, extension bits that weren't negotiated, or a bad
+  // control frame.
+  FRAME_UNSUPPORTED,
+};
+
+// A short human readable description of the frame error.
+const char* frameErrorName(FrameError error);
+
+// Parse the frame at the start of `data`, received from a client, into
+// `frame`, and set `frame_size` to the number of bytes it took up. Frames with
+// payloads longer than `max_payload` are rejected.
+FrameError parseWebSocketFrame(std::string_view data, size_t max_payload,
+                               WebSocketFrame* frame, size_t* frame_size);
+
+// Append an unmasked frame, as sent by servers, holding a whole message.
+void appendWebSocketFrame(WebSocketOpcode opcode, std::string_view payload,
+                          std::string* out);
+
+// The Sec-WebSocket-Accept value for the Sec-WebSocket-Key sent by a client:
+// the base64 encoded SHA-1 hash of the key and the protocol's GUID.
+std::string webSocketAccept(std::string_view key);
+
+// Parse the HTTP request headers (up to and including the blank line) of a
+// WebSocket handshake, setting `path` to the request target and `key` to the
+// Sec-WebSocket-Key. Returns 0 on success, or 1 if it's not a valid GET request
+// to upgrade to a WebSocket.
+int parseWebSocketUpgrade(std::string_view request, std::string* path,
+                          std::string* key);
+
+// The HTTP response that accepts the handshake for the client's key.
+std::string webSocketUpgradeResponse(std::string_view key);
+
+}  // namespace habits
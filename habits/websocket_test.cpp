@@ -0,0 +1,137 @@
+#include "websocket.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace habits {
+
+namespace {
+
+// A frame as a client would send it, masked with a fixed key.
+std::string clientFrame(int first_byte, const std::string& payload) {
+  const char mask[] = {0x12, 0x34, 0x56, 0x78};
+  std::string frame;
+  frame += static_cast<char>(first_byte);
+  if (payload.size() < 126) {
+    frame += static_cast<char>(0x80 | payload.size());
+  } else {
+    frame += static_cast<char>(0x80 | 126);
+    frame += static_cast<char>(payload.size() >> 8);
+    frame += static_cast<char>(payload.size());
+  }
+  frame.append(mask, sizeof(mask));
+  for (size_t i = 0; i < payload.size(); i++) {
+    frame += static_cast<char>(payload[i] ^ mask[i % 4]);
+  }
+  return frame;
+}
+
+TEST(WebSocketTest, AcceptKey) {
+  // The example from RFC 6455.
+  EXPECT_EQ(webSocketAccept("dGhlIHNhbXBsZSBub25jZQ=="),
+            "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+}
+
+TEST(WebSocketTest, ParsesUpgrade) {
+  std::string path;
+  std::string key;
+  EXPECT_EQ(parseWebSocketUpgrade("GET /engine/channel?x=1 HTTP/1.1\r\n"
+                                  "Host: localhost:8081\r\n"
+                                  "upgrade: WebSocket\r\n"
+                                  "Connection: keep-alive, Upgrade\r\n"
+                                  "Sec-WebSocket-Key:  abc== \r\n"
+                                  "Sec-WebSocket-Version: 13\r\n\r\n",
+                                  &path, &key),
+            0);
+  EXPECT_EQ(path, "/engine/channel?x=1");
+  EXPECT_EQ(key, "abc==");
+
+  // Not an upgrade.
+  EXPECT_EQ(parseWebSocketUpgrade("GET / HTTP/1.1\r\n"
+                                  "Sec-WebSocket-Key: abc==\r\n\r\n",
+                                  &path, &key),
+            1);
+  // No key.
+  EXPECT_EQ(parseWebSocketUpgrade("GET / HTTP/1.1\r\n"
+                                  "Upgrade: websocket\r\n\r\n",
+                                  &path, &key),
+            1);
+  EXPECT_EQ(parseWebSocketUpgrade("POST / HTTP/1.1\r\n"
+                                  "Upgrade: websocket\r\n"
+                                  "Sec-WebSocket-Key: abc==\r\n\r\n",
+                                  &path, &key),
+            1);
+}
+
+TEST(WebSocketTest, ParsesFrames) {
+  std::string data = clientFrame(0x81, "hello") +
+                     clientFrame(0x01, std::string(300, 'x')) +
+                     clientFrame(0x89, "");
+  WebSocketFrame frame;
+  size_t frame_size;
+
+  ASSERT_EQ(parseWebSocketFrame(data, 1024, &frame, &frame_size), FRAME_OK);
+  EXPECT_TRUE(frame.fin);
+  EXPECT_EQ(frame.opcode, WS_TEXT);
+  EXPECT_EQ(frame.payload, "hello");
+  data.erase(0, frame_size);
+
+  ASSERT_EQ(parseWebSocketFrame(data, 1024, &frame, &frame_size), FRAME_OK);
+  EXPECT_FALSE(frame.fin);
+  EXPECT_EQ(frame.payload, std::string(300, 'x'));
+  data.erase(0, frame_size);
+
+  ASSERT_EQ(parseWebSocketFrame(data, 1024, &frame, &frame_size), FRAME_OK);
+  EXPECT_EQ(frame.opcode, WS_PING);
+  EXPECT_EQ(frame.payload, "");
+  EXPECT_EQ(frame_size, data.size());
+}
+
+TEST(WebSocketTest, RejectsBadFrames) {
+  WebSocketFrame frame;
+  size_t frame_size;
+  std::string whole = clientFrame(0x81, "hello");
+  for (size_t size = 0; size < whole.size(); size++) {
+    EXPECT_EQ(parseWebSocketFrame(whole.substr(0, size), 1024, &frame,
+                                  &frame_size),
+              FRAME_INCOMPLETE);
+  }
+  EXPECT_EQ(parseWebSocketFrame(clientFrame(0x81, "hello"), 4, &frame,
+                                &frame_size),
+            FRAME_TOO_LARGE);
+  std::string unmasked = "\x81\x02hi";
+  EXPECT_EQ(parseWebSocketFrame(unmasked, 1024, &frame, &frame_size),
+            FRAME_UNMASKED);
+  // Reserved bits, an unknown opcode, and a fragmented control frame.
+  EXPECT_EQ(parseWebSocketFrame(clientFrame(0xc1, "hi"), 1024, &frame,
+                                &frame_size),
+            FRAME_UNSUPPORTED);
+  EXPECT_EQ(parseWebSocketFrame(clientFrame(0x83, "hi"), 1024, &frame,
+                                &frame_size),
+            FRAME_UNSUPPORTED);
+  EXPECT_EQ(parseWebSocketFrame(clientFrame(0x09, "hi"), 1024, &frame,
+                                &frame_size),
+            FRAME_UNSUPPORTED);
+}
+
+TEST(WebSocketTest, WritesFrames) {
+  std::string out;
+  appendWebSocketFrame(WS_TEXT, "hi", &out);
+  EXPECT_EQ(out, "\x81\x02hi");
+
+  out.clear();
+  appendWebSocketFrame(WS_TEXT, std::string(200, 'x'), &out);
+  EXPECT_EQ(out.substr(0, 4), std::string("\x81\x7e\x00\xc8", 4));
+  EXPECT_EQ(out.size(), 204);
+
+  out.clear();
+  appendWebSocketFrame(WS_BINARY, std::string(70000, 'x'), &out);
+  EXPECT_EQ(out.substr(0, 10),
+            std::string("\x82\x7f\x00\x00\x00\x00\x00\x01\x11\x70", 10));
+  EXPECT_EQ(out.size(), 70010);
+}
+
+}  // namespace
+}  // namespace habits
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace habits {
+
+// A fixed number of threads running tasks from a bounded queue. Submitting
+// never blocks: once the queue is full, tasks are rejected so the caller can
+// shed the load straight away.
+class WorkerPool {
+ public:
+  WorkerPool(int threads, size_t max_queued);
+
+  // Runs the tasks already queued, then joins the threads.
+  ~WorkerPool();
+
+  // Queue a task to run on one of the threads. Returns false, without queueing
+  // the task, if `max_queued` tasks are already waiting for a thread.
+  bool TrySubmit(std::function<void()> task);
+
+  // The number of threads running tasks.
+  size_t Threads() const { return threads_.size(); }
+
+  // The number of tasks waiting for a thread.
+  size_t Queued() const;
+
+  // The number of tasks rejected because the queue was full.
+  uint64_t Rejected() const;
+
+ private:
+  void work();
+
+  const size_t max_queued_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable task_ready_;
+  std::deque<std::function<void()>> tasks_;
+  uint64_t rejected_ = 0;
+  bool stopping_ = false;
+
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace habits
@@ -0,0 +1,62 @@
+#include "worker_pool.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace habits {
+
+namespace {
+
+TEST(WorkerPoolTest, RunsTasks) {
+  std::atomic<int> ran{0};
+  {
+    WorkerPool pool(4, 1000);
+    for (int i = 0; i < 1000; i++) {
+      ASSERT_TRUE(pool.TrySubmit([&ran]() { ran++; }));
+    }
+  }
+  // Destroying the pool runs all the queued tasks.
+  EXPECT_EQ(ran, 1000);
+}
+
+TEST(WorkerPoolTest, RejectsWhenFull) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool started = false;
+  bool release = false;
+  std::atomic<int> ran{0};
+  {
+    WorkerPool pool(1, 2);
+    // Block the only thread, so the next tasks stay queued.
+    ASSERT_TRUE(pool.TrySubmit([&]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      started = true;
+      cv.notify_all();
+      cv.wait(lock, [&]() { return release; });
+    }));
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&]() { return started; });
+    }
+
+    EXPECT_TRUE(pool.TrySubmit([&ran]() { ran++; }));
+    EXPECT_TRUE(pool.TrySubmit([&ran]() { ran++; }));
+    EXPECT_FALSE(pool.TrySubmit([&ran]() { ran++; }));
+    EXPECT_EQ(pool.Queued(), 2);
+    EXPECT_EQ(pool.Rejected(), 1);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      release = true;
+    }
+    cv.notify_all();
+  }
+  EXPECT_EQ(ran, 2);
+}
+
+}  // namespace
+}  // namespace habits
@@ -12,11 +12,12 @@ function isCustomEvent(event: Event): event is CustomEvent {
 }
 
 interface GameState {
+  game: string;
   fen: string;
   last_move: string;
   turn: string;
   legal: { [key: string]: string[] };
-  control: { [key: string]: number };
+  control?: { [key: string]: number };
   in_check: boolean;
   in_checkmate: boolean;
   in_draw: boolean;
@@ -28,6 +29,7 @@ const flip = queryParams.has('flip');
 const engine = flip ? 'w' : 'b';
 
 let state: GameState = {
+  game: '',
   fen: queryParams.get('fen') || startpos,
   last_move: '',
   turn: 'w',
@@ -38,6 +40,7 @@ let state: GameState = {
   in_draw: false
 };
 let pgn = '';
+let channel: WebSocket;
 
 const controlStyles = document.createElement('style');
 document.head.append(controlStyles);
@@ -110,7 +113,7 @@ board.addEventListener('drag-start', (e: Event) => {
   }
 });
 
-board.addEventListener('drop', async (e: Event) => {
+board.addEventListener('drop', (e: Event) => {
   if (!isCustomEvent(e))
     throw new Error('not a custom event');
 
@@ -135,27 +138,9 @@ board.addEventListener('drop', async (e: Event) => {
     move += 'q';
   }
 
-  const params = new URLSearchParams({ fen: state.fen });
-  try {
-    const response = await fetch('http://localhost:8080/engine/move/' + move + '?' + params.toString());
-    if (response.status !== 200) {
-      console.log(response);
-      setAction('snapback');
-      return;
-    }
-    const json = await response.json();
-    console.log(json);
-    updateState(json);
-  } catch (e) {
-    console.log(e);
-    setAction('snapback');
-    return;
-  }
-
-  if (state.turn == engine && !state.in_checkmate && !state.in_draw) {
-    // Make a move from the engine.
-    nextMove();
-  }
+  // The server sends back the position after the move, followed by the
+  // engine's reply.
+  channel.send(JSON.stringify({ type: 'move', move: move }));
 });
 
 board.addEventListener('mouseover-square', (e) => {
@@ -195,46 +180,33 @@ board.addEventListener('snap-end', (e: Event) => {
   board.setPosition(state.fen);
 });
 
-async function initializeBoard() {
-  const params = new URLSearchParams({ fen: state.fen });
-  try {
-    const response = await fetch('http://localhost:8080/engine/newgame?' + params.toString());
-    if (response.status === 200) {
-      const json = await response.json();
-      console.log(json);
-      updateState(json);
-    } else {
-      console.log(response);
-    }
-  } catch (e) {
-    console.log(e);
-  }
-
+function initializeBoard() {
   if (board && flip) {
     board.orientation = 'black';
   }
 
-  if (state.turn == engine && !state.in_checkmate && !state.in_draw) {
-    // Make a move from the engine.
-    nextMove();
-  }
-}
-
-async function nextMove() {
-  const params = new URLSearchParams({ fen: state.fen });
-  try {
-    const response = await fetch('http://localhost:8080/engine/search' + '?' + params.toString());
-    if (response.status !== 200) {
-      console.log(response);
+  // Play the game over a WebSocket, the engine's moves are pushed as soon as
+  // they are found.
+  channel = new WebSocket('ws://localhost:8081/engine/channel');
+  channel.addEventListener('open', () => {
+    // The control squares are the most expensive part of the response, so only
+    // ask for them when they're shown.
+    const fields = showControl ? 'legal,control,check,status' : 'legal,check,status';
+    channel.send(JSON.stringify({ type: 'newgame', fen: state.fen, engine: engine, fields: fields }));
+  });
+  channel.addEventListener('message', (event: MessageEvent) => {
+    const json = JSON.parse(event.data);
+    console.log(json);
+    if ('error' in json) {
+      // Put back the piece that was moved.
+      board!.setPosition(state.fen, false);
       return;
     }
-    const json = await response.json();
-    console.log(json);
     updateState(json);
-  } catch (e) {
-    console.log(e);
-    return;
-  }
+  });
+  channel.addEventListener('close', (event: CloseEvent) => {
+    console.log(event);
+  });
 }
 
 function updateState(newState: GameState) {
@@ -243,7 +215,7 @@ function updateState(newState: GameState) {
 
   highlightStyles.textContent = initialHighlightStyles();
   controlStyles.textContent = '';
-  if (showControl) {
+  if (showControl && state.control) {
     for (const [square, control] of Object.entries(state.control)) {
       if (control == 0) { continue; }
       let redColor = '255';
@@ -1,13 +1,53 @@
 #include <wordexp.h>
 
 #include <algorithm>
+#include <csignal>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <thread>
 
+#include "habits/analyze.hpp"
 #include "habits/bot.hpp"
 #include "habits/http.hpp"
+#include "habits/log.hpp"
+#include "habits/pgn.hpp"
+#include "habits/position.hpp"
+#include "habits/search.hpp"
+#include "habits/stats.hpp"
+
+// Find the value of a flag given as either "--flag=value" or "--flag value".
+// Returns false if the flag is not present or has no value.
+bool flagValue(int argc, char *argv[], const std::string &flag,
+               std::string *value) {
+  for (int i = 1; i < argc; i++) {
+    std::string s(argv[i]);
+    if (s.rfind(flag + "=", 0) == 0) {
+      *value = s.substr(flag.size() + 1);
+      return true;
+    }
+    if (s == flag && i + 1 < argc) {
+      *value = argv[i + 1];
+      return true;
+    }
+  }
+  return false;
+}
+
+// The number of threads from the --threads flag, defaulting to the number of
+// cores.
+int threadsFlag(int argc, char *argv[]) {
+  std::string threads_flag;
+  if (flagValue(argc, argv, "--threads", &threads_flag)) {
+    return std::max(1, std::atoi(threads_flag.c_str()));
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// The number of Lichess games played at the same time, unless set with the
+// --games flag.
+constexpr int DEFAULT_LICHESS_GAMES = 4;
 
 int lichessMode(int argc, char *argv[]) {
   std::string token_file = "~/.lichess-token";
@@ -52,18 +92,107 @@ int lichessMode(int argc, char *argv[]) {
   }
   wordfree(&parsed_token_file);
 
-  habits::LichessBot bot(token);
+  std::signal(SIGUSR1, [](int) { habits::requestRuleStatsDump(); });
+
+  int max_games = DEFAULT_LICHESS_GAMES;
+  std::string games_flag;
+  if (flagValue(argc, argv, "--games", &games_flag)) {
+    max_games = std::max(1, std::atoi(games_flag.c_str()));
+  }
+
+  habits::LichessBot bot(token, max_games, threadsFlag(argc, argv));
   return bot.listenForChallenges();
 }
 
+int replayMode(int argc, char *argv[]) {
+  std::string pgn_file;
+  if (!flagValue(argc, argv, "--replay", &pgn_file)) {
+    std::cerr << "--replay flag was not followed by a file name" << std::endl;
+    return 14;
+  }
+  int threads = threadsFlag(argc, argv);
+  bool run_habits =
+      std::find(argv, argv + argc, std::string("--habits")) != argv + argc;
+
+  habits::PgnReplayStats stats;
+  int result = habits::replayPgnFile(
+      pgn_file, threads,
+      [run_habits](const habits::Position &p, int ply,
+                   const std::string &move) {
+        if (!run_habits) {
+          return;
+        }
+        // Each thread replays whole games, so a game's positions all reach
+        // the same thread's Game.
+        thread_local habits::Game game;
+        if (ply == 0) {
+          game = habits::Game();
+        }
+        if (!move.empty()) {
+          game.bestMove(p);
+          game.opponentMove(move);
+        }
+      },
+      &stats);
+  if (result != 0) {
+    std::cerr << "Failed to read PGN file: " << pgn_file << std::endl;
+    return result;
+  }
+
+  std::cout << "Replayed " << stats.games << " games (" << stats.positions
+            << " positions, " << stats.errors << " errors) in "
+            << stats.seconds << "s on " << threads << " threads: "
+            << stats.GamesPerSecond() << " games/sec" << std::endl;
+  if (run_habits) {
+    std::cout << habits::ruleStatsReport();
+  }
+  return 0;
+}
+
+int analyzeMode(int argc, char *argv[]) {
+  std::string epd_file;
+  if (!flagValue(argc, argv, "--analyze", &epd_file)) {
+    std::cerr << "--analyze flag was not followed by a file name" << std::endl;
+    return 15;
+  }
+  std::ifstream input(epd_file);
+  if (!input.good()) {
+    std::cerr << "Failed to open file: " << epd_file << std::endl;
+    return 16;
+  }
+  int threads = threadsFlag(argc, argv);
+
+  // The results go to stdout, so the summary goes to stderr.
+  std::ios::sync_with_stdio(false);
+  habits::AnalyzeStats stats = habits::analyzeStream(input, std::cout, threads);
+  std::cout.flush();
+  std::cerr << "Analyzed " << stats.positions << " positions (" << stats.errors
+            << " errors) in " << stats.seconds << "s on " << threads
+            << " threads: " << stats.PositionsPerSecond() << " positions/sec"
+            << std::endl;
+  if (stats.scored > 0) {
+    std::cerr << "Best moves found: " << stats.correct << "/" << stats.scored
+              << " (" << 100.0 * stats.correct / stats.scored << "%)"
+              << std::endl;
+  }
+  if (std::find(argv, argv + argc, std::string("--stats")) != argv + argc) {
+    std::cerr << habits::ruleStatsReport();
+  }
+  return 0;
+}
+
 int httpMode(int argc, char *argv[]) {
   bool debug = false;
   if (std::find(argv, argv + argc, std::string("--debug")) != argv + argc) {
     debug = true;
+    habits::setLogLevel(habits::LOG_DEBUG);
   }
 
+  std::string static_directory = "../static";
+  flagValue(argc, argv, "--static", &static_directory);
+
   habits::HttpServer http;
-  http.listenHttp(debug);
+  http.listenHttp(static_directory, debug);
   return 0;
 }
 
@@ -75,22 +204,84 @@ int main(int argc, char *argv[]) {
     std::cout << "  --help       = Print usage information and exit."
               << std::endl;
     std::cout << "  --lichess    = Switch to Lichess Bot mode." << std::endl;
+    std::cout << "  --log-level  = Only log messages at this level or above: "
+                 "debug, info (the default), warning or error."
+              << std::endl;
+    std::cout << "  --replay     = Replay the games in a PGN file and exit."
+              << std::endl;
+    std::cout << "  --analyze    = Analyze the positions in a FEN or EPD file "
+                 "and exit."
+              << std::endl;
+    std::cout << std::endl;
+    std::cout << "Rule statistics are served at /engine/stats in HTTP mode, "
+                 "and printed on SIGUSR1 in Lichess Bot mode."
+              << std::endl;
     std::cout << std::endl;
     std::cout << "Options for HTTP mode (the default)" << std::endl;
-    std::cout << "  --debug      = Print HTTP debugging messages." << std::endl;
+    std::cout << "  --debug      = Print HTTP debugging messages, and log at "
+                 "debug level."
+              << std::endl;
+    std::cout << "  --static     = The directory of static files to serve. "
+                 "Defaults to ../static"
+              << std::endl;
     std::cout << std::endl;
     std::cout << "Options for Lichess Bot mode (started with --lichess)"
               << std::endl;
     std::cout << "  --token_file = Specify the file to get the OAUTH2 token "
                  "from. Defaults to ~/.lichess-token"
               << std::endl;
+    std::cout << "  --games      = Number of games to play at the same time. "
+                 "Defaults to 4."
+              << std::endl;
+    std::cout << "  --threads    = Number of threads to find moves on. "
+                 "Defaults to the number of cores."
+              << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options for PGN replay mode (started with --replay <file>)"
+              << std::endl;
+    std::cout << "  --threads    = Number of threads to replay games on. "
+                 "Defaults to the number of cores."
+              << std::endl;
+    std::cout << "  --habits     = Also find the best move in every position, "
+                 "and print the rule statistics."
+              << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options for analysis mode (started with --analyze <file>)"
+              << std::endl;
+    std::cout << "  --threads    = Number of threads to analyze positions on. "
+                 "Defaults to the number of cores."
+              << std::endl;
+    std::cout << "  --stats      = Also print the rule statistics."
+              << std::endl;
     std::cout << std::endl;
     return 0;
   }
 
+  std::string log_level_flag;
+  if (flagValue(argc, argv, "--log-level", &log_level_flag)) {
+    habits::LogLevel log_level;
+    if (habits::parseLogLevel(log_level_flag, &log_level) != 0) {
+      std::cerr << "Unknown --log-level: " << log_level_flag << std::endl;
+      return 17;
+    }
+    habits::setLogLevel(log_level);
+  }
+
   if (std::find(argv, argv + argc, std::string("--lichess")) != argv + argc) {
     return lichessMode(argc, argv);
   }
 
+  if (std::find_if(argv, argv + argc, [](const char *arg) {
+        return std::string(arg).rfind("--replay", 0) == 0;
+      }) != argv + argc) {
+    return replayMode(argc, argv);
+  }
+
+  if (std::find_if(argv, argv + argc, [](const char *arg) {
+        return std::string(arg).rfind("--analyze", 0) == 0;
+      }) != argv + argc) {
+    return analyzeMode(argc, argv);
+  }
+
   return httpMode(argc, argv);
 }